@@ -0,0 +1,560 @@
+/*
+ * Copyright © 2014 Manuel Bachmann
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Microbenchmarks for the toolkit drawing paths. Everything here runs
+ * on image surfaces, so no compositor is needed:
+ *
+ *	make bench
+ *	./wlmessage-bench [filter]
+ *
+ * Each line reports the time per operation, the heap allocations per
+ * operation (counted by wrapping malloc and friends, glibc only) and
+ * the pixel throughput where it makes sense.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <cairo.h>
+#include <pixman.h>
+#include <jpeglib.h>
+#include <wayland-client.h>
+
+#include "shared/cairo-util.h"
+#include "shared/image-loader.h"
+#include "shared/tile-pool.h"
+#include "wlmessage-draw.h"
+
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+
+/* Minimum run time of each benchmark, in nanoseconds */
+#define BENCH_MIN_NS 200000000ULL
+
+static uint64_t allocations;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+void *
+malloc(size_t size)
+{
+	allocations++;
+	return __libc_malloc(size);
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	allocations++;
+	return __libc_calloc(nmemb, size);
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	allocations++;
+	return __libc_realloc(ptr, size);
+}
+
+struct bench {
+	void (*run)(struct bench *bench);
+	int width, height;
+	uint32_t arg;
+
+	/* Per benchmark state, set up outside the timed loop */
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	struct theme *theme;
+	struct frame *frame;
+	const char *path;
+	struct tile_pool *pool;
+};
+
+static const char *filter;
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+bench_report(struct bench *bench, const char *name)
+{
+	uint64_t start, elapsed, allocs, n, iterations = 1;
+	double ns, pixels;
+
+	if (filter && !strstr(name, filter))
+		return;
+
+	/* Warm up caches and lazily created cairo state */
+	bench->run(bench);
+
+	for (;;) {
+		allocs = allocations;
+		start = now_ns();
+		for (n = 0; n < iterations; n++)
+			bench->run(bench);
+		elapsed = now_ns() - start;
+		allocs = allocations - allocs;
+
+		if (elapsed >= BENCH_MIN_NS)
+			break;
+		iterations *= 2;
+	}
+
+	ns = (double) elapsed / iterations;
+	printf("%-36s %8llu iter %12.0f ns/op %8.1f allocs/op",
+	       name, (unsigned long long) iterations, ns,
+	       (double) allocs / iterations);
+
+	pixels = (double) bench->width * bench->height;
+	if (pixels > 0)
+		printf(" %10.1f Mpix/s", pixels / ns * 1000.0);
+
+	printf("\n");
+}
+
+static cairo_surface_t *
+create_surface(int width, int height)
+{
+	return cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+}
+
+static void
+run_blur_surface(struct bench *bench)
+{
+	blur_surface(bench->surface, bench->arg);
+}
+
+static void
+run_theme_create(struct bench *bench)
+{
+	theme_destroy(theme_create());
+}
+
+static void
+run_theme_render_frame(struct bench *bench)
+{
+	theme_render_frame(bench->theme, bench->cr,
+			   bench->width, bench->height,
+			   "wlmessage", bench->arg);
+}
+
+static void
+run_tile_mask(struct bench *bench)
+{
+	struct theme *t = bench->theme;
+
+	tile_mask(bench->cr, t->shadow, 2, 2,
+		  bench->width + 8, bench->height + 8, 64, 64);
+}
+
+static void
+run_frame_repaint(struct bench *bench)
+{
+	frame_repaint(bench->frame, bench->cr);
+}
+
+static void
+run_load_image(struct bench *bench)
+{
+	pixman_image_t *image;
+
+	image = load_image(bench->path);
+	if (image)
+		pixman_image_unref(image);
+}
+
+static void
+run_transform(struct bench *bench)
+{
+	cairo_identity_matrix(bench->cr);
+	transform_cairo_to_buffer(bench->cr, bench->arg, 1,
+				  bench->width, bench->height);
+	cairo_rectangle(bench->cr, 0, 0, bench->width, bench->height);
+	cairo_fill(bench->cr);
+}
+
+static char message[] =
+	"The quick brown fox jumps over the lazy dog.\n"
+	"Pack my box with five dozen liquor jugs.\n"
+	"How vexingly quick daft zebras jump!";
+
+static void
+run_draw_message(struct bench *bench)
+{
+	struct rectangle allocation = { 0, 0, bench->width, bench->height };
+
+	draw_message(bench->cr, &allocation, message, NULL, 1, 2);
+}
+
+static void
+run_draw_button(struct bench *bench)
+{
+	struct rectangle allocation = { 0, 0, bench->width, bench->height };
+
+	draw_button(bench->cr, &allocation, "Cancel", 1);
+}
+
+static void
+run_draw_entry(struct bench *bench)
+{
+	struct rectangle allocation = { 0, 0, bench->width, bench->height };
+
+	draw_entry(bench->cr, &allocation, "/usr/local/app  ", 10, 1);
+}
+
+/*
+ * A full window repaint as the toolkit does it for large surfaces:
+ * every band gets its own image surface over its rows of the shared
+ * buffer, and runs the whole repaint.
+ */
+static void
+paint_window_tile(const cairo_rectangle_int_t *tile, void *data)
+{
+	struct bench *bench = data;
+	struct rectangle allocation = {
+		32, 32, bench->width - 64, bench->height - 64
+	};
+	int stride = cairo_image_surface_get_stride(bench->surface);
+	cairo_surface_t *band;
+	cairo_t *cr;
+
+	band = cairo_image_surface_create_for_data(
+		cairo_image_surface_get_data(bench->surface) + tile->y * stride,
+		cairo_image_surface_get_format(bench->surface),
+		tile->width, tile->height, stride);
+	cairo_surface_set_device_offset(band, 0, -tile->y);
+	cr = cairo_create(band);
+
+	cairo_save(cr);
+	theme_render_frame(bench->theme, cr, bench->width, bench->height,
+			   "wlmessage", THEME_FRAME_ACTIVE);
+	cairo_restore(cr);
+	draw_message(cr, &allocation, message, NULL, 1, 2);
+
+	cairo_destroy(cr);
+	cairo_surface_destroy(band);
+}
+
+static void
+run_tiled_repaint(struct bench *bench)
+{
+	cairo_surface_flush(bench->surface);
+	tile_pool_run(bench->pool, bench->width, bench->height,
+		      paint_window_tile, bench);
+	cairo_surface_mark_dirty(bench->surface);
+}
+
+/* Whether the tiled repaint gives the same pixels as with one thread */
+static int
+check_tiled_repaint(struct bench *bench, cairo_surface_t *reference)
+{
+	int stride = cairo_image_surface_get_stride(reference);
+
+	memset(cairo_image_surface_get_data(bench->surface), 0,
+	       stride * bench->height);
+	run_tiled_repaint(bench);
+
+	return memcmp(cairo_image_surface_get_data(bench->surface),
+		      cairo_image_surface_get_data(reference),
+		      stride * bench->height) == 0;
+}
+
+static void
+bench_setup_cr(struct bench *bench)
+{
+	bench->surface = create_surface(bench->width, bench->height);
+	bench->cr = cairo_create(bench->surface);
+}
+
+static void
+bench_cleanup(struct bench *bench)
+{
+	if (bench->frame)
+		frame_destroy(bench->frame);
+	if (bench->cr)
+		cairo_destroy(bench->cr);
+	if (bench->surface)
+		cairo_surface_destroy(bench->surface);
+	bench->frame = NULL;
+	bench->cr = NULL;
+	bench->surface = NULL;
+}
+
+/*
+ * There is no JPEG among the shipped icons, so encode one from the
+ * window icon to exercise the JPEG loader.
+ */
+static int
+write_jpeg(const char *png, const char *jpeg)
+{
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+	pixman_image_t *image;
+	uint32_t *pixels;
+	JSAMPROW row;
+	uint8_t *rgb;
+	FILE *fp;
+	int x, y, width, height, stride;
+
+	image = load_image(png);
+	if (!image)
+		return -1;
+
+	fp = fopen(jpeg, "wb");
+	if (!fp) {
+		pixman_image_unref(image);
+		return -1;
+	}
+
+	width = pixman_image_get_width(image);
+	height = pixman_image_get_height(image);
+	stride = pixman_image_get_stride(image);
+	rgb = malloc(width * 3);
+
+	cinfo.err = jpeg_std_error(&jerr);
+	jpeg_create_compress(&cinfo);
+	jpeg_stdio_dest(&cinfo, fp);
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_start_compress(&cinfo, TRUE);
+
+	for (y = 0; y < height; y++) {
+		pixels = (uint32_t *) ((uint8_t *)
+			pixman_image_get_data(image) + y * stride);
+		for (x = 0; x < width; x++) {
+			rgb[x * 3 + 0] = pixels[x] >> 16;
+			rgb[x * 3 + 1] = pixels[x] >> 8;
+			rgb[x * 3 + 2] = pixels[x];
+		}
+		row = rgb;
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	fclose(fp);
+	free(rgb);
+	pixman_image_unref(image);
+
+	return 0;
+}
+
+static const struct {
+	int width, height;
+} sizes[] = {
+	{ 128, 128 },
+	{ 404, 183 },
+	{ 800, 600 },
+	{ 1920, 1080 },
+};
+
+static const char *transform_names[] = {
+	"normal", "90", "180", "270",
+	"flipped", "flipped-90", "flipped-180", "flipped-270",
+};
+
+static const int tile_threads[] = { 1, 2, 4, 8 };
+
+static const char *icons[] = {
+	"icon_window.png",
+	"sign_close.png",
+	"sign_maximize.png",
+	"sign_minimize.png",
+};
+
+int
+main(int argc, char *argv[])
+{
+	struct bench bench;
+	struct theme *theme;
+	cairo_surface_t *reference;
+	char name[128], path[256], jpeg[64];
+	unsigned int i;
+	int ret = EXIT_SUCCESS;
+
+	if (argc > 1)
+		filter = argv[1];
+
+	theme = theme_create();
+	if (!theme) {
+		fprintf(stderr, "failed to create theme\n");
+		return EXIT_FAILURE;
+	}
+
+	memset(&bench, 0, sizeof bench);
+	for (i = 0; i < ARRAY_LENGTH(sizes); i++) {
+		bench.run = run_blur_surface;
+		bench.width = sizes[i].width;
+		bench.height = sizes[i].height;
+		bench.arg = 32;
+		bench.surface = create_surface(bench.width, bench.height);
+		snprintf(name, sizeof name, "blur_surface %dx%d",
+			 bench.width, bench.height);
+		bench_report(&bench, name);
+		bench_cleanup(&bench);
+	}
+
+	memset(&bench, 0, sizeof bench);
+	bench.run = run_theme_create;
+	bench_report(&bench, "theme_create");
+
+	for (i = 0; i < ARRAY_LENGTH(sizes); i++) {
+		memset(&bench, 0, sizeof bench);
+		bench.theme = theme;
+		bench.width = sizes[i].width;
+		bench.height = sizes[i].height;
+		bench_setup_cr(&bench);
+
+		bench.run = run_theme_render_frame;
+		bench.arg = THEME_FRAME_ACTIVE;
+		snprintf(name, sizeof name, "theme_render_frame %dx%d",
+			 bench.width, bench.height);
+		bench_report(&bench, name);
+
+		bench.arg = THEME_FRAME_ACTIVE | THEME_FRAME_COMPACT;
+		snprintf(name, sizeof name, "theme_render_frame compact %dx%d",
+			 bench.width, bench.height);
+		bench_report(&bench, name);
+
+		bench.run = run_tile_mask;
+		snprintf(name, sizeof name, "tile_mask %dx%d",
+			 bench.width, bench.height);
+		bench_report(&bench, name);
+
+		bench.run = run_frame_repaint;
+		bench.frame = frame_create(theme, bench.width, bench.height,
+					   1, FRAME_BUTTON_ALL, "wlmessage");
+		snprintf(name, sizeof name, "frame_repaint %dx%d",
+			 bench.width, bench.height);
+		bench_report(&bench, name);
+
+		bench_cleanup(&bench);
+	}
+
+	memset(&bench, 0, sizeof bench);
+	bench.run = run_load_image;
+	for (i = 0; i < ARRAY_LENGTH(icons); i++) {
+		snprintf(path, sizeof path, "%s/%s", BENCH_DATA_DIR, icons[i]);
+		bench.path = path;
+		snprintf(name, sizeof name, "load_png %s", icons[i]);
+		bench_report(&bench, name);
+	}
+
+	snprintf(path, sizeof path, "%s/%s", BENCH_DATA_DIR, icons[0]);
+	snprintf(jpeg, sizeof jpeg, "/tmp/wlmessage-bench-%d.jpg", getpid());
+	if (write_jpeg(path, jpeg) == 0) {
+		bench.path = jpeg;
+		bench_report(&bench, "load_jpeg icon_window.jpg");
+		unlink(jpeg);
+	}
+
+	for (i = 0; i < ARRAY_LENGTH(transform_names); i++) {
+		memset(&bench, 0, sizeof bench);
+		bench.run = run_transform;
+		bench.width = 404;
+		bench.height = 183;
+		bench.arg = WL_OUTPUT_TRANSFORM_NORMAL + i;
+		bench_setup_cr(&bench);
+		snprintf(name, sizeof name, "buffer_transform %s",
+			 transform_names[i]);
+		bench_report(&bench, name);
+		bench_cleanup(&bench);
+	}
+
+	memset(&bench, 0, sizeof bench);
+	bench.width = 404;
+	bench.height = 183;
+	bench_setup_cr(&bench);
+	bench.run = run_draw_message;
+	bench_report(&bench, "wlmessage draw_message");
+	bench_cleanup(&bench);
+
+	bench.width = 60;
+	bench.height = 32;
+	bench_setup_cr(&bench);
+	bench.run = run_draw_button;
+	bench_report(&bench, "wlmessage draw_button");
+	bench_cleanup(&bench);
+
+	bench.width = 240;
+	bench.height = 32;
+	bench_setup_cr(&bench);
+	bench.run = run_draw_entry;
+	bench_report(&bench, "wlmessage draw_entry");
+	bench_cleanup(&bench);
+
+	/*
+	 * Scaling of the tiled repaint of a fullscreen 4K window, each
+	 * pool size checked against a single-threaded reference
+	 */
+	memset(&bench, 0, sizeof bench);
+	bench.theme = theme;
+	bench.width = 3840;
+	bench.height = 2160;
+	bench.surface = create_surface(bench.width, bench.height);
+	bench.pool = tile_pool_create(1);
+	run_tiled_repaint(&bench);
+	reference = bench.surface;
+	tile_pool_destroy(bench.pool);
+
+	for (i = 0; i < ARRAY_LENGTH(tile_threads); i++) {
+		memset(&bench, 0, sizeof bench);
+		bench.run = run_tiled_repaint;
+		bench.theme = theme;
+		bench.width = 3840;
+		bench.height = 2160;
+		bench.surface = create_surface(bench.width, bench.height);
+		bench.pool = tile_pool_create(tile_threads[i]);
+		snprintf(name, sizeof name, "tiled_repaint %dx%d threads=%d",
+			 bench.width, bench.height,
+			 tile_pool_get_threads(bench.pool));
+		if ((!filter || strstr(name, filter)) &&
+		    !check_tiled_repaint(&bench, reference)) {
+			fprintf(stderr, "%s: output differs from one thread\n",
+				name);
+			ret = EXIT_FAILURE;
+		}
+		bench_report(&bench, name);
+		tile_pool_destroy(bench.pool);
+		bench_cleanup(&bench);
+	}
+	cairo_surface_destroy(reference);
+
+	theme_destroy(theme);
+
+	return ret;
+}
@@ -0,0 +1,1246 @@
+/*
+ * Copyright © 2014 Manuel Bachmann
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * A stand-in compositor for end-to-end measurements. It serves
+ * wl_compositor, wl_shm, wl_seat and wl_shell on a private socket,
+ * starts the client given on the command line against it, feeds it
+ * scripted input and reports what the client did:
+ *
+ *	wlmessage-harness [-s script] -- ./wlmessage -buttons Ok:1 hello
+ *
+ * Frame callbacks are answered and buffers released on a simulated
+ * 60 Hz refresh, nothing is ever shown. The script starts after the
+ * client's first commit and has one command per line:
+ *
+ *	configure W H		send a wl_shell_surface.configure
+ *	motion X Y [N]		move the pointer to X,Y in N steps
+ *	button [CODE]		press and release a pointer button
+ *	key CODE		press and release a key (evdev code)
+ *	sync			wait for the next commit, at most 1 s
+ *	wait MS			do nothing for MS milliseconds
+ *	quit			terminate the client
+ *
+ * Results are printed on stdout as key=value lines once the client
+ * has exited. A client still running after 30 s is killed, and the
+ * run fails.
+ *
+ * With -n N the client is started N times in a row, each instance
+ * being driven to its first frame and then to its default button
+ * (unless a script says otherwise), and percentiles of the wall time,
+ * CPU time and peak RSS of the instances are printed instead. This is
+ * the cost paid by scripts which run wlmessage over and over.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <linux/input.h>
+#include <wayland-server.h>
+#include <xkbcommon/xkbcommon.h>
+
+#include "shared/os-compatibility.h"
+
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+
+/* Simulated refresh period, in milliseconds */
+#define REFRESH_MS 16
+#define SYNC_TIMEOUT_MS 1000
+#define EXIT_TIMEOUT_MS 2000
+/* Whole run, in case the client hangs before the script even starts */
+#define RUN_TIMEOUT_MS 30000
+
+struct buffer_ref {
+	struct wl_resource *buffer;
+	struct wl_listener destroy_listener;
+};
+
+struct surface {
+	struct wl_resource *resource;
+	struct harness *harness;
+	struct wl_list link;
+
+	struct buffer_ref pending;
+	int pending_attached;
+	struct wl_list pending_frames;
+
+	struct buffer_ref current;
+	int current_released;
+	struct wl_list frames;
+
+	int toplevel;
+};
+
+struct harness {
+	struct wl_display *display;
+	struct wl_event_loop *loop;
+	struct wl_list surfaces;
+	struct wl_list pointers;
+	struct wl_list keyboards;
+
+	struct surface *focus;
+	struct wl_resource *shell_surface;
+	int pointer_entered;
+	int keyboard_entered;
+	wl_fixed_t pointer_x, pointer_y;
+
+	int keymap_fd;
+	uint32_t keymap_size;
+
+	struct wl_event_source *refresh_timer;
+	int refresh_armed;
+
+	/* Script */
+	char **steps;
+	int step_count;
+	int step;
+	int syncing;
+	struct wl_event_source *script_timer;
+	int script_done;
+
+	pid_t child;
+	struct wl_event_source *deadline_timer;
+	int timed_out;
+	int child_status;
+	int child_exited;
+	struct rusage child_rusage;
+	uint64_t exit_ns;
+
+	/* Results */
+	uint64_t start_ns;
+	uint64_t first_commit_ns;
+	uint32_t commits;
+	uint32_t buffer_commits;
+	uint32_t commits_before_input;
+	uint32_t inputs;
+	uint64_t shm_bytes;
+	uint32_t frame_callbacks;
+};
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint32_t
+harness_time(struct harness *harness)
+{
+	return (now_ns() - harness->start_ns) / 1000000;
+}
+
+static void
+buffer_ref_destroyed(struct wl_listener *listener, void *data)
+{
+	struct buffer_ref *ref =
+		wl_container_of(listener, ref, destroy_listener);
+
+	ref->buffer = NULL;
+	wl_list_remove(&ref->destroy_listener.link);
+	wl_list_init(&ref->destroy_listener.link);
+}
+
+static void
+buffer_ref_set(struct buffer_ref *ref, struct wl_resource *buffer)
+{
+	wl_list_remove(&ref->destroy_listener.link);
+	wl_list_init(&ref->destroy_listener.link);
+
+	ref->buffer = buffer;
+	if (buffer)
+		wl_resource_add_destroy_listener(buffer,
+						 &ref->destroy_listener);
+}
+
+static void
+buffer_ref_init(struct buffer_ref *ref)
+{
+	ref->buffer = NULL;
+	ref->destroy_listener.notify = buffer_ref_destroyed;
+	wl_list_init(&ref->destroy_listener.link);
+}
+
+static void harness_run_script(struct harness *harness);
+
+static void
+unlink_resource(struct wl_resource *resource)
+{
+	wl_list_remove(wl_resource_get_link(resource));
+}
+
+static int
+refresh(void *data)
+{
+	struct harness *harness = data;
+	struct surface *surface;
+	struct wl_resource *callback, *tmp;
+	uint32_t time = harness_time(harness);
+
+	harness->refresh_armed = 0;
+
+	wl_list_for_each(surface, &harness->surfaces, link) {
+		if (surface->current.buffer && !surface->current_released) {
+			wl_buffer_send_release(surface->current.buffer);
+			surface->current_released = 1;
+		}
+
+		wl_resource_for_each_safe(callback, tmp, &surface->frames) {
+			wl_callback_send_done(callback, time);
+			wl_resource_destroy(callback);
+			harness->frame_callbacks++;
+		}
+	}
+
+	return 0;
+}
+
+static void
+harness_schedule_refresh(struct harness *harness)
+{
+	if (harness->refresh_armed)
+		return;
+
+	wl_event_source_timer_update(harness->refresh_timer, REFRESH_MS);
+	harness->refresh_armed = 1;
+}
+
+static void
+surface_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+surface_attach(struct wl_client *client, struct wl_resource *resource,
+	       struct wl_resource *buffer, int32_t sx, int32_t sy)
+{
+	struct surface *surface = wl_resource_get_user_data(resource);
+
+	buffer_ref_set(&surface->pending, buffer);
+	surface->pending_attached = 1;
+}
+
+static void
+surface_damage(struct wl_client *client, struct wl_resource *resource,
+	       int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static void
+surface_frame(struct wl_client *client, struct wl_resource *resource,
+	      uint32_t id)
+{
+	struct surface *surface = wl_resource_get_user_data(resource);
+	struct wl_resource *callback;
+
+	callback = wl_resource_create(client, &wl_callback_interface, 1, id);
+	if (!callback) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	wl_resource_set_implementation(callback, NULL, NULL, unlink_resource);
+	wl_list_insert(surface->pending_frames.prev,
+		       wl_resource_get_link(callback));
+}
+
+static void
+surface_set_region(struct wl_client *client, struct wl_resource *resource,
+		   struct wl_resource *region)
+{
+}
+
+static void
+surface_commit(struct wl_client *client, struct wl_resource *resource)
+{
+	struct surface *surface = wl_resource_get_user_data(resource);
+	struct harness *harness = surface->harness;
+	struct wl_shm_buffer *shm_buffer;
+
+	harness->commits++;
+
+	if (surface->pending_attached) {
+		if (surface->current.buffer && !surface->current_released &&
+		    surface->current.buffer != surface->pending.buffer)
+			wl_buffer_send_release(surface->current.buffer);
+
+		buffer_ref_set(&surface->current, surface->pending.buffer);
+		buffer_ref_set(&surface->pending, NULL);
+		surface->pending_attached = 0;
+		surface->current_released = 0;
+
+		shm_buffer = surface->current.buffer ?
+			wl_shm_buffer_get(surface->current.buffer) : NULL;
+		if (shm_buffer) {
+			harness->buffer_commits++;
+			harness->shm_bytes +=
+				(uint64_t) wl_shm_buffer_get_stride(shm_buffer) *
+				wl_shm_buffer_get_height(shm_buffer);
+		}
+
+		if (surface->toplevel && surface->current.buffer &&
+		    !harness->first_commit_ns) {
+			harness->first_commit_ns = now_ns();
+			harness->focus = surface;
+			harness_run_script(harness);
+		}
+	}
+
+	wl_list_insert_list(surface->frames.prev, &surface->pending_frames);
+	wl_list_init(&surface->pending_frames);
+	harness_schedule_refresh(harness);
+
+	if (harness->syncing && surface->toplevel) {
+		harness->syncing = 0;
+		wl_event_source_timer_update(harness->script_timer, 0);
+		harness_run_script(harness);
+	}
+}
+
+static void
+surface_set_buffer_transform(struct wl_client *client,
+			     struct wl_resource *resource, int32_t transform)
+{
+}
+
+static void
+surface_set_buffer_scale(struct wl_client *client,
+			 struct wl_resource *resource, int32_t scale)
+{
+}
+
+static const struct wl_surface_interface surface_implementation = {
+	.destroy = surface_destroy,
+	.attach = surface_attach,
+	.damage = surface_damage,
+	.frame = surface_frame,
+	.set_opaque_region = surface_set_region,
+	.set_input_region = surface_set_region,
+	.commit = surface_commit,
+	.set_buffer_transform = surface_set_buffer_transform,
+	.set_buffer_scale = surface_set_buffer_scale,
+};
+
+static void
+destroy_frames(struct wl_list *frames)
+{
+	struct wl_resource *callback, *tmp;
+
+	wl_resource_for_each_safe(callback, tmp, frames)
+		wl_resource_destroy(callback);
+}
+
+static void
+destroy_surface(struct wl_resource *resource)
+{
+	struct surface *surface = wl_resource_get_user_data(resource);
+
+	if (surface->harness->focus == surface)
+		surface->harness->focus = NULL;
+
+	destroy_frames(&surface->pending_frames);
+	destroy_frames(&surface->frames);
+	buffer_ref_set(&surface->pending, NULL);
+	buffer_ref_set(&surface->current, NULL);
+	wl_list_remove(&surface->link);
+	free(surface);
+}
+
+static void
+compositor_create_surface(struct wl_client *client,
+			  struct wl_resource *resource, uint32_t id)
+{
+	struct harness *harness = wl_resource_get_user_data(resource);
+	struct surface *surface;
+
+	surface = calloc(1, sizeof *surface);
+	if (!surface) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	surface->resource =
+		wl_resource_create(client, &wl_surface_interface,
+				   wl_resource_get_version(resource), id);
+	if (!surface->resource) {
+		free(surface);
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	surface->harness = harness;
+	buffer_ref_init(&surface->pending);
+	buffer_ref_init(&surface->current);
+	wl_list_init(&surface->pending_frames);
+	wl_list_init(&surface->frames);
+	wl_list_insert(&harness->surfaces, &surface->link);
+
+	wl_resource_set_implementation(surface->resource,
+				       &surface_implementation,
+				       surface, destroy_surface);
+}
+
+static void
+region_destroy(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static void
+region_rect(struct wl_client *client, struct wl_resource *resource,
+	    int32_t x, int32_t y, int32_t width, int32_t height)
+{
+}
+
+static const struct wl_region_interface region_implementation = {
+	.destroy = region_destroy,
+	.add = region_rect,
+	.subtract = region_rect,
+};
+
+static void
+compositor_create_region(struct wl_client *client,
+			 struct wl_resource *resource, uint32_t id)
+{
+	struct wl_resource *region;
+
+	region = wl_resource_create(client, &wl_region_interface, 1, id);
+	if (!region) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	wl_resource_set_implementation(region, &region_implementation,
+				       NULL, NULL);
+}
+
+static const struct wl_compositor_interface compositor_implementation = {
+	.create_surface = compositor_create_surface,
+	.create_region = compositor_create_region,
+};
+
+static void
+bind_compositor(struct wl_client *client, void *data,
+		uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &wl_compositor_interface,
+				      version, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &compositor_implementation,
+				       data, NULL);
+}
+
+static void
+shell_surface_pong(struct wl_client *client, struct wl_resource *resource,
+		   uint32_t serial)
+{
+}
+
+static void
+shell_surface_move(struct wl_client *client, struct wl_resource *resource,
+		   struct wl_resource *seat, uint32_t serial)
+{
+}
+
+static void
+shell_surface_resize(struct wl_client *client, struct wl_resource *resource,
+		     struct wl_resource *seat, uint32_t serial,
+		     uint32_t edges)
+{
+}
+
+static void
+shell_surface_set_toplevel(struct wl_client *client,
+			   struct wl_resource *resource)
+{
+}
+
+static void
+shell_surface_set_transient(struct wl_client *client,
+			    struct wl_resource *resource,
+			    struct wl_resource *parent,
+			    int32_t x, int32_t y, uint32_t flags)
+{
+}
+
+static void
+shell_surface_set_fullscreen(struct wl_client *client,
+			     struct wl_resource *resource, uint32_t method,
+			     uint32_t framerate, struct wl_resource *output)
+{
+}
+
+static void
+shell_surface_set_popup(struct wl_client *client,
+			struct wl_resource *resource,
+			struct wl_resource *seat, uint32_t serial,
+			struct wl_resource *parent,
+			int32_t x, int32_t y, uint32_t flags)
+{
+}
+
+static void
+shell_surface_set_maximized(struct wl_client *client,
+			    struct wl_resource *resource,
+			    struct wl_resource *output)
+{
+}
+
+static void
+shell_surface_set_string(struct wl_client *client,
+			 struct wl_resource *resource, const char *string)
+{
+}
+
+static const struct wl_shell_surface_interface shell_surface_implementation = {
+	.pong = shell_surface_pong,
+	.move = shell_surface_move,
+	.resize = shell_surface_resize,
+	.set_toplevel = shell_surface_set_toplevel,
+	.set_transient = shell_surface_set_transient,
+	.set_fullscreen = shell_surface_set_fullscreen,
+	.set_popup = shell_surface_set_popup,
+	.set_maximized = shell_surface_set_maximized,
+	.set_title = shell_surface_set_string,
+	.set_class = shell_surface_set_string,
+};
+
+static void
+destroy_shell_surface(struct wl_resource *resource)
+{
+	struct harness *harness = wl_resource_get_user_data(resource);
+
+	if (harness->shell_surface == resource)
+		harness->shell_surface = NULL;
+}
+
+static void
+shell_get_shell_surface(struct wl_client *client,
+			struct wl_resource *resource, uint32_t id,
+			struct wl_resource *surface_resource)
+{
+	struct harness *harness = wl_resource_get_user_data(resource);
+	struct surface *surface = wl_resource_get_user_data(surface_resource);
+	struct wl_resource *shell_surface;
+
+	shell_surface = wl_resource_create(client, &wl_shell_surface_interface,
+					   1, id);
+	if (!shell_surface) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	wl_resource_set_implementation(shell_surface,
+				       &shell_surface_implementation,
+				       harness, destroy_shell_surface);
+
+	surface->toplevel = 1;
+	harness->shell_surface = shell_surface;
+}
+
+static const struct wl_shell_interface shell_implementation = {
+	.get_shell_surface = shell_get_shell_surface,
+};
+
+static void
+bind_shell(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &wl_shell_interface, 1, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &shell_implementation,
+				       data, NULL);
+}
+
+static void
+pointer_set_cursor(struct wl_client *client, struct wl_resource *resource,
+		   uint32_t serial, struct wl_resource *surface,
+		   int32_t x, int32_t y)
+{
+}
+
+static void
+resource_release(struct wl_client *client, struct wl_resource *resource)
+{
+	wl_resource_destroy(resource);
+}
+
+static const struct wl_pointer_interface pointer_implementation = {
+	.set_cursor = pointer_set_cursor,
+	.release = resource_release,
+};
+
+static const struct wl_keyboard_interface keyboard_implementation = {
+	.release = resource_release,
+};
+
+static void
+seat_get_pointer(struct wl_client *client, struct wl_resource *resource,
+		 uint32_t id)
+{
+	struct harness *harness = wl_resource_get_user_data(resource);
+	struct wl_resource *pointer;
+
+	pointer = wl_resource_create(client, &wl_pointer_interface,
+				     wl_resource_get_version(resource), id);
+	if (!pointer) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	wl_resource_set_implementation(pointer, &pointer_implementation,
+				       harness, unlink_resource);
+	wl_list_insert(&harness->pointers, wl_resource_get_link(pointer));
+}
+
+static void
+seat_get_keyboard(struct wl_client *client, struct wl_resource *resource,
+		  uint32_t id)
+{
+	struct harness *harness = wl_resource_get_user_data(resource);
+	struct wl_resource *keyboard;
+
+	keyboard = wl_resource_create(client, &wl_keyboard_interface,
+				      wl_resource_get_version(resource), id);
+	if (!keyboard) {
+		wl_resource_post_no_memory(resource);
+		return;
+	}
+
+	wl_resource_set_implementation(keyboard, &keyboard_implementation,
+				       harness, unlink_resource);
+	wl_list_insert(&harness->keyboards, wl_resource_get_link(keyboard));
+
+	wl_keyboard_send_keymap(keyboard, WL_KEYBOARD_KEYMAP_FORMAT_XKB_V1,
+				harness->keymap_fd, harness->keymap_size);
+}
+
+static void
+seat_get_touch(struct wl_client *client, struct wl_resource *resource,
+	       uint32_t id)
+{
+	wl_resource_post_error(resource, WL_DISPLAY_ERROR_INVALID_METHOD,
+			       "no touch capability");
+}
+
+static const struct wl_seat_interface seat_implementation = {
+	.get_pointer = seat_get_pointer,
+	.get_keyboard = seat_get_keyboard,
+	.get_touch = seat_get_touch,
+};
+
+static void
+bind_seat(struct wl_client *client, void *data, uint32_t version, uint32_t id)
+{
+	struct wl_resource *resource;
+
+	resource = wl_resource_create(client, &wl_seat_interface,
+				      version < 3 ? version : 3, id);
+	if (!resource) {
+		wl_client_post_no_memory(client);
+		return;
+	}
+
+	wl_resource_set_implementation(resource, &seat_implementation,
+				       data, NULL);
+	wl_seat_send_capabilities(resource, WL_SEAT_CAPABILITY_POINTER |
+				  WL_SEAT_CAPABILITY_KEYBOARD);
+}
+
+static int
+create_keymap(struct harness *harness)
+{
+	struct xkb_context *context;
+	struct xkb_keymap *keymap;
+	char *string, *map;
+
+	context = xkb_context_new(0);
+	if (!context)
+		return -1;
+
+	keymap = xkb_keymap_new_from_names(context, NULL, 0);
+	if (!keymap) {
+		xkb_context_unref(context);
+		return -1;
+	}
+
+	string = xkb_keymap_get_as_string(keymap, XKB_KEYMAP_FORMAT_TEXT_V1);
+	harness->keymap_size = strlen(string) + 1;
+	harness->keymap_fd = os_create_anonymous_file(harness->keymap_size);
+	if (harness->keymap_fd < 0)
+		goto err;
+
+	map = mmap(NULL, harness->keymap_size, PROT_READ | PROT_WRITE,
+		   MAP_SHARED, harness->keymap_fd, 0);
+	if (map == MAP_FAILED) {
+		close(harness->keymap_fd);
+		goto err;
+	}
+
+	memcpy(map, string, harness->keymap_size);
+	munmap(map, harness->keymap_size);
+	free(string);
+	xkb_keymap_unref(keymap);
+	xkb_context_unref(context);
+
+	return 0;
+
+err:
+	free(string);
+	xkb_keymap_unref(keymap);
+	xkb_context_unref(context);
+	return -1;
+}
+
+static int
+same_client(struct wl_resource *resource, struct surface *surface)
+{
+	return wl_resource_get_client(resource) ==
+		wl_resource_get_client(surface->resource);
+}
+
+static void
+send_pointer_motion(struct harness *harness, wl_fixed_t x, wl_fixed_t y)
+{
+	struct wl_resource *pointer;
+	uint32_t serial;
+
+	if (!harness->pointer_entered) {
+		serial = wl_display_next_serial(harness->display);
+		wl_resource_for_each(pointer, &harness->pointers)
+			if (same_client(pointer, harness->focus))
+				wl_pointer_send_enter(pointer, serial,
+						      harness->focus->resource,
+						      x, y);
+		harness->pointer_entered = 1;
+	} else {
+		wl_resource_for_each(pointer, &harness->pointers)
+			if (same_client(pointer, harness->focus))
+				wl_pointer_send_motion(pointer,
+						       harness_time(harness),
+						       x, y);
+	}
+
+	harness->pointer_x = x;
+	harness->pointer_y = y;
+	harness->inputs++;
+}
+
+static void
+send_pointer_button(struct harness *harness, uint32_t button)
+{
+	struct wl_resource *pointer;
+	uint32_t serial, state;
+
+	for (state = WL_POINTER_BUTTON_STATE_PRESSED;
+	     ; state = WL_POINTER_BUTTON_STATE_RELEASED) {
+		serial = wl_display_next_serial(harness->display);
+		wl_resource_for_each(pointer, &harness->pointers)
+			if (same_client(pointer, harness->focus))
+				wl_pointer_send_button(pointer, serial,
+						       harness_time(harness),
+						       button, state);
+		harness->inputs++;
+
+		if (state == WL_POINTER_BUTTON_STATE_RELEASED)
+			break;
+	}
+}
+
+static void
+send_key(struct harness *harness, uint32_t key)
+{
+	struct wl_resource *keyboard;
+	struct wl_array keys;
+	uint32_t serial, state;
+
+	if (!harness->keyboard_entered) {
+		wl_array_init(&keys);
+		serial = wl_display_next_serial(harness->display);
+		wl_resource_for_each(keyboard, &harness->keyboards) {
+			if (!same_client(keyboard, harness->focus))
+				continue;
+			wl_keyboard_send_enter(keyboard, serial,
+					       harness->focus->resource, &keys);
+			wl_keyboard_send_modifiers(keyboard, serial,
+						   0, 0, 0, 0);
+		}
+		wl_array_release(&keys);
+		harness->keyboard_entered = 1;
+	}
+
+	for (state = WL_KEYBOARD_KEY_STATE_PRESSED;
+	     ; state = WL_KEYBOARD_KEY_STATE_RELEASED) {
+		serial = wl_display_next_serial(harness->display);
+		wl_resource_for_each(keyboard, &harness->keyboards)
+			if (same_client(keyboard, harness->focus))
+				wl_keyboard_send_key(keyboard, serial,
+						     harness_time(harness),
+						     key, state);
+		harness->inputs++;
+
+		if (state == WL_KEYBOARD_KEY_STATE_RELEASED)
+			break;
+	}
+}
+
+static int
+script_timeout(void *data)
+{
+	struct harness *harness = data;
+
+	harness->syncing = 0;
+	harness_run_script(harness);
+
+	return 0;
+}
+
+static void
+harness_finish_script(struct harness *harness)
+{
+	harness->script_done = 1;
+
+	/* Give the client a moment to exit on its own */
+	wl_event_source_timer_update(harness->script_timer, EXIT_TIMEOUT_MS);
+}
+
+/*
+ * Run script steps until one of them has to wait for the client or
+ * for a timer; the commit handler and the script timer resume it.
+ */
+static void
+harness_run_script(struct harness *harness)
+{
+	char command[32];
+	int a, b, n, i, count;
+	wl_fixed_t x, y;
+
+	if (harness->script_done) {
+		if (harness->child > 0 && !harness->child_exited)
+			kill(harness->child, SIGTERM);
+		return;
+	}
+
+	while (harness->step < harness->step_count) {
+		if (!harness->focus) {
+			fprintf(stderr, "harness: client has no surface\n");
+			break;
+		}
+
+		a = b = 0;
+		n = 1;
+		count = sscanf(harness->steps[harness->step++], "%31s %d %d %d",
+			       command, &a, &b, &n);
+		if (count < 1 || command[0] == '#')
+			continue;
+
+		if (harness->inputs == 0)
+			harness->commits_before_input = harness->commits;
+
+		if (strcmp(command, "configure") == 0) {
+			if (harness->shell_surface)
+				wl_shell_surface_send_configure(
+					harness->shell_surface,
+					WL_SHELL_SURFACE_RESIZE_NONE, a, b);
+		} else if (strcmp(command, "motion") == 0) {
+			if (n < 1)
+				n = 1;
+			for (i = 1; i <= n; i++) {
+				x = harness->pointer_x +
+					(wl_fixed_from_int(a) -
+					 harness->pointer_x) * i / n;
+				y = harness->pointer_y +
+					(wl_fixed_from_int(b) -
+					 harness->pointer_y) * i / n;
+				send_pointer_motion(harness, x, y);
+			}
+		} else if (strcmp(command, "button") == 0) {
+			send_pointer_button(harness, count > 1 ? a : BTN_LEFT);
+		} else if (strcmp(command, "key") == 0) {
+			send_key(harness, a);
+		} else if (strcmp(command, "sync") == 0) {
+			harness->syncing = 1;
+			wl_event_source_timer_update(harness->script_timer,
+						     SYNC_TIMEOUT_MS);
+			return;
+		} else if (strcmp(command, "wait") == 0) {
+			wl_event_source_timer_update(harness->script_timer,
+						     a > 0 ? a : 1);
+			return;
+		} else if (strcmp(command, "quit") == 0) {
+			kill(harness->child, SIGTERM);
+		} else {
+			fprintf(stderr, "harness: unknown command \"%s\"\n",
+				command);
+		}
+	}
+
+	harness_finish_script(harness);
+}
+
+static char *spawn_script[] = {
+	"key 28",
+};
+
+static char *default_script[] = {
+	"sync",
+	"motion 100 100 20",
+	"sync",
+	"button",
+	"sync",
+	"configure 600 400",
+	"sync",
+	"key 28",
+	"sync",
+};
+
+static int
+load_script(struct harness *harness, const char *filename)
+{
+	FILE *fp;
+	char line[256];
+	int size = 0;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "harness: cannot open %s: %m\n", filename);
+		return -1;
+	}
+
+	harness->steps = NULL;
+	harness->step_count = 0;
+	while (fgets(line, sizeof line, fp)) {
+		line[strcspn(line, "\n")] = '\0';
+		if (harness->step_count == size) {
+			size = size ? size * 2 : 16;
+			harness->steps = realloc(harness->steps,
+						 size * sizeof *harness->steps);
+		}
+		harness->steps[harness->step_count++] = strdup(line);
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+static int
+handle_sigchld(int signal_number, void *data)
+{
+	struct harness *harness = data;
+	int status;
+
+	if (wait4(harness->child, &status, WNOHANG,
+		  &harness->child_rusage) != harness->child)
+		return 0;
+
+	harness->exit_ns = now_ns();
+	harness->child_exited = 1;
+	harness->child_status = status;
+	wl_display_terminate(harness->display);
+
+	return 0;
+}
+
+static int
+deadline_timeout(void *data)
+{
+	struct harness *harness = data;
+
+	fprintf(stderr, "harness: client still running after %d ms, "
+		"killing it\n", RUN_TIMEOUT_MS);
+	harness->timed_out = 1;
+	if (harness->child > 0 && !harness->child_exited)
+		kill(harness->child, SIGKILL);
+
+	return 0;
+}
+
+static pid_t
+launch_client(char *argv[], const char *socket_name)
+{
+	sigset_t mask;
+	pid_t pid;
+
+	pid = fork();
+	if (pid != 0)
+		return pid;
+
+	/* The event loop blocked SIGCHLD for its signalfd */
+	sigemptyset(&mask);
+	sigprocmask(SIG_SETMASK, &mask, NULL);
+
+	setenv("WAYLAND_DISPLAY", socket_name, 1);
+	execvp(argv[0], argv);
+	fprintf(stderr, "harness: cannot run %s: %m\n", argv[0]);
+	_exit(127);
+}
+
+static void
+print_results(struct harness *harness)
+{
+	uint32_t input_commits;
+
+	printf("first_commit_ms=%.3f\n", harness->first_commit_ns ?
+	       (harness->first_commit_ns - harness->start_ns) / 1e6 : -1.0);
+	printf("commits=%u\n", harness->commits);
+	printf("buffer_commits=%u\n", harness->buffer_commits);
+	printf("frame_callbacks=%u\n", harness->frame_callbacks);
+	printf("inputs=%u\n", harness->inputs);
+
+	input_commits = harness->commits - harness->commits_before_input;
+	printf("redraws_per_input=%.3f\n", harness->inputs ?
+	       (double) input_commits / harness->inputs : 0.0);
+	printf("shm_bytes_per_frame=%.0f\n", harness->buffer_commits ?
+	       (double) harness->shm_bytes / harness->buffer_commits : 0.0);
+
+	if (harness->timed_out)
+		printf("timed_out=1\n");
+	if (WIFEXITED(harness->child_status))
+		printf("client_exit_status=%d\n",
+		       WEXITSTATUS(harness->child_status));
+	else
+		printf("client_exit_signal=%d\n",
+		       WTERMSIG(harness->child_status));
+}
+
+static void
+usage(void)
+{
+	fprintf(stderr, "usage: wlmessage-harness [-n count] [-s script] "
+		"-- client [args...]\n");
+}
+
+/* Run the client once against a fresh display */
+static int
+harness_run(struct harness *harness, char *argv[])
+{
+	const char *socket_name;
+
+	wl_list_init(&harness->surfaces);
+	wl_list_init(&harness->pointers);
+	wl_list_init(&harness->keyboards);
+
+	harness->display = wl_display_create();
+	if (!harness->display)
+		return -1;
+	harness->loop = wl_display_get_event_loop(harness->display);
+
+	socket_name = wl_display_add_socket_auto(harness->display);
+	if (!socket_name) {
+		fprintf(stderr, "harness: failed to add a socket: %m\n");
+		wl_display_destroy(harness->display);
+		return -1;
+	}
+
+	wl_display_init_shm(harness->display);
+	wl_display_add_shm_format(harness->display, WL_SHM_FORMAT_RGB565);
+	wl_global_create(harness->display, &wl_compositor_interface, 3,
+			 harness, bind_compositor);
+	wl_global_create(harness->display, &wl_shell_interface, 1,
+			 harness, bind_shell);
+	wl_global_create(harness->display, &wl_seat_interface, 3,
+			 harness, bind_seat);
+
+	harness->refresh_timer =
+		wl_event_loop_add_timer(harness->loop, refresh, harness);
+	harness->script_timer =
+		wl_event_loop_add_timer(harness->loop, script_timeout, harness);
+	harness->deadline_timer =
+		wl_event_loop_add_timer(harness->loop, deadline_timeout,
+					harness);
+	wl_event_loop_add_signal(harness->loop, SIGCHLD,
+				 handle_sigchld, harness);
+
+	harness->start_ns = now_ns();
+	harness->child = launch_client(argv, socket_name);
+	if (harness->child < 0) {
+		fprintf(stderr, "harness: fork failed: %m\n");
+		wl_display_destroy(harness->display);
+		return -1;
+	}
+	wl_event_source_timer_update(harness->deadline_timer, RUN_TIMEOUT_MS);
+
+	wl_display_run(harness->display);
+	wl_display_destroy(harness->display);
+
+	return 0;
+}
+
+static int
+compare_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+static void
+print_percentiles(const char *name, double *values, int count)
+{
+	qsort(values, count, sizeof *values, compare_double);
+	printf("%s p50=%.2f p90=%.2f p99=%.2f max=%.2f\n", name,
+	       values[count * 50 / 100], values[count * 90 / 100],
+	       values[count * 99 / 100], values[count - 1]);
+}
+
+static double
+timeval_ms(struct timeval *tv)
+{
+	return tv->tv_sec * 1e3 + tv->tv_usec / 1e3;
+}
+
+/*
+ * Start the client count times in a row and report the distribution
+ * of its startup and teardown costs.
+ */
+static int
+spawn_bench(struct harness *template, char *argv[], int count)
+{
+	struct harness harness;
+	double *first_commit, *wall, *cpu, *rss;
+	int i, n = 0, failed = 0, ret = -1;
+
+	first_commit = calloc(count, sizeof *first_commit);
+	wall = calloc(count, sizeof *wall);
+	cpu = calloc(count, sizeof *cpu);
+	rss = calloc(count, sizeof *rss);
+	if (!first_commit || !wall || !cpu || !rss)
+		goto out;
+
+	for (i = 0; i < count; i++) {
+		harness = *template;
+		if (harness_run(&harness, argv) < 0)
+			goto out;
+
+		if (!harness.first_commit_ns || !harness.child_exited ||
+		    !WIFEXITED(harness.child_status)) {
+			failed++;
+			continue;
+		}
+
+		first_commit[n] =
+			(harness.first_commit_ns - harness.start_ns) / 1e6;
+		wall[n] = (harness.exit_ns - harness.start_ns) / 1e6;
+		cpu[n] = timeval_ms(&harness.child_rusage.ru_utime) +
+			timeval_ms(&harness.child_rusage.ru_stime);
+		/* ru_maxrss is in kilobytes */
+		rss[n] = harness.child_rusage.ru_maxrss / 1024.0;
+		n++;
+	}
+
+	printf("instances=%d failed=%d\n", count, failed);
+	if (n > 0) {
+		print_percentiles("first_commit_ms", first_commit, n);
+		print_percentiles("wall_ms", wall, n);
+		print_percentiles("cpu_ms", cpu, n);
+		print_percentiles("peak_rss_mb", rss, n);
+	}
+	ret = failed ? -1 : 0;
+
+out:
+	free(first_commit);
+	free(wall);
+	free(cpu);
+	free(rss);
+
+	return ret;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct harness harness;
+	int i, count = 0, ret;
+
+	memset(&harness, 0, sizeof harness);
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			if (load_script(&harness, argv[++i]) < 0)
+				return EXIT_FAILURE;
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			count = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--") == 0) {
+			i++;
+			break;
+		} else {
+			break;
+		}
+	}
+
+	if (i >= argc) {
+		usage();
+		return EXIT_FAILURE;
+	}
+
+	if (!harness.steps && count > 0) {
+		harness.steps = spawn_script;
+		harness.step_count = ARRAY_LENGTH(spawn_script);
+	} else if (!harness.steps) {
+		harness.steps = default_script;
+		harness.step_count = ARRAY_LENGTH(default_script);
+	}
+
+	if (create_keymap(&harness) < 0) {
+		fprintf(stderr, "harness: failed to create a keymap\n");
+		return EXIT_FAILURE;
+	}
+
+	if (count > 0) {
+		ret = spawn_bench(&harness, &argv[i], count);
+	} else {
+		ret = harness_run(&harness, &argv[i]);
+		if (ret == 0) {
+			print_results(&harness);
+			if (!harness.first_commit_ns || harness.timed_out)
+				ret = -1;
+		}
+	}
+
+	close(harness.keymap_fd);
+
+	return ret < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+}
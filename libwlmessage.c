@@ -0,0 +1,903 @@
+/* Copyright © 2014 Manuel Bachmann */
+
+#include <linux/input.h>
+#include <stdlib.h>
+#include <string.h>
+#include <wayland-client.h>
+
+#include "window.h"
+#include "text-client-protocol.h"
+#include "wlmessage-draw.h"
+#include "libwlmessage.h"
+
+
+struct wlmessage {
+	struct display *display;
+
+	char *message;
+	char *title;
+	char *titlebuttons;
+	char *icon;
+	char *deflt;
+	char *textfield;
+	char *captions[MAX_BUTTONS];
+	int values[MAX_BUTTONS];
+	int buttons_nb;
+	int noresize;
+	int compact;
+	int low_memory;
+	int timeout;
+
+	struct message_window *message_window;
+	struct wl_text_input_manager *text_input_manager;
+	struct toytimer timeout_timer;
+
+	/* The answer, handed to the callback from a deferred task */
+	wlmessage_done_func_t done;
+	void *done_data;
+	struct task done_task;
+	int answered, answer_pending;
+	int answer_value;
+	char *answer_text;
+};
+
+struct message_window {
+	struct wlmessage *wlmessage;
+	struct window *window;
+	struct widget *widget;
+
+	char *message;
+	char *title;
+	cairo_surface_t *icon;
+	struct entry *entry;
+	int buttons_nb;
+	struct wl_list button_list;
+	int default_value;
+};
+
+struct button {
+	struct message_window *message_window;
+	struct widget *widget;
+	int focused, pressed;
+	struct wl_list link;
+
+	char *caption;
+	int value;
+};
+
+struct entry {
+	struct message_window *message_window;
+	struct widget *widget;
+	int active;
+
+	struct wl_text_input *text_input;
+	char *text;
+	int cursor_pos;
+	int cursor_anchor;
+	int last_vkb_len;
+};
+
+
+/*
+ * The callback runs from a deferred task rather than from the input
+ * handler, so that it can destroy the dialog and its widgets.
+ */
+static void
+message_window_answer (struct message_window *message_window, int value,
+                       int with_text)
+{
+	struct wlmessage *wlmessage = message_window->wlmessage;
+
+	if (wlmessage->answered)
+		return;
+	wlmessage->answered = 1;
+
+	wlmessage->answer_value = value;
+	if (with_text && message_window->entry)
+		wlmessage->answer_text = strdup (message_window->entry->text);
+
+	toytimer_disarm (&wlmessage->timeout_timer);
+
+	wlmessage->answer_pending = 1;
+	display_defer (wlmessage->display, &wlmessage->done_task);
+}
+
+static void
+done_task_run (struct task *task, uint32_t events)
+{
+	struct wlmessage *wlmessage =
+		container_of (task, struct wlmessage, done_task);
+	char *text = wlmessage->answer_text;
+
+	wlmessage->answer_pending = 0;
+	wlmessage->answer_text = NULL;
+
+	/* May destroy wlmessage */
+	if (wlmessage->done)
+		wlmessage->done (wlmessage, wlmessage->answer_value, text,
+		                 wlmessage->done_data);
+
+	free (text);
+}
+
+static void
+timeout_func (struct toytimer *timer)
+{
+	struct wlmessage *wlmessage =
+		container_of (timer, struct wlmessage, timeout_timer);
+
+	message_window_answer (wlmessage->message_window, 0, 0);
+}
+
+static void
+close_handler (void *data)
+{
+	struct message_window *message_window = data;
+
+	message_window_answer (message_window, 0, 0);
+}
+
+
+static void
+text_input_enter(void *data,
+                 struct wl_text_input *text_input,
+                 struct wl_surface *surface)
+{
+}
+
+static void
+text_input_leave(void *data,
+                 struct wl_text_input *text_input)
+{
+}
+
+static void
+text_input_modifiers_map(void *data,
+                         struct wl_text_input *text_input,
+                         struct wl_array *map)
+{
+}
+
+static void
+text_input_input_panel_state(void *data,
+                             struct wl_text_input *text_input,
+                             uint32_t state)
+{
+}
+
+static void
+text_input_preedit_string(void *data,
+                          struct wl_text_input *text_input,
+                          uint32_t serial,
+                          const char *text,
+                          const char *commit)
+{
+	struct entry *entry = data;
+	char *new_text;
+
+	if (strlen(entry->text) >= 18)
+		return;
+
+	 /* workaround to prevent using Backspace for now */
+	if (strlen(text) < entry->last_vkb_len) {
+		entry->last_vkb_len = strlen(text);
+		return;
+	} else {
+		entry->last_vkb_len = strlen(text);
+	}
+
+	new_text = malloc (strlen(entry->text) + 1 + 1);
+	strncpy (new_text, entry->text, entry->cursor_pos);
+	strcpy (new_text+entry->cursor_pos, text+(strlen(text)-1));
+	strcpy (new_text+entry->cursor_pos+1, entry->text+entry->cursor_pos);
+	free (entry->text);
+	entry->text = new_text;
+	entry->cursor_pos++;
+
+	widget_schedule_redraw (entry->widget);
+}
+
+static void
+text_input_preedit_styling(void *data,
+                           struct wl_text_input *text_input,
+                           uint32_t index,
+                           uint32_t length,
+                           uint32_t style)
+{
+}
+
+static void
+text_input_preedit_cursor(void *data,
+                          struct wl_text_input *text_input,
+                          int32_t index)
+{
+}
+
+static void
+text_input_commit_string(void *data,
+                         struct wl_text_input *text_input,
+                         uint32_t serial,
+                         const char *text)
+{
+}
+
+static void
+text_input_cursor_position(void *data,
+                           struct wl_text_input *text_input,
+                           int32_t index,
+                           int32_t anchor)
+{
+}
+
+static void
+text_input_keysym(void *data,
+                  struct wl_text_input *text_input,
+                  uint32_t serial,
+                  uint32_t time,
+                  uint32_t sym,
+                  uint32_t state,
+                  uint32_t modifiers)
+{
+	struct entry *entry = data;
+	char *new_text;
+
+	if (state == WL_KEYBOARD_KEY_STATE_PRESSED)
+		return;
+
+	 /* use Tab as Backspace until I figure this out */
+	if (sym == XKB_KEY_Tab) {
+		if (entry->cursor_pos != 0) {
+			new_text = malloc (strlen(entry->text));
+			strncpy (new_text, entry->text, entry->cursor_pos - 1);
+			strcpy (new_text+entry->cursor_pos-1, entry->text+entry->cursor_pos);
+			free (entry->text);
+			entry->text = new_text;
+			entry->cursor_pos--;
+		}
+	}	
+
+	if (sym == XKB_KEY_Left) {
+		if (entry->cursor_pos != 0)
+			entry->cursor_pos--;
+	}
+
+	if (sym == XKB_KEY_Right) {
+		if (entry->cursor_pos != strlen (entry->text))
+			entry->cursor_pos++;
+	}
+
+	if (sym == XKB_KEY_Return) {
+		message_window_answer (entry->message_window,
+		                       entry->message_window->default_value, 1);
+		return;
+	}
+
+	widget_schedule_redraw (entry->widget);
+}
+
+static void
+text_input_language(void *data,
+                    struct wl_text_input *text_input,
+                    uint32_t serial,
+                    const char *language)
+{
+}
+
+static void
+text_input_text_direction(void *data,
+                          struct wl_text_input *text_input,
+                          uint32_t serial,
+                          uint32_t direction)
+{
+}
+
+static const struct wl_text_input_listener text_input_listener = {
+	text_input_enter,
+	text_input_leave,
+	text_input_modifiers_map,
+	text_input_input_panel_state,
+	text_input_preedit_string,
+	text_input_preedit_styling,
+	text_input_preedit_cursor,
+	text_input_commit_string,
+	text_input_cursor_position,
+	NULL,
+	text_input_keysym,
+	text_input_language,
+	text_input_text_direction
+};
+
+
+static void
+button_click_handler(struct widget *widget,
+		struct input *input, uint32_t time,
+		uint32_t butt,
+		enum wl_pointer_button_state state, void *data)
+{
+	struct button *button = data;
+
+	widget_schedule_redraw (widget);
+
+	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
+		button->pressed = 1;
+	} else {
+		button->pressed = 0;
+		message_window_answer (button->message_window, button->value, 1);
+	}
+}
+
+static void
+button_touch_down_handler(struct widget *widget, struct input *input,
+		 uint32_t serial, uint32_t time, int32_t id,
+		 float tx, float ty, void *data)
+{
+	struct button *button = data;
+
+	button->focused = 1;
+	widget_schedule_redraw (widget);
+}
+
+static void
+button_touch_up_handler(struct widget *widget, struct input *input,
+		 uint32_t serial, uint32_t time, int32_t id,
+		 void *data)
+{
+	struct button *button = data;
+
+	button->focused = 0;
+	widget_schedule_redraw (widget);
+
+	message_window_answer (button->message_window, button->value, 1);
+}
+
+static int
+button_enter_handler(struct widget *widget, struct input *input,
+			     float x, float y, void *data)
+{
+	struct button *button = data;
+
+	button->focused = 1;
+	widget_schedule_redraw (widget);
+
+	return CURSOR_LEFT_PTR;
+}
+
+static void
+button_leave_handler(struct widget *widget,
+			     struct input *input, void *data)
+{
+	struct button *button = data;
+
+	button->focused = 0;
+	widget_schedule_redraw (widget);
+}
+
+static void
+entry_click_handler(struct widget *widget,
+		struct input *input, uint32_t time,
+		uint32_t button,
+		enum wl_pointer_button_state state, void *data)
+{
+	struct entry *entry = data;
+	struct wl_text_input_manager *text_input_manager =
+		entry->message_window->wlmessage->text_input_manager;
+
+	widget_schedule_redraw (widget);
+
+	if (state == WL_POINTER_BUTTON_STATE_PRESSED && button == BTN_LEFT) {
+		if (!text_input_manager) {
+			entry->active = 1;
+			return;
+		}
+
+		if (!entry->text_input) {
+			entry->text_input = wl_text_input_manager_create_text_input (text_input_manager);
+			display_set_input_proxy (window_get_display (entry->message_window->window),
+			                         entry->text_input);
+			wl_text_input_add_listener (entry->text_input, &text_input_listener, entry);
+		}
+
+		struct wl_seat *seat = input_get_seat (input);
+		struct wl_surface *surface = window_get_wl_surface (entry->message_window->window);
+		wl_text_input_show_input_panel (entry->text_input);
+		wl_text_input_activate (entry->text_input, seat, surface);
+
+		entry->active = 1;
+	}
+}
+
+static void
+entry_touch_handler(struct widget *widget, struct input *input,
+		 uint32_t serial, uint32_t time, int32_t id,
+		 float tx, float ty, void *data)
+{
+	struct entry *entry = data;
+	struct wl_text_input_manager *text_input_manager =
+		entry->message_window->wlmessage->text_input_manager;
+
+	widget_schedule_redraw (widget);
+
+	if (!text_input_manager) {
+		entry->active = 1;
+		return;
+	}
+
+	if (!entry->text_input) {
+		entry->text_input = wl_text_input_manager_create_text_input (text_input_manager);
+		display_set_input_proxy (window_get_display (entry->message_window->window),
+		                         entry->text_input);
+		wl_text_input_add_listener (entry->text_input, &text_input_listener, entry);
+	}
+
+	struct wl_seat *seat = input_get_seat (input);
+	struct wl_surface *surface = window_get_wl_surface (entry->message_window->window);
+	wl_text_input_show_input_panel (entry->text_input);
+	wl_text_input_activate (entry->text_input, seat, surface);
+
+	entry->active = 1;
+}
+
+static int
+entry_motion_handler(struct widget *widget,
+		struct input *input, uint32_t time,
+		float x, float y, void *data)
+{
+	return CURSOR_IBEAM;
+}
+
+/* What redraw_handler() paints and resize_handler() lays out */
+static void
+message_window_get_content (struct message_window *message_window,
+                            struct dialog_content *content)
+{
+	struct button *button;
+	int i = 0;
+
+	memset (content, 0, sizeof *content);
+	content->message = message_window->message;
+	content->icon = message_window->icon;
+
+	wl_list_for_each (button, &message_window->button_list, link) {
+		content->captions[i] = button->caption;
+		content->focused[i] = button->focused;
+		content->pressed[i] = button->pressed;
+		i++;
+	}
+	content->buttons_nb = i;
+
+	if (message_window->entry) {
+		content->entry_text = message_window->entry->text;
+		content->entry_cursor = message_window->entry->cursor_pos;
+		content->entry_active = message_window->entry->active;
+	}
+}
+
+static void
+resize_handler (struct widget *widget, int32_t width, int32_t height, void *data)
+{
+	struct message_window *message_window = data;
+	struct dialog_content content;
+	struct dialog_layout layout;
+	struct button *button;
+	struct rectangle allocation;
+	int i;
+
+	widget_get_allocation (widget, &allocation);
+	allocation.width = width;
+	allocation.height = height;
+
+	message_window_get_content (message_window, &content);
+	layout_dialog (&allocation, &content, &layout);
+
+	if (message_window->entry)
+		widget_set_allocation (message_window->entry->widget,
+		                       layout.entry.x, layout.entry.y,
+		                       layout.entry.width, layout.entry.height);
+
+	i = 0;
+	wl_list_for_each (button, &message_window->button_list, link) {
+		widget_set_allocation (button->widget,
+		                       layout.buttons[i].x, layout.buttons[i].y,
+		                       layout.buttons[i].width, layout.buttons[i].height);
+		i++;
+	}
+}
+
+/*
+ * The whole dialog is painted here, by the same code as render_to_png();
+ * the button and entry widgets only take input.
+ */
+static void
+redraw_handler (struct widget *widget, void *data)
+{
+	struct message_window *message_window = data;
+	struct dialog_content content;
+	struct rectangle allocation;
+	cairo_t *cr;
+
+	widget_get_allocation (message_window->widget, &allocation);
+	message_window_get_content (message_window, &content);
+
+	cr = widget_cairo_create (message_window->widget);
+	draw_dialog (cr, &allocation, &content);
+	cairo_destroy (cr);
+}
+
+static void
+keyboard_focus_handler (struct window *window, struct input *input, void *data)
+{
+	struct message_window *message_window = data;
+
+	window_schedule_redraw (message_window->window);
+}
+
+static void
+key_handler (struct window *window, struct input *input, uint32_t time,
+		 uint32_t key, uint32_t sym, enum wl_keyboard_key_state state,
+		 void *data)
+{
+	struct message_window *message_window = data;
+	struct entry *entry = message_window->entry;
+	char *new_text;
+	char text[16];
+
+	if (state == WL_KEYBOARD_KEY_STATE_RELEASED)
+		return;
+
+	if (sym == XKB_KEY_Return || sym == XKB_KEY_KP_Enter) {
+		message_window_answer (message_window,
+		                       message_window->default_value, 1);
+		return;
+	}
+
+	if (entry && entry->active) {
+		switch (sym) {
+			case XKB_KEY_BackSpace:
+				if (entry->cursor_pos == 0)
+					break;
+				new_text = malloc (strlen(entry->text));
+				strncpy (new_text, entry->text, entry->cursor_pos - 1);
+				strcpy (new_text+entry->cursor_pos-1, entry->text+entry->cursor_pos);
+				free (entry->text);
+				entry->text = new_text;
+				entry->cursor_pos--;
+				break;
+			case XKB_KEY_Delete:
+				if (entry->cursor_pos == strlen (entry->text))
+					break;
+				new_text = malloc (strlen(entry->text));
+				strncpy (new_text, entry->text, entry->cursor_pos);
+				strcpy (new_text+entry->cursor_pos, entry->text+entry->cursor_pos+1);
+				free (entry->text);
+				entry->text = new_text;
+				break;
+			case XKB_KEY_Left:
+				if (entry->cursor_pos != 0)
+					entry->cursor_pos--;
+				break;
+			case XKB_KEY_Right:
+				if (entry->cursor_pos != strlen (entry->text))
+					entry->cursor_pos++;
+				break;
+			case XKB_KEY_Tab:
+				break;
+			default:
+				if (strlen(entry->text) >= 18)
+					break;
+				if (xkb_keysym_to_utf8 (sym, text, sizeof(text)) <= 0)
+					break;
+				if (strlen(text) > 1)	/* dismiss non-ASCII characters for now */
+					break;
+				new_text = malloc (strlen(entry->text) + strlen(text) + 1);
+				strncpy (new_text, entry->text, entry->cursor_pos);
+				strcpy (new_text+entry->cursor_pos, text);
+				strcpy (new_text+entry->cursor_pos+strlen(text), entry->text+entry->cursor_pos);
+				free (entry->text);
+				entry->text = new_text;
+				entry->cursor_pos++;
+		}
+		widget_schedule_redraw(entry->widget);
+	}
+}
+
+static void
+message_window_add_entry (struct message_window *message_window, char *textfield)
+{
+	struct entry *entry;
+
+	entry = xzalloc (sizeof *entry);
+	entry->message_window = message_window;
+	entry->widget = widget_add_widget (message_window->widget, entry);
+	entry->text = strdup (textfield);
+	entry->cursor_pos = strlen (entry->text);
+	entry->cursor_anchor = entry->cursor_pos;
+	entry->last_vkb_len = 0;
+	entry->active = 0;
+
+	message_window->entry = entry;
+
+	widget_set_motion_handler (entry->widget, entry_motion_handler);
+	widget_set_button_handler (entry->widget, entry_click_handler);
+	widget_set_touch_down_handler (entry->widget, entry_touch_handler);
+}
+
+static void
+message_window_add_button (struct message_window *message_window, char *caption, int value)
+{
+	struct button *button;
+
+	button = xzalloc (sizeof *button);
+	button->message_window = message_window;
+	button->widget = widget_add_widget (message_window->widget, button);
+	button->caption = strdup (caption);
+	button->value = value;
+
+	widget_set_enter_handler (button->widget, button_enter_handler);
+	widget_set_leave_handler (button->widget, button_leave_handler);
+	widget_set_button_handler (button->widget, button_click_handler);
+	widget_set_touch_down_handler (button->widget, button_touch_down_handler);
+	widget_set_touch_up_handler (button->widget, button_touch_up_handler);
+
+	wl_list_insert (message_window->button_list.prev, &button->link);
+}
+
+static struct message_window *
+message_window_create (struct wlmessage *wlmessage)
+{
+	struct message_window *message_window;
+	int frame_type = parse_titlebuttons (wlmessage->titlebuttons);
+	int compact = wlmessage->compact;
+	char *message = wlmessage->message ? wlmessage->message : "";
+	int extended_width = 0;
+	int lines_nb = 0;
+	int i;
+
+	message_window = xzalloc (sizeof *message_window);
+	message_window->wlmessage = wlmessage;
+	message_window->window = window_create (wlmessage->display);
+	if (wlmessage->low_memory) {
+		 /* 16-bit shm buffers, no shadow, a single buffer if possible */
+		window_set_buffer_type (message_window->window, WINDOW_BUFFER_TYPE_SHM);
+		window_set_preferred_format (message_window->window, WINDOW_PREFERRED_FORMAT_RGB565);
+		window_set_low_memory (message_window->window, 1);
+		 /* RGB565 has no alpha, so leave no transparent pixel either */
+		compact = 1;
+	}
+	if (compact)
+		window_set_compact_frame (message_window->window, 1);
+	message_window->widget = window_frame_create (message_window->window, frame_type, !wlmessage->noresize,  message_window);
+
+	message_window->message = strdup (message);
+
+	if (wlmessage->title)
+		message_window->title = strdup (wlmessage->title);
+	else
+		message_window->title = strdup ("wlmessage");
+	window_set_title (message_window->window, message_window->title);
+
+	message_window->buttons_nb = 0;
+	wl_list_init (&message_window->button_list);
+	for (i = 0; i < wlmessage->buttons_nb; i++) {
+		message_window_add_button (message_window, wlmessage->captions[i],
+		                           wlmessage->values[i]);
+		message_window->buttons_nb++;
+	}
+
+	message_window->default_value = 0;
+	if (wlmessage->deflt) {
+		struct button *button;
+		wl_list_for_each (button, &message_window->button_list, link) {
+			if (!strcmp(button->caption, wlmessage->deflt))
+				message_window->default_value = button->value;
+		}
+	}
+
+	if (wlmessage->textfield) {
+		message_window_add_entry (message_window, wlmessage->textfield);
+	} else {
+		message_window->entry = NULL;
+	}
+
+	startup_trace_phase ("message_window_create");
+
+	message_window->icon = wlmessage->icon ? load_icon (wlmessage->icon) : NULL;
+	startup_trace_phase ("icon_load");
+
+	extended_width = (get_max_length_of_lines (message)) - 35;
+	 if (extended_width < 0) extended_width = 0;
+	lines_nb = get_number_of_lines (message);
+
+	window_set_user_data (message_window->window, message_window);
+	window_set_keyboard_focus_handler (message_window->window, keyboard_focus_handler);
+	window_set_key_handler (message_window->window, key_handler);
+	window_set_close_handler (message_window->window, close_handler);
+	widget_set_redraw_handler (message_window->widget, redraw_handler);
+	widget_set_resize_handler (message_window->widget, resize_handler);
+
+	 /* 480x280 with the default frame and its shadow */
+	window_frame_set_child_size (message_window->widget,
+	                             404 + extended_width*10,
+	                             183 + lines_nb*16 + (!message_window->entry ? 0 : 1)*32
+	                                               + (!message_window->buttons_nb ? 0 : 1)*32);
+
+	return message_window;
+}
+
+static void
+message_window_destroy (struct message_window *message_window)
+{
+	if (message_window->icon)
+		cairo_surface_destroy (message_window->icon);
+
+	struct entry *entry;
+	if (message_window->entry) {
+		entry = message_window->entry;
+		if (entry->text_input)
+			wl_text_input_destroy (entry->text_input);
+		widget_destroy(entry->widget);
+		free (entry->text);
+		free (entry);
+	}
+
+	struct button *button, *tmp;
+	wl_list_for_each_safe (button, tmp, &message_window->button_list, link) {
+		wl_list_remove (&button->link);
+		widget_destroy (button->widget);
+		free (button->caption);
+		free (button);
+	}
+
+	widget_destroy (message_window->widget);
+	window_destroy (message_window->window);
+	free (message_window->title);
+	free (message_window->message);
+	free (message_window);
+}
+
+
+struct wlmessage *
+wlmessage_create (struct display *display)
+{
+	struct wlmessage *wlmessage;
+
+	wlmessage = xzalloc (sizeof *wlmessage);
+	wlmessage->display = display;
+	wlmessage->done_task.run = done_task_run;
+	toytimer_init (&wlmessage->timeout_timer, display, timeout_func);
+
+	return wlmessage;
+}
+
+void
+wlmessage_destroy (struct wlmessage *wlmessage)
+{
+	int i;
+
+	if (wlmessage->answer_pending)
+		wl_list_remove (&wlmessage->done_task.link);
+	toytimer_fini (&wlmessage->timeout_timer);
+
+	if (wlmessage->message_window)
+		message_window_destroy (wlmessage->message_window);
+	if (wlmessage->text_input_manager)
+		wl_text_input_manager_destroy (wlmessage->text_input_manager);
+
+	for (i = 0; i < wlmessage->buttons_nb; i++)
+		free (wlmessage->captions[i]);
+	free (wlmessage->message);
+	free (wlmessage->title);
+	free (wlmessage->titlebuttons);
+	free (wlmessage->icon);
+	free (wlmessage->deflt);
+	free (wlmessage->textfield);
+	free (wlmessage->answer_text);
+	free (wlmessage);
+}
+
+static void
+set_string (char **field, const char *value)
+{
+	free (*field);
+	*field = value ? strdup (value) : NULL;
+}
+
+void
+wlmessage_set_message (struct wlmessage *wlmessage, const char *message)
+{
+	set_string (&wlmessage->message, message);
+}
+
+void
+wlmessage_set_title (struct wlmessage *wlmessage, const char *title)
+{
+	set_string (&wlmessage->title, title);
+}
+
+void
+wlmessage_set_titlebuttons (struct wlmessage *wlmessage,
+                            const char *titlebuttons)
+{
+	set_string (&wlmessage->titlebuttons, titlebuttons);
+}
+
+void
+wlmessage_set_noresize (struct wlmessage *wlmessage, int noresize)
+{
+	wlmessage->noresize = noresize;
+}
+
+void
+wlmessage_set_compact (struct wlmessage *wlmessage, int compact)
+{
+	wlmessage->compact = compact;
+}
+
+void
+wlmessage_set_low_memory (struct wlmessage *wlmessage, int low_memory)
+{
+	wlmessage->low_memory = low_memory;
+}
+
+void
+wlmessage_set_icon (struct wlmessage *wlmessage, const char *filename)
+{
+	set_string (&wlmessage->icon, filename);
+}
+
+int
+wlmessage_add_button (struct wlmessage *wlmessage, const char *caption,
+                      int value)
+{
+	if (wlmessage->buttons_nb == MAX_BUTTONS)
+		return -1;
+
+	wlmessage->captions[wlmessage->buttons_nb] = strdup (caption);
+	wlmessage->values[wlmessage->buttons_nb] = value;
+	wlmessage->buttons_nb++;
+
+	return 0;
+}
+
+void
+wlmessage_set_default_button (struct wlmessage *wlmessage,
+                              const char *caption)
+{
+	set_string (&wlmessage->deflt, caption);
+}
+
+void
+wlmessage_set_textfield (struct wlmessage *wlmessage, const char *text)
+{
+	set_string (&wlmessage->textfield, text);
+}
+
+void
+wlmessage_set_timeout (struct wlmessage *wlmessage, int timeout)
+{
+	wlmessage->timeout = timeout;
+}
+
+int
+wlmessage_show (struct wlmessage *wlmessage, wlmessage_done_func_t done,
+                void *data)
+{
+	if (wlmessage->message_window)
+		return -1;
+
+	wlmessage->done = done;
+	wlmessage->done_data = data;
+
+	/* Bound here, the global handler belongs to the host */
+	if (wlmessage->textfield)
+		wlmessage->text_input_manager =
+			display_bind_interface (wlmessage->display,
+			                        &wl_text_input_manager_interface, 1);
+
+	wlmessage->message_window = message_window_create (wlmessage);
+
+	if (wlmessage->timeout > 0)
+		toytimer_arm (&wlmessage->timeout_timer,
+		              wlmessage->timeout * 1000ULL, 0);
+
+	return 0;
+}
@@ -0,0 +1,124 @@
+/* Copyright © 2014 Manuel Bachmann */
+
+#ifndef LIBWLMESSAGE_H
+#define LIBWLMESSAGE_H
+
+/*
+ * Message dialogs on a toolkit display, as shown by wlmessage(1). Any
+ * number of them can be shown on the same display; the display is run
+ * by display_run() or by the host main loop with the calls below.
+ */
+struct wlmessage;
+
+struct display;
+struct wl_display;
+
+/*
+ * The toolkit display calls which are part of the library; see
+ * window.h in the wlmessage sources for their details.
+ */
+struct display *
+display_create(int *argc, char *argv[]);
+
+/*
+ * Show the dialogs on a connection of the caller, which it keeps
+ * owning. The dialogs' objects live on an event queue of their own, so
+ * the caller's default queue is left alone; as both read the same
+ * socket, the caller has to dispatch its pending events
+ * (wl_display_dispatch_pending()) after display_dispatch_once().
+ */
+struct display *
+display_create_for_wl_display(struct wl_display *wl_display);
+
+void
+display_destroy(struct display *display);
+
+struct wl_display *
+display_get_display(struct display *display);
+
+void
+display_run(struct display *d);
+
+void
+display_exit(struct display *d);
+
+/*
+ * For a host main loop: watch the epoll fd, block at most the timeout
+ * (in ms, -1 for none), and call display_dispatch_once() whenever the
+ * fd is readable or the timeout expires. It returns -1 once the display
+ * has been exited, and starts it again on the next call.
+ */
+int
+display_get_epoll_fd(struct display *display);
+
+int
+display_get_next_timeout(struct display *display);
+
+int
+display_dispatch_once(struct display *display);
+
+/*
+ * Called once per dialog when it is answered. value is that of the
+ * activated button (or of the default button for Return), text the
+ * content of the text field if there is one. Both are 0 and NULL when
+ * the dialog is closed or times out. text is only valid during the
+ * call. The callback may destroy the dialog.
+ */
+typedef void (*wlmessage_done_func_t) (struct wlmessage *wlmessage,
+                                       int value, const char *text,
+                                       void *data);
+
+struct wlmessage *
+wlmessage_create (struct display *display);
+
+void
+wlmessage_destroy (struct wlmessage *wlmessage);
+
+/* Set before wlmessage_show(); strings are copied */
+void
+wlmessage_set_message (struct wlmessage *wlmessage, const char *message);
+
+void
+wlmessage_set_title (struct wlmessage *wlmessage, const char *title);
+
+/* Comma-separated list of "Min, Max, Close, None" */
+void
+wlmessage_set_titlebuttons (struct wlmessage *wlmessage,
+                            const char *titlebuttons);
+
+void
+wlmessage_set_noresize (struct wlmessage *wlmessage, int noresize);
+
+void
+wlmessage_set_compact (struct wlmessage *wlmessage, int compact);
+
+/* 16-bit single-buffered rendering, implies compact */
+void
+wlmessage_set_low_memory (struct wlmessage *wlmessage, int low_memory);
+
+void
+wlmessage_set_icon (struct wlmessage *wlmessage, const char *filename);
+
+/* Returns -1 when the dialog already has its three buttons */
+int
+wlmessage_add_button (struct wlmessage *wlmessage, const char *caption,
+                      int value);
+
+/* Button activated by Return, by caption */
+void
+wlmessage_set_default_button (struct wlmessage *wlmessage,
+                              const char *caption);
+
+void
+wlmessage_set_textfield (struct wlmessage *wlmessage, const char *text);
+
+/* Answer with 0 after timeout milliseconds, 0 for never */
+void
+wlmessage_set_timeout (struct wlmessage *wlmessage, int timeout);
+
+/* Map the dialog; returns -1 if it is already shown */
+int
+wlmessage_show (struct wlmessage *wlmessage, wlmessage_done_func_t done,
+                void *data);
+
+#endif
@@ -36,6 +36,14 @@ ExclusiveArch:
 %description
 wlmessage is a very tiny and toolkit-independent tool, following the "xmessage" syntax and able to display interactive dialog boxes under Wayland.
 
+%package devel
+Summary:        Development files for libwlmessage
+Group:          Graphics & UI Framework/Development
+Requires:       %{name} = %{version}
+
+%description devel
+Headers for libwlmessage, which shows wlmessage dialogs on an existing Wayland display.
+
 %prep
 %setup -q
 cp %{SOURCE1} .
@@ -47,6 +55,7 @@ make %{?_smp_mflags}
 %install
 %make_install
 # install binaries
+rm -f %{buildroot}%{_libdir}/libwlmessage.la
 
 
 %files
@@ -54,6 +63,17 @@ make %{?_smp_mflags}
 %defattr(-,root,root)
 %license COPYING
 %{_bindir}/wlmessage
+%{_libdir}/libwlmessage.so.*
 %{_datadir}/wlmessage
 
+%post -p /sbin/ldconfig
+
+%postun -p /sbin/ldconfig
+
+%files devel
+%manifest %{name}.manifest
+%{_includedir}/wlmessage
+%{_libdir}/libwlmessage.so
+%{_libdir}/pkgconfig/libwlmessage.pc
+
 %changelog
@@ -0,0 +1,215 @@
+/* 
+ * Copyright (C) 2015 Martin Gräßlin
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 2.1 of the License, or
+ * (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERVER_DECORATION_CLIENT_PROTOCOL_H
+#define SERVER_DECORATION_CLIENT_PROTOCOL_H
+
+#ifdef  __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include "wayland-client.h"
+
+struct wl_client;
+struct wl_resource;
+
+struct org_kde_kwin_server_decoration_manager;
+struct org_kde_kwin_server_decoration;
+
+extern const struct wl_interface org_kde_kwin_server_decoration_manager_interface;
+extern const struct wl_interface org_kde_kwin_server_decoration_interface;
+
+#ifndef ORG_KDE_KWIN_SERVER_DECORATION_MANAGER_MODE_ENUM
+#define ORG_KDE_KWIN_SERVER_DECORATION_MANAGER_MODE_ENUM
+/**
+ * org_kde_kwin_server_decoration_manager_mode - Possible values to use
+ *	in request_mode and the event mode.
+ * @ORG_KDE_KWIN_SERVER_DECORATION_MANAGER_MODE_NONE: Undecorated: The
+ *	surface is not decorated at all, neither server nor client-side.
+ * @ORG_KDE_KWIN_SERVER_DECORATION_MANAGER_MODE_CLIENT: Client-side
+ *	decoration: The decoration is part of the surface and the client.
+ * @ORG_KDE_KWIN_SERVER_DECORATION_MANAGER_MODE_SERVER: Server-side
+ *	decoration: The server embeds the surface into a decoration frame.
+ */
+enum org_kde_kwin_server_decoration_manager_mode {
+	ORG_KDE_KWIN_SERVER_DECORATION_MANAGER_MODE_NONE = 0,
+	ORG_KDE_KWIN_SERVER_DECORATION_MANAGER_MODE_CLIENT = 1,
+	ORG_KDE_KWIN_SERVER_DECORATION_MANAGER_MODE_SERVER = 2,
+};
+#endif /* ORG_KDE_KWIN_SERVER_DECORATION_MANAGER_MODE_ENUM */
+
+/**
+ * org_kde_kwin_server_decoration_manager - Server side window decoration
+ *	manager
+ * @default_mode: The default mode used on the server
+ *
+ * This interface allows to coordinate whether the server should create a
+ * server-side window decoration around a wl_surface representing a
+ * shell surface or whether the client should draw it itself.
+ */
+struct org_kde_kwin_server_decoration_manager_listener {
+	/**
+	 * default_mode - The default mode used on the server
+	 * @mode: The default decoration mode applied to newly created
+	 *	server decorations.
+	 *
+	 * This event is emitted directly after binding the interface. It
+	 * contains the default mode for the decoration. When a new server
+	 * decoration object is created this new object will be in the
+	 * default mode until the first request_mode is requested.
+	 */
+	void (*default_mode)(void *data,
+			     struct org_kde_kwin_server_decoration_manager *org_kde_kwin_server_decoration_manager,
+			     uint32_t mode);
+};
+
+static inline int
+org_kde_kwin_server_decoration_manager_add_listener(struct org_kde_kwin_server_decoration_manager *org_kde_kwin_server_decoration_manager,
+						    const struct org_kde_kwin_server_decoration_manager_listener *listener, void *data)
+{
+	return wl_proxy_add_listener((struct wl_proxy *) org_kde_kwin_server_decoration_manager,
+				     (void (**)(void)) listener, data);
+}
+
+#define ORG_KDE_KWIN_SERVER_DECORATION_MANAGER_CREATE	0
+
+static inline void
+org_kde_kwin_server_decoration_manager_set_user_data(struct org_kde_kwin_server_decoration_manager *org_kde_kwin_server_decoration_manager, void *user_data)
+{
+	wl_proxy_set_user_data((struct wl_proxy *) org_kde_kwin_server_decoration_manager, user_data);
+}
+
+static inline void *
+org_kde_kwin_server_decoration_manager_get_user_data(struct org_kde_kwin_server_decoration_manager *org_kde_kwin_server_decoration_manager)
+{
+	return wl_proxy_get_user_data((struct wl_proxy *) org_kde_kwin_server_decoration_manager);
+}
+
+static inline void
+org_kde_kwin_server_decoration_manager_destroy(struct org_kde_kwin_server_decoration_manager *org_kde_kwin_server_decoration_manager)
+{
+	wl_proxy_destroy((struct wl_proxy *) org_kde_kwin_server_decoration_manager);
+}
+
+static inline struct org_kde_kwin_server_decoration *
+org_kde_kwin_server_decoration_manager_create(struct org_kde_kwin_server_decoration_manager *org_kde_kwin_server_decoration_manager, struct wl_surface *surface)
+{
+	struct wl_proxy *id;
+
+	id = wl_proxy_marshal_constructor((struct wl_proxy *) org_kde_kwin_server_decoration_manager,
+			 ORG_KDE_KWIN_SERVER_DECORATION_MANAGER_CREATE, &org_kde_kwin_server_decoration_interface, NULL, surface);
+
+	return (struct org_kde_kwin_server_decoration *) id;
+}
+
+#ifndef ORG_KDE_KWIN_SERVER_DECORATION_MODE_ENUM
+#define ORG_KDE_KWIN_SERVER_DECORATION_MODE_ENUM
+/**
+ * org_kde_kwin_server_decoration_mode - Possible values to use in
+ *	request_mode and the event mode.
+ * @ORG_KDE_KWIN_SERVER_DECORATION_MODE_NONE: Undecorated: The surface
+ *	is not decorated at all, neither server nor client-side.
+ * @ORG_KDE_KWIN_SERVER_DECORATION_MODE_CLIENT: Client-side decoration:
+ *	The decoration is part of the surface and the client.
+ * @ORG_KDE_KWIN_SERVER_DECORATION_MODE_SERVER: Server-side decoration:
+ *	The server embeds the surface into a decoration frame.
+ */
+enum org_kde_kwin_server_decoration_mode {
+	ORG_KDE_KWIN_SERVER_DECORATION_MODE_NONE = 0,
+	ORG_KDE_KWIN_SERVER_DECORATION_MODE_CLIENT = 1,
+	ORG_KDE_KWIN_SERVER_DECORATION_MODE_SERVER = 2,
+};
+#endif /* ORG_KDE_KWIN_SERVER_DECORATION_MODE_ENUM */
+
+struct org_kde_kwin_server_decoration_listener {
+	/**
+	 * mode - The new decoration mode applied by the server
+	 * @mode: The decoration mode applied to the surface by the
+	 *	server.
+	 *
+	 * This event is emitted directly after the decoration is created
+	 * and represents the base decoration policy by the server. E.g. a
+	 * server which wants all surfaces to be client-side decorated will
+	 * send Client, a server which wants server-side decoration will
+	 * send Server.
+	 *
+	 * The client can request a different mode through the decoration
+	 * request. The server will acknowledge this by another event with
+	 * the same mode. So even if a server prefers server-side
+	 * decoration it's possible to force a client-side decoration.
+	 *
+	 * The server may emit this event at any time. In this case the
+	 * client can again request a different mode. It's the
+	 * responsibility of the server to prevent a feedback loop.
+	 */
+	void (*mode)(void *data,
+		     struct org_kde_kwin_server_decoration *org_kde_kwin_server_decoration,
+		     uint32_t mode);
+};
+
+static inline int
+org_kde_kwin_server_decoration_add_listener(struct org_kde_kwin_server_decoration *org_kde_kwin_server_decoration,
+					    const struct org_kde_kwin_server_decoration_listener *listener, void *data)
+{
+	return wl_proxy_add_listener((struct wl_proxy *) org_kde_kwin_server_decoration,
+				     (void (**)(void)) listener, data);
+}
+
+#define ORG_KDE_KWIN_SERVER_DECORATION_RELEASE	0
+#define ORG_KDE_KWIN_SERVER_DECORATION_REQUEST_MODE	1
+
+static inline void
+org_kde_kwin_server_decoration_set_user_data(struct org_kde_kwin_server_decoration *org_kde_kwin_server_decoration, void *user_data)
+{
+	wl_proxy_set_user_data((struct wl_proxy *) org_kde_kwin_server_decoration, user_data);
+}
+
+static inline void *
+org_kde_kwin_server_decoration_get_user_data(struct org_kde_kwin_server_decoration *org_kde_kwin_server_decoration)
+{
+	return wl_proxy_get_user_data((struct wl_proxy *) org_kde_kwin_server_decoration);
+}
+
+static inline void
+org_kde_kwin_server_decoration_destroy(struct org_kde_kwin_server_decoration *org_kde_kwin_server_decoration)
+{
+	wl_proxy_destroy((struct wl_proxy *) org_kde_kwin_server_decoration);
+}
+
+static inline void
+org_kde_kwin_server_decoration_release(struct org_kde_kwin_server_decoration *org_kde_kwin_server_decoration)
+{
+	wl_proxy_marshal((struct wl_proxy *) org_kde_kwin_server_decoration,
+			 ORG_KDE_KWIN_SERVER_DECORATION_RELEASE);
+
+	wl_proxy_destroy((struct wl_proxy *) org_kde_kwin_server_decoration);
+}
+
+static inline void
+org_kde_kwin_server_decoration_request_mode(struct org_kde_kwin_server_decoration *org_kde_kwin_server_decoration, uint32_t mode)
+{
+	wl_proxy_marshal((struct wl_proxy *) org_kde_kwin_server_decoration,
+			 ORG_KDE_KWIN_SERVER_DECORATION_REQUEST_MODE, mode);
+}
+
+#ifdef  __cplusplus
+}
+#endif
+
+#endif
@@ -29,6 +29,7 @@
 #include <stdio.h>
 #include <math.h>
 #include <cairo.h>
+#include <wayland-client.h>
 #include "cairo-util.h"
 
 #include "image-loader.h"
@@ -46,7 +47,7 @@ surface_flush_device(cairo_surface_t *surface)
 		cairo_device_flush(device);
 }
 
-static int
+int
 blur_surface(cairo_surface_t *surface, int margin)
 {
 	int32_t width, height, stride, x, y, z, w;
@@ -299,6 +300,80 @@ rounded_rect(cairo_t *cr, int x0, int y0, int x1, int y1, int radius)
 	cairo_close_path(cr);
 }
 
+/*
+ * Map surface coordinates to buffer coordinates for a buffer attached
+ * with the given wl_output_transform and scale.
+ */
+void
+transform_cairo_to_buffer(cairo_t *cr, uint32_t transform, int32_t scale,
+			  int surface_width, int surface_height)
+{
+	double angle;
+	cairo_matrix_t m;
+	int translate_x, translate_y;
+
+	switch (transform) {
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		cairo_matrix_init(&m, -1, 0, 0, 1, 0, 0);
+		break;
+	default:
+		cairo_matrix_init_identity(&m);
+		break;
+	}
+
+	switch (transform) {
+	case WL_OUTPUT_TRANSFORM_NORMAL:
+	default:
+		angle = 0;
+		translate_x = 0;
+		translate_y = 0;
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED:
+		angle = 0;
+		translate_x = surface_width;
+		translate_y = 0;
+		break;
+	case WL_OUTPUT_TRANSFORM_90:
+		angle = M_PI_2;
+		translate_x = surface_height;
+		translate_y = 0;
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
+		angle = M_PI_2;
+		translate_x = surface_height;
+		translate_y = surface_width;
+		break;
+	case WL_OUTPUT_TRANSFORM_180:
+		angle = M_PI;
+		translate_x = surface_width;
+		translate_y = surface_height;
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
+		angle = M_PI;
+		translate_x = 0;
+		translate_y = surface_height;
+		break;
+	case WL_OUTPUT_TRANSFORM_270:
+		angle = M_PI + M_PI_2;
+		translate_x = 0;
+		translate_y = surface_width;
+		break;
+	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
+		angle = M_PI + M_PI_2;
+		translate_x = 0;
+		translate_y = 0;
+		break;
+	}
+
+	cairo_scale(cr, scale, scale);
+	cairo_translate(cr, translate_x, translate_y);
+	cairo_rotate(cr, angle);
+	cairo_transform(cr, &m);
+}
+
 cairo_surface_t *
 load_cairo_surface(const char *filename)
 {
@@ -424,7 +499,8 @@ theme_render_frame(struct theme *t,
 	cairo_set_source_rgba(cr, 0, 0, 0, 0);
 	cairo_paint(cr);
 
-	if (flags & THEME_FRAME_MAXIMIZED)
+	if (flags & (THEME_FRAME_MAXIMIZED | THEME_FRAME_NO_SHADOW |
+		     THEME_FRAME_COMPACT))
 		margin = 0;
 	else {
 		cairo_set_source_rgba(cr, 0, 0, 0, 0.45);
@@ -444,10 +520,17 @@ theme_render_frame(struct theme *t,
 	else
 		top_margin = t->width;
 
-	tile_source(cr, source,
-		    margin, margin,
-		    width - margin * 2, height - margin * 2,
-		    t->width, top_margin);
+	if (flags & THEME_FRAME_COMPACT) {
+		/* Square corners, so that every pixel is opaque */
+		theme_set_background_source(t, cr, flags);
+		cairo_rectangle(cr, 0, 0, width, height);
+		cairo_fill(cr);
+	} else {
+		tile_source(cr, source,
+			    margin, margin,
+			    width - margin * 2, height - margin * 2,
+			    t->width, top_margin);
+	}
 
 	if (title) {
 		cairo_rectangle (cr, margin + t->width, margin,
@@ -491,7 +574,8 @@ theme_get_location(struct theme *t, int x, int y,
 	const int grip_size = 8;
 	int margin, top_margin;
 
-	margin = (flags & THEME_FRAME_MAXIMIZED) ? 0 : t->margin;
+	margin = (flags & (THEME_FRAME_MAXIMIZED | THEME_FRAME_NO_SHADOW |
+			   THEME_FRAME_COMPACT)) ? 0 : t->margin;
 
 	if (flags & THEME_FRAME_NO_TITLE)
 		top_margin = t->width;
@@ -29,6 +29,9 @@
 void
 surface_flush_device(cairo_surface_t *surface);
 
+int
+blur_surface(cairo_surface_t *surface, int margin);
+
 void
 tile_mask(cairo_t *cr, cairo_surface_t *surface,
 	  int x, int y, int width, int height, int margin, int top_margin);
@@ -40,6 +43,10 @@ tile_source(cairo_t *cr, cairo_surface_t *surface,
 void
 rounded_rect(cairo_t *cr, int x0, int y0, int x1, int y1, int radius);
 
+void
+transform_cairo_to_buffer(cairo_t *cr, uint32_t transform, int32_t scale,
+			  int surface_width, int surface_height);
+
 cairo_surface_t *
 load_cairo_surface(const char *filename);
 
@@ -61,7 +68,9 @@ theme_destroy(struct theme *t);
 enum {
 	THEME_FRAME_ACTIVE = 1,
 	THEME_FRAME_MAXIMIZED = 2,
-	THEME_FRAME_NO_TITLE = 4
+	THEME_FRAME_NO_TITLE = 4,
+	THEME_FRAME_NO_SHADOW = 8,
+	THEME_FRAME_COMPACT = 16
 };
 
 void
@@ -106,7 +115,9 @@ enum frame_status {
 
 enum frame_flag {
 	FRAME_FLAG_ACTIVE = 0x1,
-	FRAME_FLAG_MAXIMIZED = 0x2
+	FRAME_FLAG_MAXIMIZED = 0x2,
+	FRAME_FLAG_NO_SHADOW = 0x4,
+	FRAME_FLAG_COMPACT = 0x8
 };
 
 enum {
@@ -123,12 +134,16 @@ enum frame_button_state {
 };
 
 struct frame *
-frame_create(struct theme *t, int32_t width, int32_t height, uint32_t buttons,
-            uint32_t resizable, const char *title);
+frame_create(struct theme *t, int32_t width, int32_t height, uint32_t resizable,
+            uint32_t buttons, const char *title);
 
 void
 frame_destroy(struct frame *frame);
 
+/* Decode the frame button icons ahead of the first frame_create() */
+void
+frame_preload_icons(void);
+
 /* May set FRAME_STATUS_REPAINT */
 int
 frame_set_title(struct frame *frame, const char *title);
@@ -29,6 +29,8 @@
 
 #include "cairo-util.h"
 
+#define ARRAY_LENGTH(a) (sizeof (a) / sizeof (a)[0])
+
 enum frame_button_flags {
 	FRAME_BUTTON_ALIGN_RIGHT = 0x1,
 	FRAME_BUTTON_DECORATED = 0x2,
@@ -100,6 +102,47 @@ struct frame {
 	struct wl_list touches;
 };
 
+/* Decoded once per process, see frame_preload_icons() */
+static struct {
+	const char *path;
+	cairo_surface_t *surface;
+} frame_icons[] = {
+	{ DATADIR "/wlmessage/icon_window.png" },
+	{ DATADIR "/wlmessage/sign_close.png" },
+	{ DATADIR "/wlmessage/sign_maximize.png" },
+	{ DATADIR "/wlmessage/sign_minimize.png" },
+};
+
+static cairo_surface_t *
+frame_icon_load(const char *path)
+{
+	cairo_surface_t *surface;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(frame_icons); i++)
+		if (strcmp(frame_icons[i].path, path) == 0)
+			break;
+
+	if (i < ARRAY_LENGTH(frame_icons) && frame_icons[i].surface)
+		return cairo_surface_reference(frame_icons[i].surface);
+
+	surface = cairo_image_surface_create_from_png(path);
+	if (i < ARRAY_LENGTH(frame_icons) &&
+	    cairo_surface_status(surface) == CAIRO_STATUS_SUCCESS)
+		frame_icons[i].surface = cairo_surface_reference(surface);
+
+	return surface;
+}
+
+void
+frame_preload_icons(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_LENGTH(frame_icons); i++)
+		cairo_surface_destroy(frame_icon_load(frame_icons[i].path));
+}
+
 static struct frame_button *
 frame_button_create(struct frame *frame, const char *icon,
 		    enum frame_status status_effect,
@@ -112,7 +155,7 @@ frame_button_create(struct frame *frame, const char *icon,
 	if (!button)
 		return NULL;
 
-	button->icon = cairo_image_surface_create_from_png(icon);
+	button->icon = frame_icon_load(icon);
 	status = cairo_surface_status(button->icon);
 	if ((!button->icon) || (status != CAIRO_STATUS_SUCCESS)) {
 		free(button);
@@ -384,10 +427,16 @@ frame_set_title(struct frame *frame, const char *title)
 	return 0;
 }
 
+#define FRAME_NO_SHADOW_FLAGS (FRAME_FLAG_NO_SHADOW | FRAME_FLAG_COMPACT)
+#define FRAME_GEOMETRY_FLAGS (FRAME_FLAG_MAXIMIZED | FRAME_NO_SHADOW_FLAGS)
+
 void
 frame_set_flag(struct frame *frame, enum frame_flag flag)
 {
-	if (flag & FRAME_FLAG_MAXIMIZED && !(frame->flags & FRAME_FLAG_MAXIMIZED))
+	if ((frame->flags & flag) == flag)
+		return;
+
+	if (flag & FRAME_GEOMETRY_FLAGS & ~frame->flags)
 		frame->geometry_dirty = 1;
 
 	frame->flags |= flag;
@@ -397,7 +446,10 @@ frame_set_flag(struct frame *frame, enum frame_flag flag)
 void
 frame_unset_flag(struct frame *frame, enum frame_flag flag)
 {
-	if (flag & FRAME_FLAG_MAXIMIZED && frame->flags & FRAME_FLAG_MAXIMIZED)
+	if (!(frame->flags & flag))
+		return;
+
+	if (flag & FRAME_GEOMETRY_FLAGS & frame->flags)
 		frame->geometry_dirty = 1;
 
 	frame->flags &= ~flag;
@@ -425,7 +477,7 @@ frame_resize_inside(struct frame *frame, int32_t width, int32_t height)
 	else
 		titlebar_height = t->width;
 
-	if (frame->flags & FRAME_FLAG_MAXIMIZED) {
+	if (frame->flags & (FRAME_FLAG_MAXIMIZED | FRAME_NO_SHADOW_FLAGS)) {
 		decoration_width = t->width * 2;
 		decoration_height = t->width + titlebar_height;
 	} else {
@@ -477,6 +529,20 @@ frame_refresh_geometry(struct frame *frame)
 
 		frame->opaque_margin = 0;
 		frame->shadow_margin = 0;
+	} else if (frame->flags & FRAME_NO_SHADOW_FLAGS) {
+		decoration_width = t->width * 2;
+		decoration_height = t->width + titlebar_height;
+
+		frame->interior.x = t->width;
+		frame->interior.y = titlebar_height;
+		frame->interior.width = frame->width - decoration_width;
+		frame->interior.height = frame->height - decoration_height;
+
+		if (frame->flags & FRAME_FLAG_COMPACT)
+			frame->opaque_margin = 0;
+		else
+			frame->opaque_margin = t->frame_radius;
+		frame->shadow_margin = 0;
 	} else {
 		decoration_width = (t->width + t->margin) * 2;
 		decoration_height = t->width + titlebar_height + t->margin * 2;
@@ -595,7 +661,26 @@ frame_resizable(struct frame *frame)
 void
 frame_status_clear(struct frame *frame, enum frame_status status)
 {
-	frame->status &= ~status;
+	/* Left untouched when clear, frame_repaint() may run once per tile */
+	if (frame->status & status)
+		frame->status &= ~status;
+}
+
+static uint32_t
+frame_theme_flags(struct frame *frame)
+{
+	uint32_t flags = 0;
+
+	if (frame->flags & FRAME_FLAG_MAXIMIZED)
+		flags |= THEME_FRAME_MAXIMIZED;
+
+	if (frame->flags & FRAME_FLAG_NO_SHADOW)
+		flags |= THEME_FRAME_NO_SHADOW;
+
+	if (frame->flags & FRAME_FLAG_COMPACT)
+		flags |= THEME_FRAME_COMPACT;
+
+	return flags;
 }
 
 static struct frame_button *
@@ -631,8 +716,7 @@ frame_pointer_motion(struct frame *frame, void *data, int x, int y)
 
 	location = theme_get_location(frame->theme, x, y,
 				      frame->width, frame->height,
-				      frame->flags & FRAME_FLAG_MAXIMIZED ?
-				      THEME_FRAME_MAXIMIZED : 0);
+				      frame_theme_flags(frame));
 	if (!pointer)
 		return location;
 
@@ -752,8 +836,7 @@ frame_pointer_button(struct frame *frame, void *data,
 
 	location = theme_get_location(frame->theme, pointer->x, pointer->y,
 				      frame->width, frame->height,
-				      frame->flags & FRAME_FLAG_MAXIMIZED ?
-				      THEME_FRAME_MAXIMIZED : 0);
+				      frame_theme_flags(frame));
 
 	if (state == FRAME_BUTTON_PRESSED) {
 		button = malloc(sizeof *button);
@@ -801,8 +884,7 @@ frame_touch_down(struct frame *frame, void *data, int32_t id, int x, int y)
 
 	location = theme_get_location(frame->theme, x, y,
 				      frame->width, frame->height,
-				      frame->flags & FRAME_FLAG_MAXIMIZED ?
-				      THEME_FRAME_MAXIMIZED : 0);
+				      frame_theme_flags(frame));
 
 	switch (location) {
 	case THEME_LOCATION_TITLEBAR:
@@ -842,12 +924,11 @@ void
 frame_repaint(struct frame *frame, cairo_t *cr)
 {
 	struct frame_button *button;
-	uint32_t flags = 0;
+	uint32_t flags;
 
 	frame_refresh_geometry(frame);
 
-	if (frame->flags & FRAME_FLAG_MAXIMIZED)
-		flags |= THEME_FRAME_MAXIMIZED;
+	flags = frame_theme_flags(frame);
 
 	if (frame->flags & FRAME_FLAG_ACTIVE)
 		flags |= THEME_FRAME_ACTIVE;
@@ -0,0 +1,93 @@
+/*
+ * Copyright © 2014 Manuel Bachmann
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Bounded lock-free queue of pointers between exactly one producer
+ * thread and one consumer thread. The size must be a power of two.
+ */
+
+#ifndef SPSC_H
+#define SPSC_H
+
+#include <stdlib.h>
+
+struct spsc_queue {
+	void **slots;
+	unsigned int mask;
+	unsigned int head;	/* next slot to pop, owned by the consumer */
+	unsigned int tail;	/* next slot to push, owned by the producer */
+};
+
+static inline int
+spsc_queue_init(struct spsc_queue *queue, unsigned int size)
+{
+	queue->slots = calloc(size, sizeof *queue->slots);
+	if (!queue->slots)
+		return -1;
+
+	queue->mask = size - 1;
+	queue->head = 0;
+	queue->tail = 0;
+
+	return 0;
+}
+
+static inline void
+spsc_queue_release(struct spsc_queue *queue)
+{
+	free(queue->slots);
+}
+
+/* Producer side; returns -1 when the queue is full */
+static inline int
+spsc_queue_push(struct spsc_queue *queue, void *item)
+{
+	unsigned int tail = queue->tail;
+	unsigned int head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+	if (tail - head > queue->mask)
+		return -1;
+
+	queue->slots[tail & queue->mask] = item;
+	__atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* Consumer side; returns NULL when the queue is empty */
+static inline void *
+spsc_queue_pop(struct spsc_queue *queue)
+{
+	unsigned int head = queue->head;
+	unsigned int tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+	void *item;
+
+	if (head == tail)
+		return NULL;
+
+	item = queue->slots[head & queue->mask];
+	__atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+
+	return item;
+}
+
+#endif
@@ -0,0 +1,212 @@
+/*
+ * Copyright © 2014 Manuel Bachmann
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "tile-pool.h"
+
+/* Rows painted alone by the caller before the workers start */
+#define TILE_WARMUP_ROWS 16
+
+/* Bands per thread, so that uneven bands still share out evenly */
+#define TILE_BANDS_PER_THREAD 4
+
+#define TILE_MAX_THREADS 64
+
+struct tile_pool {
+	int threads;
+	int worker_count;
+	pthread_t workers[TILE_MAX_THREADS];
+
+	pthread_mutex_t mutex;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned int generation;
+	int quit;
+
+	/* The current job */
+	tile_paint_func_t paint;
+	void *data;
+	int width;
+	int first_row, last_row;
+	int band_height;
+	int band_count;
+	int next_band;		/* atomic */
+	int busy;		/* workers still painting, under mutex */
+};
+
+static void
+tile_pool_paint_bands(struct tile_pool *pool)
+{
+	cairo_rectangle_int_t tile;
+	int band;
+
+	for (;;) {
+		band = __atomic_fetch_add(&pool->next_band, 1,
+					  __ATOMIC_RELAXED);
+		if (band >= pool->band_count)
+			return;
+
+		tile.x = 0;
+		tile.y = pool->first_row + band * pool->band_height;
+		tile.width = pool->width;
+		tile.height = pool->band_height;
+		if (tile.y + tile.height > pool->last_row)
+			tile.height = pool->last_row - tile.y;
+
+		pool->paint(&tile, pool->data);
+	}
+}
+
+static void *
+tile_pool_worker(void *data)
+{
+	struct tile_pool *pool = data;
+	unsigned int generation = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (;;) {
+		while (!pool->quit && pool->generation == generation)
+			pthread_cond_wait(&pool->start, &pool->mutex);
+		if (pool->quit)
+			break;
+		generation = pool->generation;
+		pthread_mutex_unlock(&pool->mutex);
+
+		tile_pool_paint_bands(pool);
+
+		pthread_mutex_lock(&pool->mutex);
+		if (--pool->busy == 0)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+struct tile_pool *
+tile_pool_create(int threads)
+{
+	struct tile_pool *pool;
+	int i;
+
+	if (threads > TILE_MAX_THREADS)
+		threads = TILE_MAX_THREADS;
+	if (threads < 1)
+		threads = 1;
+
+	pool = calloc(1, sizeof *pool);
+	if (!pool)
+		return NULL;
+
+	pool->threads = threads;
+	pthread_mutex_init(&pool->mutex, NULL);
+	pthread_cond_init(&pool->start, NULL);
+	pthread_cond_init(&pool->done, NULL);
+
+	for (i = 0; i < threads - 1; i++) {
+		if (pthread_create(&pool->workers[i], NULL,
+				   tile_pool_worker, pool) != 0)
+			break;
+		pool->worker_count++;
+	}
+
+	/* Fewer workers than asked for still make a working pool */
+	pool->threads = pool->worker_count + 1;
+
+	return pool;
+}
+
+void
+tile_pool_destroy(struct tile_pool *pool)
+{
+	int i;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->quit = 1;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < pool->worker_count; i++)
+		pthread_join(pool->workers[i], NULL);
+
+	pthread_cond_destroy(&pool->done);
+	pthread_cond_destroy(&pool->start);
+	pthread_mutex_destroy(&pool->mutex);
+	free(pool);
+}
+
+int
+tile_pool_get_threads(struct tile_pool *pool)
+{
+	return pool->threads;
+}
+
+void
+tile_pool_run(struct tile_pool *pool, int width, int height,
+	      tile_paint_func_t paint, void *data)
+{
+	cairo_rectangle_int_t tile;
+	int rows, bands;
+
+	tile.x = 0;
+	tile.y = 0;
+	tile.width = width;
+	tile.height = height;
+
+	if (pool->threads == 1 || height <= TILE_WARMUP_ROWS) {
+		paint(&tile, data);
+		return;
+	}
+
+	tile.height = TILE_WARMUP_ROWS;
+	paint(&tile, data);
+
+	rows = height - TILE_WARMUP_ROWS;
+	bands = pool->threads * TILE_BANDS_PER_THREAD;
+	if (bands > rows)
+		bands = rows;
+
+	pool->paint = paint;
+	pool->data = data;
+	pool->width = width;
+	pool->first_row = TILE_WARMUP_ROWS;
+	pool->last_row = height;
+	pool->band_height = (rows + bands - 1) / bands;
+	pool->band_count = (rows + pool->band_height - 1) / pool->band_height;
+	pool->next_band = 0;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->busy = pool->worker_count;
+	pool->generation++;
+	pthread_cond_broadcast(&pool->start);
+	pthread_mutex_unlock(&pool->mutex);
+
+	tile_pool_paint_bands(pool);
+
+	/* Join: every band is in the buffer before the caller moves on */
+	pthread_mutex_lock(&pool->mutex);
+	while (pool->busy > 0)
+		pthread_cond_wait(&pool->done, &pool->mutex);
+	pthread_mutex_unlock(&pool->mutex);
+}
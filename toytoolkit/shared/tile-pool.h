@@ -0,0 +1,59 @@
+/*
+ * Copyright © 2014 Manuel Bachmann
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Pool of worker threads painting horizontal bands of one buffer in
+ * parallel. The painter is called once per band with the band in
+ * buffer pixels, and is expected to clip its drawing to it.
+ */
+
+#ifndef TILE_POOL_H
+#define TILE_POOL_H
+
+#include <cairo.h>
+
+struct tile_pool;
+
+typedef void (*tile_paint_func_t)(const cairo_rectangle_int_t *tile,
+				  void *data);
+
+/* threads counts the caller, which paints bands too */
+struct tile_pool *
+tile_pool_create(int threads);
+
+void
+tile_pool_destroy(struct tile_pool *pool);
+
+int
+tile_pool_get_threads(struct tile_pool *pool);
+
+/*
+ * Paint a width x height buffer, returning once every band is done.
+ * A thin first band is painted by the caller alone before the others
+ * start, so lazily computed state is settled by the time the painter
+ * runs concurrently; after that it must only read shared state.
+ */
+void
+tile_pool_run(struct tile_pool *pool, int width, int height,
+	      tile_paint_func_t paint, void *data);
+
+#endif
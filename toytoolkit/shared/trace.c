@@ -0,0 +1,166 @@
+/*
+ * Copyright © 2014 Manuel Bachmann
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "trace.h"
+
+#define TRACE_RING_SIZE 4096	/* power of two */
+
+/*
+ * The render and tile threads record events too: writers claim a slot
+ * with an atomic increment of head, and seq, which is the slot's index
+ * plus one once written, lets the dump skip slots being rewritten.
+ */
+struct trace_event {
+	uint64_t ts;		/* ns, CLOCK_MONOTONIC */
+	uint32_t dur;		/* ns, 0 for instant events */
+	uint16_t type;
+	uint16_t instant;
+	uint32_t arg;
+	uint32_t tid;
+	uint32_t seq;		/* atomic */
+};
+
+static struct {
+	uint32_t head;		/* atomic */
+	struct trace_event events[TRACE_RING_SIZE];
+} ring;
+
+static __thread uint32_t trace_tid;
+
+static const char * const trace_names[] = {
+	[TRACE_TASK_DEFERRED] = "deferred task",
+	[TRACE_TASK_FD] = "fd task",
+	[TRACE_DISPATCH] = "dispatch",
+	[TRACE_REDRAW] = "redraw",
+	[TRACE_RESIZE] = "resize",
+	[TRACE_BUFFER_ATTACH] = "buffer attach",
+	[TRACE_BUFFER_RELEASE] = "buffer release",
+};
+
+uint64_t
+trace_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+trace_record(enum trace_type type, uint64_t ts, uint64_t dur,
+	     int instant, uint32_t arg)
+{
+	struct trace_event *event;
+	uint32_t index;
+
+	if (!trace_tid)
+		trace_tid = syscall(SYS_gettid);
+
+	index = __atomic_fetch_add(&ring.head, 1, __ATOMIC_RELAXED);
+	event = &ring.events[index & (TRACE_RING_SIZE - 1)];
+
+	__atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	event->ts = ts;
+	event->dur = dur > UINT32_MAX ? UINT32_MAX : dur;
+	event->type = type;
+	event->instant = instant;
+	event->arg = arg;
+	event->tid = trace_tid;
+
+	__atomic_store_n(&event->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+void
+trace_complete(enum trace_type type, uint64_t start, uint32_t arg)
+{
+	trace_record(type, start, trace_now() - start, 0, arg);
+}
+
+void
+trace_instant(enum trace_type type, uint32_t arg)
+{
+	trace_record(type, trace_now(), 0, 1, arg);
+}
+
+void
+trace_dump_json(FILE *fp)
+{
+	struct trace_event *slot, event;
+	uint32_t i, head, first, count, seq, written = 0;
+	int pid = getpid();
+
+	head = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE);
+	count = head < TRACE_RING_SIZE ? head : TRACE_RING_SIZE;
+	first = head - count;
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+	for (i = 0; i < count; i++) {
+		slot = &ring.events[(first + i) & (TRACE_RING_SIZE - 1)];
+
+		/* Skip the slots another thread is writing or has reused */
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		event = *slot;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (seq != first + i + 1 ||
+		    __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+
+		fprintf(fp, "%s\n{\"name\":\"%s\",\"cat\":\"toytoolkit\","
+			"\"pid\":%d,\"tid\":%u,\"ts\":%.3f,",
+			written++ ? "," : "", trace_names[event.type],
+			pid, event.tid, event.ts / 1000.0);
+
+		if (event.instant)
+			fprintf(fp, "\"ph\":\"i\",\"s\":\"t\",");
+		else
+			fprintf(fp, "\"ph\":\"X\",\"dur\":%.3f,",
+				event.dur / 1000.0);
+
+		fprintf(fp, "\"args\":{\"arg\":%u}}", event.arg);
+	}
+
+	fprintf(fp, "\n]}\n");
+}
+
+int
+trace_dump_file(const char *path)
+{
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (!fp)
+		return -1;
+
+	trace_dump_json(fp);
+
+	return fclose(fp);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright © 2014 Manuel Bachmann
+ *
+ * Permission to use, copy, modify, distribute, and sell this software and its
+ * documentation for any purpose is hereby granted without fee, provided that
+ * the above copyright notice appear in all copies and that both that copyright
+ * notice and this permission notice appear in supporting documentation, and
+ * that the name of the copyright holders not be used in advertising or
+ * publicity pertaining to distribution of the software without specific,
+ * written prior permission.  The copyright holders make no representations
+ * about the suitability of this software for any purpose.  It is provided "as
+ * is" without express or implied warranty.
+ *
+ * THE COPYRIGHT HOLDERS DISCLAIM ALL WARRANTIES WITH REGARD TO THIS SOFTWARE,
+ * INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS, IN NO
+ * EVENT SHALL THE COPYRIGHT HOLDERS BE LIABLE FOR ANY SPECIAL, INDIRECT OR
+ * CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM LOSS OF USE,
+ * DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR OTHER
+ * TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR PERFORMANCE
+ * OF THIS SOFTWARE.
+ */
+
+/*
+ * Fixed-size ring of timestamped toolkit events, cheap enough to be
+ * always on, which can be dumped in the Chrome trace event format
+ * (chrome://tracing, ui.perfetto.dev). Events can be recorded from
+ * any thread, each showing on a track of its own.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+enum trace_type {
+	TRACE_TASK_DEFERRED,
+	TRACE_TASK_FD,
+	TRACE_DISPATCH,
+	TRACE_REDRAW,
+	TRACE_RESIZE,
+	TRACE_BUFFER_ATTACH,
+	TRACE_BUFFER_RELEASE,
+	TRACE_TYPE_COUNT
+};
+
+uint64_t
+trace_now(void);
+
+/* Record an event of type which lasted from start until now */
+void
+trace_complete(enum trace_type type, uint64_t start, uint32_t arg);
+
+/* Record an event without duration */
+void
+trace_instant(enum trace_type type, uint32_t arg);
+
+void
+trace_dump_json(FILE *fp);
+
+int
+trace_dump_file(const char *path);
+
+#endif
@@ -35,8 +35,15 @@
 #include <cairo.h>
 #include <sys/time.h>
 #include <sys/mman.h>
+#include <sys/resource.h>
 #include <sys/epoll.h>
 #include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sched.h>
+#include <pthread.h>
 
 #ifdef HAVE_CAIRO_EGL
 #include <wayland-egl.h>
@@ -67,7 +74,12 @@ typedef void *EGLContext;
 #include "xdg-shell-client-protocol.h"
 #include "text-cursor-position-client-protocol.h"
 #include "workspaces-client-protocol.h"
+#include "server-decoration-client-protocol.h"
+#include "presentation-time-client-protocol.h"
 #include "./shared/os-compatibility.h"
+#include "./shared/trace.h"
+#include "./shared/spsc.h"
+#include "./shared/tile-pool.h"
 
 #include "window.h"
 
@@ -80,8 +92,73 @@ struct global {
 	struct wl_list link;
 };
 
+/*
+ * Always-on counters, printed on SIGUSR1 when signals are watched (see
+ * display_watch_signals()). Those marked current are levels rather
+ * than running totals.
+ */
+struct counters {
+	uint64_t frames_rendered;
+	uint64_t frames_throttled;
+	uint64_t bytes_damaged;
+	uint64_t bytes_attached;
+	uint64_t shm_pools_created;
+	uint64_t shm_bytes_mapped;	/* current */
+	uint64_t buffers_held;		/* current */
+	uint64_t redraw_allocs;
+	uint64_t loop_wakeups;
+};
+
+/*
+ * Allocations made by the calling thread through the x*alloc()
+ * helpers, which the toolkit uses for its own objects; cairo, pixman,
+ * libwayland and plain malloc() calls are not seen. A redraw counts
+ * those of the main and render threads, not the tile workers'.
+ */
+static __thread uint64_t alloc_count;
+
+/*
+ * Protocol traffic per redraw cycle, grouped by interface. Only the
+ * requests sent from the redraw path are counted; events are those
+ * received since the previous cycle.
+ */
+enum traffic_class {
+	TRAFFIC_WL_COMPOSITOR,
+	TRAFFIC_WL_SHM_POOL,
+	TRAFFIC_WL_SURFACE,
+	TRAFFIC_WL_REGION,
+	TRAFFIC_WL_BUFFER,
+	TRAFFIC_WL_CALLBACK,
+	TRAFFIC_XDG_SURFACE,
+	TRAFFIC_CLASS_COUNT
+};
+
+struct protocol_traffic {
+	uint32_t requests[TRAFFIC_CLASS_COUNT];
+	uint32_t events[TRAFFIC_CLASS_COUNT];
+	uint64_t bytes[TRAFFIC_CLASS_COUNT];
+};
+
+#define LATENCY_BUCKETS 24
+
+/* Bucket i counts latencies in [2^i, 2^(i+1)) microseconds */
+struct latency_histogram {
+	uint32_t count;
+	uint64_t total_us;
+	uint64_t max_us;
+	uint32_t buckets[LATENCY_BUCKETS];
+};
+
 struct display {
 	struct wl_display *display;
+	int own_connection;
+	/*
+	 * The toolkit's objects are created from a wrapper of the
+	 * connection on a queue of their own, so that the default queue
+	 * is left to the application when the connection is shared.
+	 */
+	struct wl_display *display_wrapper;
+	struct wl_event_queue *queue;
 	struct wl_registry *registry;
 	struct wl_compositor *compositor;
 	struct wl_subcompositor *subcompositor;
@@ -91,6 +168,7 @@ struct display {
 	struct text_cursor_position *text_cursor_position;
 	struct workspace_manager *workspace_manager;
 	struct xdg_shell *xdg_shell;
+	struct org_kde_kwin_server_decoration_manager *server_decoration_manager;
 	EGLDisplay dpy;
 	EGLConfig argb_config;
 	EGLContext argb_ctx;
@@ -101,11 +179,35 @@ struct display {
 	uint32_t display_fd_events;
 	struct task display_task;
 
+	/* Extra queues dispatched on the main thread, see
+	 * display_watch_queue() */
+	struct wl_array queues;
+
+	/* Painting off the main thread, see TOYTOOLKIT_RENDER_THREAD */
+	struct render_thread *render_thread;
+	struct tile_pool *tile_pool;
+	int tile_pool_disabled;
+
+	/* Seat events, dispatched by input_task */
+	struct wl_event_queue *input_queue;
+	struct task input_task;
+	int input_task_scheduled;
+
 	int epoll_fd;
-	struct wl_list deferred_list;
+	struct wl_list deferred_list[TASK_PRIORITY_COUNT];
 
+	/* Exit display_run() after this many milliseconds, if not 0 */
 	int timeout;
-	struct timeval time;
+	struct toytimer timeout_timer;
+
+	/* Armed toytimers, a min-heap on their expiry time */
+	int timer_fd;
+	struct task timer_task;
+	struct toytimer **timers;
+	int timer_count, timer_size;
+	uint64_t timer_programmed;
+	int timers_dispatching;
+	struct wl_list expired_timers;
 
 	int running;
 
@@ -136,6 +238,47 @@ struct display {
 
 	int has_rgb565;
 	int seat_version;
+
+	/* Prefault new shm pools, see TOYTOOLKIT_SHM_PREFAULT */
+	int shm_prefault;
+
+	/* Statistics reported on exit, see TOYTOOLKIT_STATS */
+	int stats_enabled;
+	uint32_t stats_redraws;
+	long stats_redraw_minflt;
+	size_t stats_shm_peak;
+	uint32_t stats_shm_extra_leaves;
+	uint64_t stats_shm_attached_pixels;
+
+	/* Presentation feedback, requested only when stats are enabled */
+	struct wp_presentation *presentation;
+	struct wl_event_queue *presentation_queue;
+	clockid_t presentation_clock;
+	struct wl_list presentation_list;
+	struct timespec pending_input;
+	struct latency_histogram input_latency;
+	struct latency_histogram commit_latency;
+	uint32_t stats_discarded;
+
+	/* Protocol traffic, see TOYTOOLKIT_STATS=protocol */
+	int stats_protocol;
+	struct protocol_traffic traffic_cycle;
+	struct protocol_traffic traffic_total;
+	uint32_t traffic_max_requests[TRAFFIC_CLASS_COUNT];
+
+	struct counters counters;
+
+	/* Input recording and replay, see TOYTOOLKIT_INPUT_RECORD */
+	FILE *input_record;
+	uint64_t input_record_start;
+	struct input_replay *input_replay;
+
+	/* SIGUSR1/SIGUSR2 handling, see display_watch_signals() */
+	int signal_fd;
+	sigset_t signal_saved_mask;
+	struct task signal_task;
+	struct task trace_dump_task;
+	int trace_dump_pending;
 };
 
 struct window_output {
@@ -209,6 +352,7 @@ struct surface {
 	int32_t buffer_scale;
 
 	cairo_surface_t *cairo_surface;
+	cairo_surface_t *recording;	/* replayed by the render thread */
 
 	struct wl_list link;
 };
@@ -224,6 +368,27 @@ struct window {
 	int redraw_needed;
 	int redraw_task_scheduled;
 	struct task redraw_task;
+	int redraw_after_render;
+
+	/* Surfaces painted by the current redraw */
+	struct surface **paint_surfaces;
+	int paint_count, paint_size;
+	int paint_inline;
+	int render_resized;
+	int render_in_flight;
+
+	/*
+	 * Window state the redraw handlers read, latched on the main
+	 * thread by window_redraw(), as the tile workers run them
+	 * concurrently.
+	 */
+	int paint_frame_drawn;
+
+	/* Redraw accounting, finished once the paint is done */
+	uint64_t redraw_start;
+	uint64_t redraw_allocs;
+	uint64_t render_allocs;		/* written by the render thread */
+	long redraw_minflt_start;
 	int resize_needed;
 	int custom;
 	int focused;
@@ -232,6 +397,10 @@ struct window {
 
 	int fullscreen;
 	int maximized;
+	int no_shadow;
+	int compact_frame;
+	int server_decorated;
+	int low_memory;
 
 	enum preferred_format preferred_format;
 
@@ -246,6 +415,7 @@ struct window {
 	struct surface *main_surface;
 	struct wl_shell_surface *shell_surface;
 	struct xdg_surface *xdg_surface;
+	struct org_kde_kwin_server_decoration *server_decoration;
 	struct xdg_popup *xdg_popup;
 
 	struct window *transient_for;
@@ -337,8 +507,7 @@ struct input {
 		xkb_mod_mask_t shift_mask;
 	} xkb;
 
-	struct task repeat_task;
-	int repeat_timer_fd;
+	struct toytimer repeat_timer;
 	uint32_t repeat_sym;
 	uint32_t repeat_key;
 	uint32_t repeat_time;
@@ -383,12 +552,12 @@ struct tooltip {
 	struct widget *parent;
 	struct widget *widget;
 	char *entry;
-	struct task tooltip_task;
-	int tooltip_fd;
+	struct toytimer timer;
 	float x, y;
 };
 
 struct shm_pool {
+	struct display *display;
 	struct wl_shm_pool *pool;
 	size_t size;
 	size_t used;
@@ -445,6 +614,151 @@ debug_print(void *proxy, int line, const char *func, const char *fmt, ...)
 
 #endif
 
+#define STARTUP_PHASES_MAX 16
+
+struct startup_phase {
+	const char *name;
+	struct timespec end;
+	long rss_kb;
+	long minflt;
+};
+
+/*
+ * Startup timeline, see startup_trace_enable(). This is process-wide
+ * rather than per display, as it starts before the display exists.
+ */
+static struct {
+	int enabled;
+	int json;
+	int done;
+	struct timespec start;
+	long start_minflt;
+	int count;
+	struct startup_phase phases[STARTUP_PHASES_MAX];
+} startup_trace;
+
+static long
+startup_trace_rss_kb(void)
+{
+	FILE *fp;
+	long size, resident = 0;
+
+	fp = fopen("/proc/self/statm", "r");
+	if (!fp)
+		return 0;
+
+	if (fscanf(fp, "%ld %ld", &size, &resident) != 2)
+		resident = 0;
+	fclose(fp);
+
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static long
+startup_trace_minflt(void)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	return usage.ru_minflt;
+}
+
+static double
+timespec_sub_to_ms(const struct timespec *a, const struct timespec *b)
+{
+	return (a->tv_sec - b->tv_sec) * 1000.0 +
+		(a->tv_nsec - b->tv_nsec) / 1000000.0;
+}
+
+void
+startup_trace_enable(int json)
+{
+	if (startup_trace.enabled) {
+		startup_trace.json |= json;
+		return;
+	}
+
+	startup_trace.enabled = 1;
+	startup_trace.json = json;
+	clock_gettime(CLOCK_MONOTONIC, &startup_trace.start);
+	startup_trace.start_minflt = startup_trace_minflt();
+}
+
+static void
+startup_trace_print(FILE *fp)
+{
+	struct startup_phase *phase;
+	const struct timespec *begin = &startup_trace.start;
+	long minflt = startup_trace.start_minflt;
+	int i;
+
+	if (startup_trace.json)
+		fprintf(fp, "{\"startup\":[");
+	else
+		fprintf(fp, "%-24s %10s %10s %8s %8s\n",
+			"phase", "end ms", "phase ms", "rss kB", "minflt");
+
+	for (i = 0; i < startup_trace.count; i++) {
+		phase = &startup_trace.phases[i];
+
+		if (startup_trace.json)
+			fprintf(fp, "%s{\"phase\":\"%s\",\"end_ms\":%.3f,"
+				"\"duration_ms\":%.3f,\"rss_kb\":%ld,"
+				"\"minflt\":%ld}",
+				i ? "," : "", phase->name,
+				timespec_sub_to_ms(&phase->end,
+						   &startup_trace.start),
+				timespec_sub_to_ms(&phase->end, begin),
+				phase->rss_kb, phase->minflt - minflt);
+		else
+			fprintf(fp, "%-24s %10.3f %10.3f %8ld %8ld\n",
+				phase->name,
+				timespec_sub_to_ms(&phase->end,
+						   &startup_trace.start),
+				timespec_sub_to_ms(&phase->end, begin),
+				phase->rss_kb, phase->minflt - minflt);
+
+		begin = &phase->end;
+		minflt = phase->minflt;
+	}
+
+	if (startup_trace.json)
+		fprintf(fp, "]}\n");
+}
+
+/*
+ * Record the end of a startup phase, which began where the previous one
+ * ended. Each phase is only recorded the first time; the timeline is
+ * printed once the first frame callback arrives.
+ */
+void
+startup_trace_phase(const char *name)
+{
+	struct startup_phase *phase;
+	int i;
+
+	if (!startup_trace.enabled || startup_trace.done)
+		return;
+
+	for (i = 0; i < startup_trace.count; i++)
+		if (strcmp(startup_trace.phases[i].name, name) == 0)
+			return;
+
+	if (startup_trace.count < STARTUP_PHASES_MAX) {
+		phase = &startup_trace.phases[startup_trace.count++];
+		phase->name = name;
+		clock_gettime(CLOCK_MONOTONIC, &phase->end);
+		phase->rss_kb = startup_trace_rss_kb();
+		phase->minflt = startup_trace_minflt();
+	}
+
+	if (strcmp(name, "first_frame_callback") == 0) {
+		startup_trace.done = 1;
+		startup_trace_print(stderr);
+	}
+}
+
 static void
 surface_to_buffer_size (enum wl_output_transform buffer_transform, int32_t buffer_scale, int32_t *width, int32_t *height)
 {
@@ -650,7 +964,107 @@ egl_window_surface_create(struct display *display,
 
 #endif
 
+static const struct wl_interface *traffic_interfaces[] = {
+	[TRAFFIC_WL_COMPOSITOR] = &wl_compositor_interface,
+	[TRAFFIC_WL_SHM_POOL] = &wl_shm_pool_interface,
+	[TRAFFIC_WL_SURFACE] = &wl_surface_interface,
+	[TRAFFIC_WL_REGION] = &wl_region_interface,
+	[TRAFFIC_WL_BUFFER] = &wl_buffer_interface,
+	[TRAFFIC_WL_CALLBACK] = &wl_callback_interface,
+	[TRAFFIC_XDG_SURFACE] = &xdg_surface_interface,
+};
+
+static int
+traffic_class(const struct wl_interface *interface)
+{
+	int i;
+
+	for (i = 0; i < TRAFFIC_CLASS_COUNT; i++)
+		if (traffic_interfaces[i] == interface)
+			return i;
+
+	assert(0 && "untracked interface");
+	return 0;
+}
+
+/*
+ * Wire size of a request: the 8 byte header plus one 32 bit word per
+ * argument. File descriptors travel out of band, and string and array
+ * contents are not included.
+ */
+static uint32_t
+request_size(const struct wl_interface *interface, uint32_t opcode)
+{
+	const char *sig = interface->methods[opcode].signature;
+	uint32_t size = 8;
+
+	for (; *sig; sig++) {
+		if (strchr("iufosna", *sig))
+			size += 4;
+	}
+
+	return size;
+}
+
+static void
+display_count_request(struct display *display,
+		      const struct wl_interface *interface, uint32_t opcode)
+{
+	int class;
+
+	if (!display->stats_enabled)
+		return;
+
+	class = traffic_class(interface);
+	display->traffic_cycle.requests[class]++;
+	display->traffic_cycle.bytes[class] +=
+		request_size(interface, opcode);
+}
+
+static void
+display_count_event(struct display *display,
+		    const struct wl_interface *interface)
+{
+	if (!display->stats_enabled)
+		return;
+
+	display->traffic_cycle.events[traffic_class(interface)]++;
+}
+
+static void
+display_end_traffic_cycle(struct display *display)
+{
+	struct protocol_traffic *cycle = &display->traffic_cycle;
+	struct protocol_traffic *total = &display->traffic_total;
+	int i;
+
+	if (display->stats_protocol)
+		fprintf(stderr, "toytoolkit protocol: redraw %u",
+			display->stats_redraws);
+
+	for (i = 0; i < TRAFFIC_CLASS_COUNT; i++) {
+		total->requests[i] += cycle->requests[i];
+		total->events[i] += cycle->events[i];
+		total->bytes[i] += cycle->bytes[i];
+		if (cycle->requests[i] > display->traffic_max_requests[i])
+			display->traffic_max_requests[i] = cycle->requests[i];
+
+		if (display->stats_protocol &&
+		    (cycle->requests[i] || cycle->events[i]))
+			fprintf(stderr, " %s=%u/%u/%llu",
+				traffic_interfaces[i]->name,
+				cycle->requests[i], cycle->events[i],
+				(unsigned long long) cycle->bytes[i]);
+	}
+
+	if (display->stats_protocol)
+		fprintf(stderr, "\n");
+
+	memset(cycle, 0, sizeof *cycle);
+}
+
 struct shm_surface_data {
+	struct display *display;
 	struct wl_buffer *buffer;
 	struct shm_pool *pool;
 };
@@ -674,6 +1088,8 @@ shm_surface_data_destroy(void *p)
 {
 	struct shm_surface_data *data = p;
 
+	display_count_request(data->display, &wl_buffer_interface,
+			      WL_BUFFER_DESTROY);
 	wl_buffer_destroy(data->buffer);
 	if (data->pool)
 		shm_pool_destroy(data->pool);
@@ -681,6 +1097,37 @@ shm_surface_data_destroy(void *p)
 	free(data);
 }
 
+/*
+ * Map a fresh pool. When prefaulting is enabled, the page tables are
+ * populated up front, so that the first paint into the buffer does not
+ * take a page fault for every page of it.
+ */
+static void *
+shm_pool_map(struct display *display, int fd, int size)
+{
+	int flags = MAP_SHARED;
+	void *data;
+
+#ifndef MADV_POPULATE_WRITE
+	if (display->shm_prefault)
+		flags |= MAP_POPULATE;
+#endif
+
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+
+#ifdef MADV_POPULATE_WRITE
+	if (data != MAP_FAILED && display->shm_prefault &&
+	    madvise(data, size, MADV_POPULATE_WRITE) < 0) {
+		/* Kernel older than 5.14, settle for a read-populate */
+		munmap(data, size);
+		data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			    flags | MAP_POPULATE, fd, 0);
+	}
+#endif
+
+	return data;
+}
+
 static struct wl_shm_pool *
 make_shm_pool(struct display *display, int size, void **data)
 {
@@ -694,7 +1141,7 @@ make_shm_pool(struct display *display, int size, void **data)
 		return NULL;
 	}
 
-	*data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	*data = shm_pool_map(display, fd, size);
 	if (*data == MAP_FAILED) {
 		fprintf(stderr, "mmap failed: %m\n");
 		close(fd);
@@ -722,9 +1169,15 @@ shm_pool_create(struct display *display, size_t size)
 		return NULL;
 	}
 
+	pool->display = display;
 	pool->size = size;
 	pool->used = 0;
 
+	display->counters.shm_pools_created++;
+	display->counters.shm_bytes_mapped += size;
+	if (display->counters.shm_bytes_mapped > display->stats_shm_peak)
+		display->stats_shm_peak = display->counters.shm_bytes_mapped;
+
 	return pool;
 }
 
@@ -744,6 +1197,8 @@ shm_pool_allocate(struct shm_pool *pool, size_t size, int *offset)
 static void
 shm_pool_destroy(struct shm_pool *pool)
 {
+	pool->display->counters.shm_bytes_mapped -= pool->size;
+
 	munmap(pool->data, pool->size);
 	wl_shm_pool_destroy(pool->pool);
 	free(pool);
@@ -756,13 +1211,24 @@ shm_pool_reset(struct shm_pool *pool)
 	pool->used = 0;
 }
 
+static cairo_format_t
+cairo_format_for_shm_surface(struct display *display, uint32_t flags)
+{
+	if (flags & SURFACE_HINT_RGB565 && display->has_rgb565)
+		return CAIRO_FORMAT_RGB16_565;
+	else
+		return CAIRO_FORMAT_ARGB32;
+}
+
 static int
-data_length_for_shm_surface(struct rectangle *rect)
+data_length_for_shm_surface(struct display *display,
+			    struct rectangle *rect, uint32_t flags)
 {
 	int stride;
 
-	stride = cairo_format_stride_for_width (CAIRO_FORMAT_ARGB32,
-						rect->width);
+	stride = cairo_format_stride_for_width (
+			cairo_format_for_shm_surface(display, flags),
+			rect->width);
 	return stride * rect->height;
 }
 
@@ -782,10 +1248,7 @@ display_create_shm_surface_from_pool(struct display *display,
 	if (data == NULL)
 		return NULL;
 
-	if (flags & SURFACE_HINT_RGB565 && display->has_rgb565)
-		cairo_format = CAIRO_FORMAT_RGB16_565;
-	else
-		cairo_format = CAIRO_FORMAT_ARGB32;
+	cairo_format = cairo_format_for_shm_surface(display, flags);
 
 	stride = cairo_format_stride_for_width (cairo_format, rectangle->width);
 	length = stride * rectangle->height;
@@ -815,6 +1278,9 @@ display_create_shm_surface_from_pool(struct display *display,
 			format = WL_SHM_FORMAT_ARGB8888;
 	}
 
+	data->display = display;
+	display_count_request(display, &wl_shm_pool_interface,
+			      WL_SHM_POOL_CREATE_BUFFER);
 	data->buffer = wl_shm_pool_create_buffer(pool->pool, offset,
 						 rectangle->width,
 						 rectangle->height,
@@ -847,7 +1313,8 @@ display_create_shm_surface(struct display *display,
 	}
 
 	pool = shm_pool_create(display,
-			       data_length_for_shm_surface(rectangle));
+			       data_length_for_shm_surface(display, rectangle,
+							   flags));
 	if (!pool)
 		return NULL;
 
@@ -965,7 +1432,7 @@ static void
 shm_surface_buffer_release(void *data, struct wl_buffer *buffer)
 {
 	struct shm_surface *surface = data;
-	struct shm_surface_leaf *leaf;
+	struct shm_surface_leaf *leaf, *released;
 	int i;
 	int free_found;
 
@@ -979,15 +1446,30 @@ shm_surface_buffer_release(void *data, struct wl_buffer *buffer)
 		}
 	}
 	assert(i < MAX_LEAVES && "unknown buffer released");
-
-	/* Leave one free leaf with storage, release others */
+	released = leaf;
+	surface->display->counters.buffers_held--;
+	display_count_event(surface->display, &wl_buffer_interface);
+	trace_instant(TRACE_BUFFER_RELEASE, i);
+
+	/* Leave one free leaf with storage, release others. With
+	 * SURFACE_HINT_LOW_MEMORY the one kept is always the leaf just
+	 * released, so that a compositor releasing buffers promptly
+	 * keeps us down to a single leaf.
+	 */
 	free_found = 0;
+	if (surface->flags & SURFACE_HINT_LOW_MEMORY)
+		free_found = 1;
+
 	for (i = 0; i < MAX_LEAVES; i++) {
 		leaf = &surface->leaf[i];
 
 		if (!leaf->cairo_surface || leaf->busy)
 			continue;
 
+		if (surface->flags & SURFACE_HINT_LOW_MEMORY &&
+		    leaf == released)
+			continue;
+
 		if (!free_found)
 			free_found = 1;
 		else
@@ -1047,11 +1529,20 @@ shm_surface_prepare(struct toysurface *base, int dx, int dy,
 	    cairo_image_surface_get_height(leaf->cairo_surface) == height)
 		goto out;
 
-	if (leaf->cairo_surface)
+	if (leaf->cairo_surface) {
 		cairo_surface_destroy(leaf->cairo_surface);
+	} else {
+		/* The server still holds a buffer, so we grow another */
+		for (i = 0; i < MAX_LEAVES; i++)
+			if (surface->leaf[i].busy)
+				break;
+		if (i < MAX_LEAVES)
+			surface->display->stats_shm_extra_leaves++;
+	}
 
 #ifdef USE_RESIZE_POOL
-	if (resize_hint && !leaf->resize_pool) {
+	if (resize_hint && !leaf->resize_pool &&
+	    !(surface->flags & SURFACE_HINT_LOW_MEMORY)) {
 		/* Create a big pool to allocate from, while continuously
 		 * resizing. Mmapping a new pool in the server
 		 * is relatively expensive, so reusing a pool performs
@@ -1090,6 +1581,8 @@ shm_surface_swap(struct toysurface *base,
 {
 	struct shm_surface *surface = to_shm_surface(base);
 	struct shm_surface_leaf *leaf = surface->current;
+	struct counters *counters = &surface->display->counters;
+	int stride, width, height, bpp;
 
 	server_allocation->width =
 		cairo_image_surface_get_width(leaf->cairo_surface);
@@ -1105,9 +1598,30 @@ shm_surface_swap(struct toysurface *base,
 	wl_surface_damage(surface->surface, 0, 0,
 			  server_allocation->width, server_allocation->height);
 	wl_surface_commit(surface->surface);
+	display_count_request(surface->display, &wl_surface_interface,
+			      WL_SURFACE_ATTACH);
+	display_count_request(surface->display, &wl_surface_interface,
+			      WL_SURFACE_DAMAGE);
+	display_count_request(surface->display, &wl_surface_interface,
+			      WL_SURFACE_COMMIT);
+
+	surface->display->stats_shm_attached_pixels +=
+		cairo_image_surface_get_width(leaf->cairo_surface) *
+		cairo_image_surface_get_height(leaf->cairo_surface);
+
+	stride = cairo_image_surface_get_stride(leaf->cairo_surface);
+	width = cairo_image_surface_get_width(leaf->cairo_surface);
+	height = cairo_image_surface_get_height(leaf->cairo_surface);
+	bpp = cairo_image_surface_get_format(leaf->cairo_surface) ==
+		CAIRO_FORMAT_RGB16_565 ? 2 : 4;
+	counters->bytes_attached += stride * height;
+	/* The whole buffer is damaged, without the stride padding */
+	counters->bytes_damaged += (uint64_t) width * height * bpp;
+	counters->buffers_held++;
 
 	DBG_OBJ(surface->surface, "leaf %d busy\n",
 		(int)(leaf - &surface->leaf[0]));
+	trace_instant(TRACE_BUFFER_ATTACH, leaf - &surface->leaf[0]);
 
 	leaf->busy = 1;
 	surface->current = NULL;
@@ -1130,8 +1644,11 @@ shm_surface_destroy(struct toysurface *base)
 	struct shm_surface *surface = to_shm_surface(base);
 	int i;
 
-	for (i = 0; i < MAX_LEAVES; i++)
+	for (i = 0; i < MAX_LEAVES; i++) {
+		if (surface->leaf[i].busy)
+			surface->display->counters.buffers_held--;
 		shm_surface_leaf_release(&surface->leaf[i]);
+	}
 
 	free(surface);
 }
@@ -1312,9 +1829,17 @@ display_get_pointer_image(struct display *display, int pointer)
 	return cursor ? cursor->images[0] : NULL;
 }
 
+static struct presentation_feedback *
+surface_request_presentation_feedback(struct surface *surface);
+static void
+presentation_feedback_committed(struct presentation_feedback *feedback);
+
 static void
 surface_flush(struct surface *surface)
 {
+	struct display *display = surface->window->display;
+	struct presentation_feedback *feedback = NULL;
+
 	if (!surface->cairo_surface)
 		return;
 
@@ -1323,6 +1848,10 @@ surface_flush(struct surface *surface)
 					     surface->opaque_region);
 		wl_region_destroy(surface->opaque_region);
 		surface->opaque_region = NULL;
+		display_count_request(display, &wl_surface_interface,
+				      WL_SURFACE_SET_OPAQUE_REGION);
+		display_count_request(display, &wl_region_interface,
+				      WL_REGION_DESTROY);
 	}
 
 	if (surface->input_region) {
@@ -1330,11 +1859,21 @@ surface_flush(struct surface *surface)
 					    surface->input_region);
 		wl_region_destroy(surface->input_region);
 		surface->input_region = NULL;
+		display_count_request(display, &wl_surface_interface,
+				      WL_SURFACE_SET_INPUT_REGION);
+		display_count_request(display, &wl_region_interface,
+				      WL_REGION_DESTROY);
 	}
 
+	if (display->presentation)
+		feedback = surface_request_presentation_feedback(surface);
+
 	surface->toysurface->swap(surface->toysurface,
 				  surface->buffer_transform, surface->buffer_scale,
 				  &surface->server_allocation);
+	if (feedback)
+		presentation_feedback_committed(feedback);
+	startup_trace_phase("first_commit");
 
 	cairo_surface_destroy(surface->cairo_surface);
 	surface->cairo_surface = NULL;
@@ -1399,6 +1938,12 @@ window_create_main_surface(struct window *window)
 	if (window->preferred_format == WINDOW_PREFERRED_FORMAT_RGB565)
 		flags |= SURFACE_HINT_RGB565;
 
+	if (window->low_memory)
+		flags |= SURFACE_HINT_LOW_MEMORY;
+
+	if (surface->widget && surface->widget->opaque)
+		flags |= SURFACE_OPAQUE;
+
 	surface_create_surface(surface, flags);
 }
 
@@ -1449,10 +1994,19 @@ window_get_output_scale(struct window *window)
 }
 
 static void window_frame_destroy(struct window_frame *frame);
+static void input_replay_window_destroyed(struct window *window);
+static void display_finish_render(struct display *display);
+static void display_schedule_input(struct display *display);
+static void window_redraw_end_stats(struct window *window);
+static void handle_timers(struct task *task, uint32_t events);
+static void handle_timeout(struct toytimer *timer);
 
 static void
 surface_destroy(struct surface *surface)
 {
+	/* The render thread may be painting it */
+	display_finish_render(surface->window->display);
+
 	if (surface->frame_cb)
 		wl_callback_destroy(surface->frame_cb);
 
@@ -1482,8 +2036,13 @@ window_destroy(struct window *window)
 	struct window_output *window_output;
 	struct window_output *window_output_tmp;
 
+	/* The render thread may be painting it */
+	display_finish_render(display);
+
 	wl_list_remove(&window->redraw_task.link);
 
+	input_replay_window_destroyed(window);
+
 	wl_list_for_each(input, &display->input_list, link) {	  
 		if (input->touch_focus == window)
 			input->touch_focus = NULL;
@@ -1501,6 +2060,8 @@ window_destroy(struct window *window)
 		free (window_output);
 	}
 
+	if (window->server_decoration)
+		org_kde_kwin_server_decoration_release(window->server_decoration);
 	if (window->frame)
 		window_frame_destroy(window->frame);
 
@@ -1515,6 +2076,7 @@ window_destroy(struct window *window)
 
 	wl_list_remove(&window->link);
 
+	free(window->paint_surfaces);
 	free(window->title);
 	free(window);
 }
@@ -1683,81 +2245,21 @@ static void
 widget_cairo_update_transform(struct widget *widget, cairo_t *cr)
 {
 	struct surface *surface = widget->surface;
-	double angle;
-	cairo_matrix_t m;
-	enum wl_output_transform transform;
-	int surface_width, surface_height;
-	int translate_x, translate_y;
-	int32_t scale;
-
-	surface_width = surface->allocation.width;
-	surface_height = surface->allocation.height;
-
-	transform = surface->buffer_transform;
-	scale = surface->buffer_scale;
-
-	switch (transform) {
-	case WL_OUTPUT_TRANSFORM_FLIPPED:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		cairo_matrix_init(&m, -1, 0, 0, 1, 0, 0);
-		break;
-	default:
-		cairo_matrix_init_identity(&m);
-		break;
-	}
-
-	switch (transform) {
-	case WL_OUTPUT_TRANSFORM_NORMAL:
-	default:
-		angle = 0;
-		translate_x = 0;
-		translate_y = 0;
-		break;
-	case WL_OUTPUT_TRANSFORM_FLIPPED:
-		angle = 0;
-		translate_x = surface_width;
-		translate_y = 0;
-		break;
-	case WL_OUTPUT_TRANSFORM_90:
-		angle = M_PI_2;
-		translate_x = surface_height;
-		translate_y = 0;
-		break;
-	case WL_OUTPUT_TRANSFORM_FLIPPED_90:
-		angle = M_PI_2;
-		translate_x = surface_height;
-		translate_y = surface_width;
-		break;
-	case WL_OUTPUT_TRANSFORM_180:
-		angle = M_PI;
-		translate_x = surface_width;
-		translate_y = surface_height;
-		break;
-	case WL_OUTPUT_TRANSFORM_FLIPPED_180:
-		angle = M_PI;
-		translate_x = 0;
-		translate_y = surface_height;
-		break;
-	case WL_OUTPUT_TRANSFORM_270:
-		angle = M_PI + M_PI_2;
-		translate_x = 0;
-		translate_y = surface_width;
-		break;
-	case WL_OUTPUT_TRANSFORM_FLIPPED_270:
-		angle = M_PI + M_PI_2;
-		translate_x = 0;
-		translate_y = 0;
-		break;
-	}
 
-	cairo_scale(cr, scale, scale);
-	cairo_translate(cr, translate_x, translate_y);
-	cairo_rotate(cr, angle);
-	cairo_transform(cr, &m);
+	transform_cairo_to_buffer(cr, surface->buffer_transform,
+				  surface->buffer_scale,
+				  surface->allocation.width,
+				  surface->allocation.height);
 }
 
+/*
+ * What the calling thread draws the widgets of paint_target_surface
+ * to instead of its buffer: an image surface over a band of it, see
+ * surface_paint(), or a recording, see surface_record()
+ */
+static __thread cairo_surface_t *paint_target;
+static __thread struct surface *paint_target_surface;
+
 cairo_t *
 widget_cairo_create(struct widget *widget)
 {
@@ -1766,7 +2268,10 @@ widget_cairo_create(struct widget *widget)
 	cairo_t *cr;
 
 	cairo_surface = widget_get_cairo_surface(widget);
-	cr = cairo_create(cairo_surface);
+	if (paint_target && surface == paint_target_surface)
+		cr = cairo_create(paint_target);
+	else
+		cr = cairo_create(cairo_surface);
 
 	widget_cairo_update_transform(widget, cr);
 
@@ -1796,15 +2301,21 @@ widget_get_last_time(struct widget *widget)
 void
 widget_input_region_add(struct widget *widget, const struct rectangle *rect)
 {
-	struct wl_compositor *comp = widget->window->display->compositor;
+	struct display *display = widget->window->display;
 	struct surface *surface = widget->surface;
 
-	if (!surface->input_region)
-		surface->input_region = wl_compositor_create_region(comp);
+	if (!surface->input_region) {
+		surface->input_region =
+			wl_compositor_create_region(display->compositor);
+		display_count_request(display, &wl_compositor_interface,
+				      WL_COMPOSITOR_CREATE_REGION);
+	}
 
 	if (rect) {
 		wl_region_add(surface->input_region,
 			      rect->x, rect->y, rect->width, rect->height);
+		display_count_request(display, &wl_region_interface,
+				      WL_REGION_ADD);
 	}
 }
 
@@ -2006,21 +2517,17 @@ widget_destroy_tooltip(struct widget *parent)
 		tooltip->widget = NULL;
 	}
 
-	close(tooltip->tooltip_fd);
+	toytimer_fini(&tooltip->timer);
 	free(tooltip->entry);
 	free(tooltip);
 	parent->tooltip = NULL;
 }
 
 static void
-tooltip_func(struct task *task, uint32_t events)
+tooltip_func(struct toytimer *timer)
 {
-	struct tooltip *tooltip =
-		container_of(task, struct tooltip, tooltip_task);
-	uint64_t exp;
+	struct tooltip *tooltip = container_of(timer, struct tooltip, timer);
 
-	if (read(tooltip->tooltip_fd, &exp, sizeof (uint64_t)) != sizeof (uint64_t))
-		abort();
 	window_create_tooltip(tooltip);
 }
 
@@ -2028,16 +2535,7 @@ tooltip_func(struct task *task, uint32_t events)
 static int
 tooltip_timer_reset(struct tooltip *tooltip)
 {
-	struct itimerspec its;
-
-	its.it_interval.tv_sec = 0;
-	its.it_interval.tv_nsec = 0;
-	its.it_value.tv_sec = TOOLTIP_TIMEOUT / 1000;
-	its.it_value.tv_nsec = (TOOLTIP_TIMEOUT % 1000) * 1000 * 1000;
-	if (timerfd_settime(tooltip->tooltip_fd, 0, &its, NULL) < 0) {
-		fprintf(stderr, "could not set timerfd\n: %m");
-		return -1;
-	}
+	toytimer_arm(&tooltip->timer, TOOLTIP_TIMEOUT * 1000, 0);
 
 	return 0;
 }
@@ -2070,15 +2568,7 @@ widget_set_tooltip(struct widget *parent, char *entry, float x, float y)
 	tooltip->x = x;
 	tooltip->y = y;
 	tooltip->entry = strdup(entry);
-	tooltip->tooltip_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
-	if (tooltip->tooltip_fd < 0) {
-		fprintf(stderr, "could not create timerfd\n: %m");
-		return -1;
-	}
-
-	tooltip->tooltip_task.run = tooltip_func;
-	display_watch_fd(parent->window->display, tooltip->tooltip_fd,
-			 EPOLLIN, &tooltip->tooltip_task);
+	toytimer_init(&tooltip->timer, parent->window->display, tooltip_func);
 	tooltip_timer_reset(tooltip);
 
 	return 0;
@@ -2100,6 +2590,13 @@ static const struct workspace_manager_listener workspace_manager_listener = {
 	workspace_manager_state
 };
 
+/* The frame is not drawn in fullscreen, nor when the server decorates */
+static int
+frame_is_drawn(struct window *window)
+{
+	return !window->fullscreen && !window->server_decorated;
+}
+
 static void
 frame_resize_handler(struct widget *widget,
 		     int32_t width, int32_t height, void *data)
@@ -2109,8 +2606,9 @@ frame_resize_handler(struct widget *widget,
 	struct rectangle interior;
 	struct rectangle input;
 	struct rectangle opaque;
+	int decorated = frame_is_drawn(widget->window);
 
-	if (widget->window->fullscreen) {
+	if (!decorated) {
 		interior.x = 0;
 		interior.y = 0;
 		interior.width = width;
@@ -2134,7 +2632,7 @@ frame_resize_handler(struct widget *widget,
 		child->resize_handler(child, interior.width, interior.height,
 				      child->user_data);
 
-		if (widget->window->fullscreen) {
+		if (!decorated) {
 			width = child->allocation.width;
 			height = child->allocation.height;
 		} else {
@@ -2150,7 +2648,10 @@ frame_resize_handler(struct widget *widget,
 
 	widget->surface->input_region =
 		wl_compositor_create_region(widget->window->display->compositor);
-	if (!widget->window->fullscreen) {
+	display_count_request(widget->window->display,
+			      &wl_compositor_interface,
+			      WL_COMPOSITOR_CREATE_REGION);
+	if (decorated) {
 		frame_input_rect(frame->frame, &input.x, &input.y,
 				 &input.width, &input.height);
 		wl_region_add(widget->surface->input_region,
@@ -2158,11 +2659,13 @@ frame_resize_handler(struct widget *widget,
 	} else {
 		wl_region_add(widget->surface->input_region, 0, 0, width, height);
 	}
+	display_count_request(widget->window->display,
+			      &wl_region_interface, WL_REGION_ADD);
 
 	widget_set_allocation(widget, 0, 0, width, height);
 
 	if (child->opaque) {
-		if (!widget->window->fullscreen) {
+		if (decorated) {
 			frame_opaque_rect(frame->frame, &opaque.x, &opaque.y,
 					  &opaque.width, &opaque.height);
 
@@ -2173,6 +2676,8 @@ frame_resize_handler(struct widget *widget,
 			wl_region_add(widget->surface->opaque_region,
 				      0, 0, width, height);
 		}
+		display_count_request(widget->window->display,
+				      &wl_region_interface, WL_REGION_ADD);
 	}
 
 
@@ -2186,15 +2691,9 @@ frame_redraw_handler(struct widget *widget, void *data)
 	struct window_frame *frame = data;
 	struct window *window = widget->window;
 
-	if (window->fullscreen)
+	if (!window->paint_frame_drawn)
 		return;
 
-	if (window->focused) {
-		frame_set_flag(frame->frame, FRAME_FLAG_ACTIVE);
-	} else {
-		frame_unset_flag(frame->frame, FRAME_FLAG_ACTIVE);
-	}
-
 	cr = widget_cairo_create(widget);
 
 	frame_repaint(frame->frame, cr);
@@ -2441,6 +2940,75 @@ frame_touch_up_handler(struct widget *widget,
 	frame_handle_status(frame, input, time, THEME_LOCATION_CLIENT_AREA);
 }
 
+static void
+server_decoration_handle_mode(void *data,
+			      struct org_kde_kwin_server_decoration *decoration,
+			      uint32_t mode)
+{
+	struct window *window = data;
+	int server_decorated = mode == ORG_KDE_KWIN_SERVER_DECORATION_MODE_SERVER;
+	int32_t width, height;
+
+	if (window->server_decorated == server_decorated)
+		return;
+
+	/* The initial mode, before the frame is set up */
+	if (!window->frame) {
+		window->server_decorated = server_decorated;
+		return;
+	}
+
+	/* Keep the content size, and resize the surface around it */
+	width = window->pending_allocation.width;
+	height = window->pending_allocation.height;
+	if (!window->server_decorated) {
+		frame_resize(window->frame->frame, width, height);
+		frame_interior(window->frame->frame, NULL, NULL,
+			       &width, &height);
+	}
+
+	window->server_decorated = server_decorated;
+	window->min_allocation.width = 0;
+	window->min_allocation.height = 0;
+	window_frame_set_child_size(window->frame->child, width, height);
+}
+
+static const struct org_kde_kwin_server_decoration_listener server_decoration_listener = {
+	server_decoration_handle_mode
+};
+
+static void
+window_request_server_decoration(struct window *window)
+{
+	struct display *display = window->display;
+	struct wl_event_queue *queue;
+
+	window->server_decoration =
+		org_kde_kwin_server_decoration_manager_create(
+			display->server_decoration_manager,
+			window->main_surface->surface);
+	org_kde_kwin_server_decoration_add_listener(window->server_decoration,
+						    &server_decoration_listener,
+						    window);
+
+	/*
+	 * Wait for the compositor's answer before the frame is sized, so
+	 * that neither mode costs a resize and repaint on the first
+	 * configure. The roundtrip runs on a queue of its own, so only the
+	 * decoration's mode events are dispatched meanwhile.
+	 */
+	queue = wl_display_create_queue(display->display);
+	wl_proxy_set_queue((struct wl_proxy *) window->server_decoration,
+			   queue);
+	org_kde_kwin_server_decoration_request_mode(window->server_decoration,
+		ORG_KDE_KWIN_SERVER_DECORATION_MODE_SERVER);
+	if (wl_display_roundtrip_queue(display->display, queue) < 0)
+		window->server_decorated = 0;
+	wl_proxy_set_queue((struct wl_proxy *) window->server_decoration,
+			   display->queue);
+	wl_event_queue_destroy(queue);
+}
+
 struct widget *
 window_frame_create(struct window *window, uint32_t type, uint32_t resizable, void *data)
 {
@@ -2457,6 +3025,13 @@ window_frame_create(struct window *window, uint32_t type, uint32_t resizable, vo
 	frame->frame = frame_create(window->display->theme, 0, 0,
 				    resizable, buttons, window->title);
 
+	if (window->display->server_decoration_manager && !window->custom)
+		window_request_server_decoration(window);
+	if (window->no_shadow)
+		frame_set_flag(frame->frame, FRAME_FLAG_NO_SHADOW);
+	if (window->compact_frame)
+		frame_set_flag(frame->frame, FRAME_FLAG_COMPACT);
+
 	frame->widget = window_add_widget(window, frame);
 	frame->child = widget_add_widget(frame->widget, data);
 
@@ -2469,6 +3044,12 @@ window_frame_create(struct window *window, uint32_t type, uint32_t resizable, vo
 	widget_set_touch_down_handler(frame->widget, frame_touch_down_handler);
 	widget_set_touch_up_handler(frame->widget, frame_touch_up_handler);
 
+	/* A compact frame covers every pixel of the surface, which lets
+	 * the main surface use an opaque format and opaque region. The
+	 * child is then expected to paint all of its allocation. */
+	if (window->compact_frame)
+		widget_set_transparent(frame->widget, 0);
+
 	window->frame = frame;
 
 	return frame->child;
@@ -2482,9 +3063,13 @@ window_frame_set_child_size(struct widget *widget, int child_width,
 	struct theme *t = display->theme;
 	int decoration_width, decoration_height;
 	int width, height;
-	int margin = widget->window->maximized ? 0 : t->margin;
+	int margin = t->margin;
+
+	if (widget->window->maximized || widget->window->no_shadow ||
+	    widget->window->compact_frame)
+		margin = 0;
 
-	if (!widget->window->fullscreen) {
+	if (frame_is_drawn(widget->window)) {
 		decoration_width = (t->width + margin) * 2;
 		decoration_height = t->width +
 			t->titlebar_height + margin * 2;
@@ -2605,17 +3190,280 @@ input_remove_pointer_focus(struct input *input)
 	input->current_cursor = CURSOR_UNSET;
 }
 
-static void
-pointer_handle_enter(void *data, struct wl_pointer *pointer,
-		     uint32_t serial, struct wl_surface *surface,
-		     wl_fixed_t sx_w, wl_fixed_t sy_w)
+struct presentation_feedback {
+	struct display *display;
+	struct wp_presentation_feedback *feedback;
+	struct timespec commit;
+	struct timespec input;
+	struct wl_list link;
+};
+
+static uint64_t
+timespec_sub_to_us(const struct timespec *a, const struct timespec *b)
 {
-	struct input *input = data;
-	struct window *window;
+	int64_t us;
+
+	us = (int64_t) (a->tv_sec - b->tv_sec) * 1000000 +
+		(a->tv_nsec - b->tv_nsec) / 1000;
+
+	return us > 0 ? us : 0;
+}
+
+static void
+latency_histogram_add(struct latency_histogram *histogram, uint64_t us)
+{
+	int i = 0;
+
+	while (i < LATENCY_BUCKETS - 1 && us >> (i + 1))
+		i++;
+
+	histogram->buckets[i]++;
+	histogram->count++;
+	histogram->total_us += us;
+	if (us > histogram->max_us)
+		histogram->max_us = us;
+}
+
+static void
+latency_histogram_print(struct latency_histogram *histogram,
+			const char *name, FILE *fp)
+{
+	int i;
+
+	fprintf(fp, "toytoolkit latency: %s count %u avg %llu us max %llu us\n",
+		name, histogram->count,
+		(unsigned long long) (histogram->count ?
+				      histogram->total_us / histogram->count : 0),
+		(unsigned long long) histogram->max_us);
+
+	for (i = 0; i < LATENCY_BUCKETS; i++) {
+		if (!histogram->buckets[i])
+			continue;
+		fprintf(fp, "toytoolkit latency: %s %llu-%llu us %u\n",
+			name,
+			i ? 1ULL << i : 0ULL, (1ULL << (i + 1)) - 1,
+			histogram->buckets[i]);
+	}
+}
+
+static void
+presentation_feedback_destroy(struct presentation_feedback *feedback)
+{
+	wp_presentation_feedback_destroy(feedback->feedback);
+	wl_list_remove(&feedback->link);
+	free(feedback);
+}
+
+static void
+feedback_sync_output(void *data,
+		     struct wp_presentation_feedback *presentation_feedback,
+		     struct wl_output *output)
+{
+}
+
+static void
+feedback_presented(void *data,
+		   struct wp_presentation_feedback *presentation_feedback,
+		   uint32_t tv_sec_hi, uint32_t tv_sec_lo, uint32_t tv_nsec,
+		   uint32_t refresh, uint32_t seq_hi, uint32_t seq_lo,
+		   uint32_t flags)
+{
+	struct presentation_feedback *feedback = data;
+	struct display *display = feedback->display;
+	struct timespec presented;
+
+	presented.tv_sec = ((uint64_t) tv_sec_hi << 32) + tv_sec_lo;
+	presented.tv_nsec = tv_nsec;
+
+	latency_histogram_add(&display->commit_latency,
+			      timespec_sub_to_us(&presented, &feedback->commit));
+	if (feedback->input.tv_sec || feedback->input.tv_nsec)
+		latency_histogram_add(&display->input_latency,
+				      timespec_sub_to_us(&presented,
+							 &feedback->input));
+
+	presentation_feedback_destroy(feedback);
+}
+
+static void
+feedback_discarded(void *data,
+		   struct wp_presentation_feedback *presentation_feedback)
+{
+	struct presentation_feedback *feedback = data;
+
+	feedback->display->stats_discarded++;
+	presentation_feedback_destroy(feedback);
+}
+
+static const struct wp_presentation_feedback_listener feedback_listener = {
+	feedback_sync_output,
+	feedback_presented,
+	feedback_discarded
+};
+
+/*
+ * Ask for the presentation time of the commit about to be made; the
+ * caller stamps the commit time once wl_surface_commit() is issued.
+ */
+static struct presentation_feedback *
+surface_request_presentation_feedback(struct surface *surface)
+{
+	struct display *display = surface->window->display;
+	struct presentation_feedback *feedback;
+
+	feedback = xzalloc(sizeof *feedback);
+	feedback->display = display;
+	feedback->feedback = wp_presentation_feedback(display->presentation,
+						      surface->surface);
+	wl_proxy_set_queue((struct wl_proxy *) feedback->feedback,
+			   display->presentation_queue);
+	wp_presentation_feedback_add_listener(feedback->feedback,
+					      &feedback_listener, feedback);
+
+	/* The first frame after an input event carries its latency */
+	feedback->input = display->pending_input;
+	display->pending_input.tv_sec = 0;
+	display->pending_input.tv_nsec = 0;
+
+	wl_list_insert(&display->presentation_list, &feedback->link);
+
+	return feedback;
+}
+
+static void
+presentation_feedback_committed(struct presentation_feedback *feedback)
+{
+	clock_gettime(feedback->display->presentation_clock,
+		      &feedback->commit);
+}
+
+/*
+ * Input events can be recorded to a file with their timestamps and
+ * replayed into the same handlers later, at the recorded pace or as
+ * fast as possible, to get reproducible hit-testing and redraw costs
+ * under input load:
+ *
+ *	TOYTOOLKIT_INPUT_RECORD=file	record the seat events
+ *	TOYTOOLKIT_INPUT_REPLAY=file	replay them once the first window
+ *					is drawn
+ *	TOYTOOLKIT_INPUT_REPLAY_FAST=1	do not wait between events
+ *	TOYTOOLKIT_INPUT_STORM=rate[,s]	replay generated pointer motion
+ *					at rate events per second
+ *
+ * Each line of a recording is the time in nanoseconds since the first
+ * event, the event name and its integer arguments, wl_fixed_t values
+ * being written raw. Surfaces are not recorded, replayed events go to
+ * the first window.
+ */
+enum input_event_type {
+	INPUT_EVENT_ENTER,
+	INPUT_EVENT_LEAVE,
+	INPUT_EVENT_MOTION,
+	INPUT_EVENT_BUTTON,
+	INPUT_EVENT_AXIS,
+	INPUT_EVENT_KEYBOARD_ENTER,
+	INPUT_EVENT_KEYBOARD_LEAVE,
+	INPUT_EVENT_KEY,
+	INPUT_EVENT_MODIFIERS,
+	INPUT_EVENT_TOUCH_DOWN,
+	INPUT_EVENT_TOUCH_UP,
+	INPUT_EVENT_TOUCH_MOTION,
+	INPUT_EVENT_TOUCH_FRAME,
+	INPUT_EVENT_TOUCH_CANCEL,
+	INPUT_EVENT_COUNT
+};
+
+static const struct {
+	const char *name;
+	int args;
+} input_events[] = {
+	[INPUT_EVENT_ENTER] = { "enter", 2 },
+	[INPUT_EVENT_LEAVE] = { "leave", 0 },
+	[INPUT_EVENT_MOTION] = { "motion", 2 },
+	[INPUT_EVENT_BUTTON] = { "button", 2 },
+	[INPUT_EVENT_AXIS] = { "axis", 2 },
+	[INPUT_EVENT_KEYBOARD_ENTER] = { "keyboard_enter", 0 },
+	[INPUT_EVENT_KEYBOARD_LEAVE] = { "keyboard_leave", 0 },
+	[INPUT_EVENT_KEY] = { "key", 2 },
+	[INPUT_EVENT_MODIFIERS] = { "modifiers", 4 },
+	[INPUT_EVENT_TOUCH_DOWN] = { "touch_down", 3 },
+	[INPUT_EVENT_TOUCH_UP] = { "touch_up", 1 },
+	[INPUT_EVENT_TOUCH_MOTION] = { "touch_motion", 3 },
+	[INPUT_EVENT_TOUCH_FRAME] = { "touch_frame", 0 },
+	[INPUT_EVENT_TOUCH_CANCEL] = { "touch_cancel", 0 },
+};
+
+struct recorded_input {
+	uint64_t time;
+	enum input_event_type type;
+	int32_t args[4];
+};
+
+struct input_replay {
+	struct display *display;
+	struct window *window;
+	struct recorded_input *events;
+	uint32_t count, next;
+	int fast;
+	int done;
+
+	/* Generated motion, in events per second; 0 when from a file */
+	uint32_t storm_rate;
+
+	uint64_t start;
+	uint64_t handler_ns;
+	uint32_t frames_start;
+
+	struct toytimer timer;
+};
+
+static void
+input_record(struct display *display, enum input_event_type type,
+	     int32_t a, int32_t b, int32_t c, int32_t d)
+{
+	int32_t args[4] = { a, b, c, d };
+	uint64_t now;
+	int i;
+
+	if (!display->input_record)
+		return;
+
+	now = trace_now();
+	if (!display->input_record_start)
+		display->input_record_start = now;
+
+	fprintf(display->input_record, "%llu %s",
+		(unsigned long long) (now - display->input_record_start),
+		input_events[type].name);
+	for (i = 0; i < input_events[type].args; i++)
+		fprintf(display->input_record, " %d", args[i]);
+	fputc('\n', display->input_record);
+}
+
+static void
+display_note_input(struct display *display)
+{
+	if (!display->presentation)
+		return;
+
+	if (!display->pending_input.tv_sec && !display->pending_input.tv_nsec)
+		clock_gettime(display->presentation_clock,
+			      &display->pending_input);
+}
+
+static void
+pointer_handle_enter(void *data, struct wl_pointer *pointer,
+		     uint32_t serial, struct wl_surface *surface,
+		     wl_fixed_t sx_w, wl_fixed_t sy_w)
+{
+	struct input *input = data;
+	struct window *window;
 	struct widget *widget;
 	float sx = wl_fixed_to_double(sx_w);
 	float sy = wl_fixed_to_double(sy_w);
 
+	input_record(input->display, INPUT_EVENT_ENTER, sx_w, sy_w, 0, 0);
+
 	if (!surface) {
 		/* enter event for a window we've just destroyed */
 		return;
@@ -2650,6 +3498,7 @@ pointer_handle_leave(void *data, struct wl_pointer *pointer,
 {
 	struct input *input = data;
 
+	input_record(input->display, INPUT_EVENT_LEAVE, 0, 0, 0, 0);
 	input->display->serial = serial;
 	input_remove_pointer_focus(input);
 }
@@ -2665,6 +3514,8 @@ pointer_handle_motion(void *data, struct wl_pointer *pointer,
 	float sx = wl_fixed_to_double(sx_w);
 	float sy = wl_fixed_to_double(sy_w);
 
+	input_record(input->display, INPUT_EVENT_MOTION, sx_w, sy_w, 0, 0);
+
 	if (!window)
 		return;
 
@@ -2709,6 +3560,8 @@ pointer_handle_button(void *data, struct wl_pointer *pointer, uint32_t serial,
 	struct widget *widget;
 	enum wl_pointer_button_state state = state_w;
 
+	input_record(input->display, INPUT_EVENT_BUTTON, button, state_w, 0, 0);
+	display_note_input(input->display);
 	input->display->serial = serial;
 	if (input->focus_widget && input->grab == NULL &&
 	    state == WL_POINTER_BUTTON_STATE_PRESSED)
@@ -2733,6 +3586,8 @@ pointer_handle_axis(void *data, struct wl_pointer *pointer,
 	struct input *input = data;
 	struct widget *widget;
 
+	input_record(input->display, INPUT_EVENT_AXIS, axis, value, 0, 0);
+
 	widget = input->focus_widget;
 	if (input->grab)
 		widget = input->grab;
@@ -2755,13 +3610,8 @@ static void
 input_remove_keyboard_focus(struct input *input)
 {
 	struct window *window = input->keyboard_focus;
-	struct itimerspec its;
 
-	its.it_interval.tv_sec = 0;
-	its.it_interval.tv_nsec = 0;
-	its.it_value.tv_sec = 0;
-	its.it_value.tv_nsec = 0;
-	timerfd_settime(input->repeat_timer_fd, 0, &its, NULL);
+	toytimer_disarm(&input->repeat_timer);
 
 	if (!window)
 		return;
@@ -2775,20 +3625,20 @@ input_remove_keyboard_focus(struct input *input)
 }
 
 static void
-keyboard_repeat_func(struct task *task, uint32_t events)
+keyboard_repeat_func(struct toytimer *timer)
 {
 	struct input *input =
-		container_of(task, struct input, repeat_task);
-	struct window *window = input->keyboard_focus;
-	uint64_t exp;
+		container_of(timer, struct input, repeat_timer);
+	struct window *window;
+	uint64_t count;
 
-	if (read(input->repeat_timer_fd, &exp, sizeof exp) != sizeof exp)
-		/* If we change the timer between the fd becoming
-		 * readable and getting here, there'll be nothing to
-		 * read and we get EAGAIN. */
-		return;
+	/* Also deliver the repeats a busy main loop made us miss */
+	count = toytimer_get_overrun(timer) + 1;
+	while (count-- > 0) {
+		window = input->keyboard_focus;
+		if (!window || !window->key_handler)
+			break;
 
-	if (window && window->key_handler) {
 		(*window->key_handler)(window, input, input->repeat_time,
 				       input->repeat_key, input->repeat_sym,
 				       WL_KEYBOARD_KEY_STATE_PRESSED,
@@ -2861,6 +3711,7 @@ keyboard_handle_enter(void *data, struct wl_keyboard *keyboard,
 	struct input *input = data;
 	struct window *window;
 
+	input_record(input->display, INPUT_EVENT_KEYBOARD_ENTER, 0, 0, 0, 0);
 	input->display->serial = serial;
 	input->keyboard_focus = wl_surface_get_user_data(surface);
 
@@ -2877,6 +3728,7 @@ keyboard_handle_leave(void *data, struct wl_keyboard *keyboard,
 {
 	struct input *input = data;
 
+	input_record(input->display, INPUT_EVENT_KEYBOARD_LEAVE, 0, 0, 0, 0);
 	input->display->serial = serial;
 	input_remove_keyboard_focus(input);
 }
@@ -2892,8 +3744,9 @@ keyboard_handle_key(void *data, struct wl_keyboard *keyboard,
 	enum wl_keyboard_key_state state = state_w;
 	const xkb_keysym_t *syms;
 	xkb_keysym_t sym;
-	struct itimerspec its;
 
+	input_record(input->display, INPUT_EVENT_KEY, key, state_w, 0, 0);
+	display_note_input(input->display);
 	input->display->serial = serial;
 	code = key + 8;
 	if (!window || !input->xkb.state)
@@ -2932,21 +3785,13 @@ keyboard_handle_key(void *data, struct wl_keyboard *keyboard,
 
 	if (state == WL_KEYBOARD_KEY_STATE_RELEASED &&
 	    key == input->repeat_key) {
-		its.it_interval.tv_sec = 0;
-		its.it_interval.tv_nsec = 0;
-		its.it_value.tv_sec = 0;
-		its.it_value.tv_nsec = 0;
-		timerfd_settime(input->repeat_timer_fd, 0, &its, NULL);
+		toytimer_disarm(&input->repeat_timer);
 	} else if (state == WL_KEYBOARD_KEY_STATE_PRESSED &&
 		   xkb_keymap_key_repeats(input->xkb.keymap, code)) {
 		input->repeat_sym = sym;
 		input->repeat_key = key;
 		input->repeat_time = time;
-		its.it_interval.tv_sec = 0;
-		its.it_interval.tv_nsec = 25 * 1000 * 1000;
-		its.it_value.tv_sec = 0;
-		its.it_value.tv_nsec = 400 * 1000 * 1000;
-		timerfd_settime(input->repeat_timer_fd, 0, &its, NULL);
+		toytimer_arm(&input->repeat_timer, 400 * 1000, 25 * 1000);
 	}
 }
 
@@ -2959,6 +3804,9 @@ keyboard_handle_modifiers(void *data, struct wl_keyboard *keyboard,
 	struct input *input = data;
 	xkb_mod_mask_t mask;
 
+	input_record(input->display, INPUT_EVENT_MODIFIERS, mods_depressed,
+		     mods_latched, mods_locked, group);
+
 	/* If we're not using a keymap, then we don't handle PC-style modifiers */
 	if (!input->xkb.keymap)
 		return;
@@ -2995,6 +3843,8 @@ touch_handle_down(void *data, struct wl_touch *wl_touch,
 	float sx = wl_fixed_to_double(x_w);
 	float sy = wl_fixed_to_double(y_w);
 
+	input_record(input->display, INPUT_EVENT_TOUCH_DOWN, id, x_w, y_w, 0);
+	display_note_input(input->display);
 	input->display->serial = serial;
 	input->touch_focus = wl_surface_get_user_data(surface);
 	if (!input->touch_focus) {
@@ -3039,6 +3889,8 @@ touch_handle_up(void *data, struct wl_touch *wl_touch,
 	struct input *input = data;
 	struct touch_point *tp, *tmp;
 
+	input_record(input->display, INPUT_EVENT_TOUCH_UP, id, 0, 0, 0);
+
 	if (!input->touch_focus) {
 		DBG("No touch focus found for touch up event!\n");
 		return;
@@ -3069,6 +3921,8 @@ touch_handle_motion(void *data, struct wl_touch *wl_touch,
 	float sx = wl_fixed_to_double(x_w);
 	float sy = wl_fixed_to_double(y_w);
 
+	input_record(input->display, INPUT_EVENT_TOUCH_MOTION, id, x_w, y_w, 0);
+
 	DBG("touch_handle_motion: %i %i\n", id, wl_list_length(&input->touch_point_list));
 
 	if (!input->touch_focus) {
@@ -3096,6 +3950,8 @@ touch_handle_frame(void *data, struct wl_touch *wl_touch)
 	struct input *input = data;
 	struct touch_point *tp, *tmp;
 
+	input_record(input->display, INPUT_EVENT_TOUCH_FRAME, 0, 0, 0, 0);
+
 	DBG("touch_handle_frame\n");
 
 	if (!input->touch_focus) {
@@ -3116,6 +3972,8 @@ touch_handle_cancel(void *data, struct wl_touch *wl_touch)
 	struct input *input = data;
 	struct touch_point *tp, *tmp;
 
+	input_record(input->display, INPUT_EVENT_TOUCH_CANCEL, 0, 0, 0, 0);
+
 	DBG("touch_handle_cancel\n");
 
 	if (!input->touch_focus) {
@@ -3141,6 +3999,334 @@ static const struct wl_touch_listener touch_listener = {
 	touch_handle_cancel,
 };
 
+/* Whether the seat has the device an event would come from */
+static int
+input_has_device_for(struct input *input, enum input_event_type type)
+{
+	if (type <= INPUT_EVENT_AXIS)
+		return input->pointer != NULL;
+	if (type <= INPUT_EVENT_MODIFIERS)
+		return input->keyboard != NULL && input->xkb.state != NULL;
+
+	return input->touch != NULL;
+}
+
+static void
+input_replay_dispatch(struct input_replay *replay,
+		      struct recorded_input *event)
+{
+	struct display *display = replay->display;
+	struct wl_surface *surface = replay->window->main_surface->surface;
+	struct rectangle *allocation = &replay->window->main_surface->allocation;
+	uint32_t time = event->time / 1000000;
+	int32_t *args = event->args;
+	int32_t storm_args[2];
+	struct wl_array keys;
+	struct input *input;
+
+	if (wl_list_empty(&display->input_list))
+		return;
+	input = container_of(display->input_list.next, struct input, link);
+
+	/* Events recorded on another seat may not apply to this one */
+	if (!input_has_device_for(input, event->type))
+		return;
+
+	/* Generated positions are fractions of the window size */
+	if (replay->storm_rate) {
+		storm_args[0] = wl_fixed_from_double(allocation->width *
+						     (args[0] / 65536.0));
+		storm_args[1] = wl_fixed_from_double(allocation->height *
+						     (args[1] / 65536.0));
+		args = storm_args;
+	}
+
+	switch (event->type) {
+	case INPUT_EVENT_ENTER:
+		pointer_handle_enter(input, input->pointer, display->serial,
+				     surface, args[0], args[1]);
+		break;
+	case INPUT_EVENT_LEAVE:
+		pointer_handle_leave(input, input->pointer, display->serial,
+				     surface);
+		break;
+	case INPUT_EVENT_MOTION:
+		pointer_handle_motion(input, input->pointer, time,
+				      args[0], args[1]);
+		break;
+	case INPUT_EVENT_BUTTON:
+		pointer_handle_button(input, input->pointer, display->serial,
+				      time, args[0], args[1]);
+		break;
+	case INPUT_EVENT_AXIS:
+		pointer_handle_axis(input, input->pointer, time,
+				    args[0], args[1]);
+		break;
+	case INPUT_EVENT_KEYBOARD_ENTER:
+		wl_array_init(&keys);
+		keyboard_handle_enter(input, input->keyboard, display->serial,
+				      surface, &keys);
+		break;
+	case INPUT_EVENT_KEYBOARD_LEAVE:
+		keyboard_handle_leave(input, input->keyboard, display->serial,
+				      surface);
+		break;
+	case INPUT_EVENT_KEY:
+		keyboard_handle_key(input, input->keyboard, display->serial,
+				    time, args[0], args[1]);
+		break;
+	case INPUT_EVENT_MODIFIERS:
+		keyboard_handle_modifiers(input, input->keyboard,
+					  display->serial, args[0], args[1],
+					  args[2], args[3]);
+		break;
+	case INPUT_EVENT_TOUCH_DOWN:
+		touch_handle_down(input, input->touch, display->serial, time,
+				  surface, args[0], args[1], args[2]);
+		break;
+	case INPUT_EVENT_TOUCH_UP:
+		touch_handle_up(input, input->touch, display->serial, time,
+				args[0]);
+		break;
+	case INPUT_EVENT_TOUCH_MOTION:
+		touch_handle_motion(input, input->touch, time,
+				    args[0], args[1], args[2]);
+		break;
+	case INPUT_EVENT_TOUCH_FRAME:
+		touch_handle_frame(input, input->touch);
+		break;
+	case INPUT_EVENT_TOUCH_CANCEL:
+		touch_handle_cancel(input, input->touch);
+		break;
+	default:
+		break;
+	}
+}
+
+static void
+input_replay_arm(struct input_replay *replay)
+{
+	uint64_t when, now = trace_now();
+
+	/* When fast, deferred tasks such as redraws still run in between */
+	when = replay->start + replay->events[replay->next].time;
+	if (replay->fast || when <= now)
+		toytimer_arm(&replay->timer, 0, 0);
+	else
+		toytimer_arm(&replay->timer, (when - now) / 1000, 0);
+}
+
+static void
+input_replay_finish(struct input_replay *replay)
+{
+	struct display *display = replay->display;
+	double elapsed = (trace_now() - replay->start) / 1e9;
+	uint32_t frames;
+
+	if (replay->done)
+		return;
+	replay->done = 1;
+	replay->window = NULL;
+
+	toytimer_fini(&replay->timer);
+
+	frames = display->counters.frames_rendered - replay->frames_start;
+	fprintf(stderr, "toytoolkit replay: events=%u elapsed_ms=%.1f "
+		"events_per_sec=%.0f handler_us_avg=%.2f frames=%u "
+		"frames_per_event=%.3f\n",
+		replay->next, elapsed * 1e3,
+		elapsed > 0 ? replay->next / elapsed : 0.0,
+		replay->next ? replay->handler_ns / 1e3 / replay->next : 0.0,
+		frames, replay->next ? (double) frames / replay->next : 0.0);
+}
+
+static void
+input_replay_window_destroyed(struct window *window)
+{
+	struct input_replay *replay = window->display->input_replay;
+
+	if (replay && replay->window == window)
+		input_replay_finish(replay);
+}
+
+static void
+input_replay_func(struct toytimer *timer)
+{
+	struct input_replay *replay =
+		container_of(timer, struct input_replay, timer);
+	uint64_t now, start;
+
+	/* Deliver everything that is due in one go, like a compositor
+	 * flushing its queue, unless replaying as fast as possible */
+	now = trace_now();
+	do {
+		start = trace_now();
+		input_replay_dispatch(replay, &replay->events[replay->next++]);
+		replay->handler_ns += trace_now() - start;
+	} while (!replay->fast && replay->window &&
+		 replay->next < replay->count &&
+		 replay->start + replay->events[replay->next].time <= now);
+
+	if (!replay->window)
+		return;
+
+	if (replay->next < replay->count)
+		input_replay_arm(replay);
+	else
+		input_replay_finish(replay);
+}
+
+static void
+input_replay_start(struct input_replay *replay, struct window *window)
+{
+	if (replay->window || replay->done)
+		return;
+
+	if (replay->count == 0) {
+		replay->done = 1;
+		return;
+	}
+
+	replay->window = window;
+	replay->start = trace_now();
+	replay->frames_start = replay->display->counters.frames_rendered;
+
+	toytimer_init(&replay->timer, replay->display, input_replay_func);
+	input_replay_arm(replay);
+}
+
+static int
+input_replay_load(struct input_replay *replay, const char *filename)
+{
+	struct recorded_input *event;
+	unsigned long long time;
+	char line[256], name[32];
+	uint32_t size = 0;
+	FILE *fp;
+	int i;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		fprintf(stderr, "could not open input recording %s: %m\n",
+			filename);
+		return -1;
+	}
+
+	while (fgets(line, sizeof line, fp)) {
+		if (replay->count == size) {
+			size = size ? size * 2 : 256;
+			replay->events = xrealloc((char *) replay->events,
+						  size * sizeof *event);
+		}
+
+		event = &replay->events[replay->count];
+		memset(event, 0, sizeof *event);
+		if (sscanf(line, "%llu %31s %d %d %d %d", &time, name,
+			   &event->args[0], &event->args[1],
+			   &event->args[2], &event->args[3]) < 2)
+			continue;
+
+		for (i = 0; i < INPUT_EVENT_COUNT; i++)
+			if (strcmp(name, input_events[i].name) == 0)
+				break;
+		if (i == INPUT_EVENT_COUNT) {
+			fprintf(stderr, "unknown input event \"%s\" in %s\n",
+				name, filename);
+			continue;
+		}
+
+		event->time = time;
+		event->type = i;
+		replay->count++;
+	}
+
+	fclose(fp);
+
+	return 0;
+}
+
+/*
+ * Pointer motion over the whole window at rate events per second,
+ * tracing a Lissajous curve so that it keeps crossing widgets.
+ */
+static void
+input_replay_generate_storm(struct input_replay *replay,
+			    uint32_t rate, uint32_t seconds)
+{
+	struct recorded_input *event;
+	uint64_t period = 1000000000ULL / rate;
+	uint32_t i;
+	double t;
+
+	replay->storm_rate = rate;
+	replay->count = rate * seconds + 1;
+	replay->events = xzalloc(replay->count * sizeof *event);
+
+	for (i = 0; i < replay->count; i++) {
+		event = &replay->events[i];
+		t = 2 * M_PI * i / rate;
+		event->time = i * period;
+		event->type = i ? INPUT_EVENT_MOTION : INPUT_EVENT_ENTER;
+		event->args[0] = 65536 * (0.5 + 0.45 * sin(t));
+		event->args[1] = 65536 * (0.5 + 0.45 * sin(2 * t));
+	}
+}
+
+static struct input_replay *
+input_replay_create(struct display *display)
+{
+	struct input_replay *replay;
+	const char *filename = getenv("TOYTOOLKIT_INPUT_REPLAY");
+	const char *storm = getenv("TOYTOOLKIT_INPUT_STORM");
+	unsigned int rate = 0, seconds = 2;
+
+	if (storm && (sscanf(storm, "%u,%u", &rate, &seconds) < 1 ||
+		      rate == 0 || seconds == 0)) {
+		fprintf(stderr, "TOYTOOLKIT_INPUT_STORM should be "
+			"rate[,seconds]\n");
+		return NULL;
+	}
+
+	if (!filename && !rate)
+		return NULL;
+
+	replay = xzalloc(sizeof *replay);
+	replay->display = display;
+	replay->fast = getenv("TOYTOOLKIT_INPUT_REPLAY_FAST") != NULL;
+
+	if (rate) {
+		input_replay_generate_storm(replay, rate, seconds);
+	} else if (input_replay_load(replay, filename) < 0) {
+		free(replay);
+		return NULL;
+	}
+
+	return replay;
+}
+
+static void
+input_replay_destroy(struct input_replay *replay)
+{
+	if (replay->window)
+		input_replay_finish(replay);
+
+	free(replay->events);
+	free(replay);
+}
+
+/* Seat events go through the input task, see display_schedule_input() */
+static void
+input_set_queue(struct input *input, struct wl_proxy *proxy)
+{
+	wl_proxy_set_queue(proxy, input->display->input_queue);
+}
+
+void
+display_set_input_proxy(struct display *display, void *proxy)
+{
+	wl_proxy_set_queue((struct wl_proxy *) proxy, display->input_queue);
+}
+
 static void
 seat_handle_capabilities(void *data, struct wl_seat *seat,
 			 enum wl_seat_capability caps)
@@ -3149,6 +4335,7 @@ seat_handle_capabilities(void *data, struct wl_seat *seat,
 
 	if ((caps & WL_SEAT_CAPABILITY_POINTER) && !input->pointer) {
 		input->pointer = wl_seat_get_pointer(seat);
+		input_set_queue(input, (struct wl_proxy *) input->pointer);
 		wl_pointer_set_user_data(input->pointer, input);
 		wl_pointer_add_listener(input->pointer, &pointer_listener,
 					input);
@@ -3159,6 +4346,7 @@ seat_handle_capabilities(void *data, struct wl_seat *seat,
 
 	if ((caps & WL_SEAT_CAPABILITY_KEYBOARD) && !input->keyboard) {
 		input->keyboard = wl_seat_get_keyboard(seat);
+		input_set_queue(input, (struct wl_proxy *) input->keyboard);
 		wl_keyboard_set_user_data(input->keyboard, input);
 		wl_keyboard_add_listener(input->keyboard, &keyboard_listener,
 					 input);
@@ -3169,6 +4357,7 @@ seat_handle_capabilities(void *data, struct wl_seat *seat,
 
 	if ((caps & WL_SEAT_CAPABILITY_TOUCH) && !input->touch) {
 		input->touch = wl_seat_get_touch(seat);
+		input_set_queue(input, (struct wl_proxy *) input->touch);
 		wl_touch_set_user_data(input->touch, input);
 		wl_touch_add_listener(input->touch, &touch_listener, input);
 	} else if (!(caps & WL_SEAT_CAPABILITY_TOUCH) && input->touch) {
@@ -3694,17 +4883,25 @@ static void
 surface_resize(struct surface *surface)
 {
 	struct widget *widget = surface->widget;
-	struct wl_compositor *compositor = widget->window->display->compositor;
+	struct display *display = widget->window->display;
 
 	if (surface->input_region) {
 		wl_region_destroy(surface->input_region);
 		surface->input_region = NULL;
+		display_count_request(display, &wl_region_interface,
+				      WL_REGION_DESTROY);
 	}
 
-	if (surface->opaque_region)
+	if (surface->opaque_region) {
 		wl_region_destroy(surface->opaque_region);
+		display_count_request(display, &wl_region_interface,
+				      WL_REGION_DESTROY);
+	}
 
-	surface->opaque_region = wl_compositor_create_region(compositor);
+	surface->opaque_region =
+		wl_compositor_create_region(display->compositor);
+	display_count_request(display, &wl_compositor_interface,
+			      WL_COMPOSITOR_CREATE_REGION);
 
 	if (widget->resize_handler)
 		widget->resize_handler(widget,
@@ -3725,10 +4922,13 @@ surface_resize(struct surface *surface)
 	}
 	surface->allocation = widget->allocation;
 
-	if (widget->opaque)
+	if (widget->opaque) {
 		wl_region_add(surface->opaque_region, 0, 0,
 			      widget->allocation.width,
 			      widget->allocation.height);
+		display_count_request(display, &wl_region_interface,
+				      WL_REGION_ADD);
+	}
 }
 
 static void
@@ -3757,8 +4957,11 @@ hack_prevent_EGL_sub_surface_deadlock(struct window *window)
 	 * accumulated from the widget resize hooks.
 	 */
 	if (window->subsurface_list.next != &window->main_surface->link ||
-	    window->subsurface_list.prev != &window->main_surface->link)
+	    window->subsurface_list.prev != &window->main_surface->link) {
 		wl_surface_commit(window->main_surface->surface);
+		display_count_request(window->display, &wl_surface_interface,
+				      WL_SURFACE_COMMIT);
+	}
 }
 
 static void
@@ -3883,6 +5086,8 @@ handle_xdg_surface_configure(void *data, struct xdg_surface *xdg_surface,
 {
 	struct window *window = data;
 
+	display_count_event(window->display, &xdg_surface_interface);
+	startup_trace_phase("first_configure");
 	window_schedule_resize(window, width, height);
 }
 
@@ -3894,6 +5099,7 @@ handle_xdg_surface_change_state(void *data, struct xdg_surface *xdg_surface,
 {
 	struct window *window = data;
 
+	display_count_event(window->display, &xdg_surface_interface);
 	switch (state) {
 	case XDG_SURFACE_STATE_MAXIMIZED:
 		window->maximized = value;
@@ -3916,6 +5122,8 @@ static void
 handle_xdg_surface_activated(void *data, struct xdg_surface *xdg_surface)
 {
 	struct window *window = data;
+
+	display_count_event(window->display, &xdg_surface_interface);
 	window->focused = 1;
 }
 
@@ -3923,6 +5131,8 @@ static void
 handle_xdg_surface_deactivated(void *data, struct xdg_surface *xdg_surface)
 {
 	struct window *window = data;
+
+	display_count_event(window->display, &xdg_surface_interface);
 	window->focused = 0;
 }
 
@@ -3930,6 +5140,8 @@ static void
 handle_xdg_surface_delete(void *data, struct xdg_surface *xdg_surface)
 {
 	struct window *window = data;
+
+	display_count_event(window->display, &xdg_surface_interface);
 	window_close(window);
 }
 
@@ -3953,6 +5165,7 @@ handle_wl_shell_surface_configure(void *data, struct wl_shell_surface *shell_sur
 {
 	struct window *window = data;
 
+	startup_trace_phase("first_configure");
 	window_schedule_resize(window, width, height);
 }
 
@@ -3987,6 +5200,8 @@ window_sync_transient_for(struct window *window)
 
 	if (window->xdg_surface) {
 		xdg_surface_set_transient_for(window->xdg_surface, parent_surface);
+		display_count_request(window->display, &xdg_surface_interface,
+				      XDG_SURFACE_SET_TRANSIENT_FOR);
 	} else if (window->shell_surface) {
 		if (parent_surface)
 			wl_shell_surface_set_transient(window->shell_surface, parent_surface, window->x, window->y, 0);
@@ -4006,7 +5221,10 @@ window_sync_margin(struct window *window)
 	if (!window->frame)
 		return;
 
-	margin = frame_get_shadow_margin(window->frame->frame);
+	if (window->server_decorated)
+		margin = 0;
+	else
+		margin = frame_get_shadow_margin(window->frame->frame);
 
 	/* Shadow size is the same on every side. */
 	xdg_surface_set_margin(window->xdg_surface,
@@ -4014,6 +5232,8 @@ window_sync_margin(struct window *window)
 				     margin,
 				     margin,
 				     margin);
+	display_count_request(window->display, &xdg_surface_interface,
+			      XDG_SURFACE_SET_MARGIN);
 }
 
 static void
@@ -4065,9 +5285,12 @@ frame_callback(void *data, struct wl_callback *callback, uint32_t time)
 	DBG_OBJ(callback, "done\n");
 	wl_callback_destroy(callback);
 	surface->frame_cb = NULL;
+	display_count_event(surface->window->display, &wl_callback_interface);
 
 	surface->last_time = time;
 
+	startup_trace_phase("first_frame_callback");
+
 	if (surface->redraw_needed || surface->window->redraw_needed) {
 		DBG_OBJ(surface->surface, "window_schedule_redraw_task\n");
 		window_schedule_redraw_task(surface->window);
@@ -4078,8 +5301,12 @@ static const struct wl_callback_listener listener = {
 	frame_callback
 };
 
+/*
+ * Get the surface ready for painting: returns 1 when its widgets have
+ * to be painted, 0 when there is nothing to do and -1 on failure.
+ */
 static int
-surface_redraw(struct surface *surface)
+surface_prepare_redraw(struct surface *surface)
 {
 	DBG_OBJ(surface->surface, "begin\n");
 
@@ -4090,8 +5317,10 @@ surface_redraw(struct surface *surface)
 	 * not yet hit the screen.
 	 */
 	if (surface->frame_cb) {
-		if (!surface->window->redraw_needed)
+		if (!surface->window->redraw_needed) {
+			surface->window->display->counters.frames_throttled++;
 			return 0;
+		}
 
 		DBG_OBJ(surface->frame_cb, "cancelled\n");
 		wl_callback_destroy(surface->frame_cb);
@@ -4104,41 +5333,442 @@ surface_redraw(struct surface *surface)
 	}
 
 	surface->frame_cb = wl_surface_frame(surface->surface);
+	display_count_request(surface->window->display, &wl_surface_interface,
+			      WL_SURFACE_FRAME);
 	wl_callback_add_listener(surface->frame_cb, &listener, surface);
 	DBG_OBJ(surface->frame_cb, "new\n");
 
 	surface->redraw_needed = 0;
-	DBG_OBJ(surface->surface, "-> widget_redraw\n");
-	widget_redraw(surface->widget);
-	DBG_OBJ(surface->surface, "done\n");
-	return 0;
+	return 1;
 }
 
 static void
-idle_redraw(struct task *task, uint32_t events)
+window_queue_paint(struct window *window, struct surface *surface)
 {
-	struct window *window = container_of(task, struct window, redraw_task);
-	struct surface *surface;
-	int failed = 0;
-	int resized = 0;
+	if (window->paint_count == window->paint_size) {
+		window->paint_size = window->paint_size ?
+			window->paint_size * 2 : 4;
+		window->paint_surfaces =
+			xrealloc((char *) window->paint_surfaces,
+				 window->paint_size *
+				 sizeof *window->paint_surfaces);
+	}
 
-	DBG(" --------- \n");
+	window->paint_surfaces[window->paint_count++] = surface;
 
-	wl_list_init(&window->redraw_task.link);
-	window->redraw_task_scheduled = 0;
+	/* EGL surfaces have their context on the main thread, and only
+	 * cairo drawing can be recorded for the render thread */
+	if (surface->buffer_type != WINDOW_BUFFER_TYPE_SHM ||
+	    !surface->widget->use_cairo)
+		window->paint_inline = 1;
+	/* Get the buffer here, so the painter never creates protocol objects */
+	else if (window->display->render_thread)
+		widget_get_cairo_surface(surface->widget);
+}
+
+/*
+ * With TOYTOOLKIT_TILE_THREADS=n, large shm surfaces are painted in
+ * horizontal bands by a pool of n threads, 0 meaning one per core up
+ * to TILE_DEFAULT_MAX_THREADS. Each band runs all the redraw handlers,
+ * with widget_cairo_create() contexts on an image surface of its own
+ * over the band's rows of the buffer, as cairo surfaces cannot be
+ * drawn to from several threads. The handlers must then only draw:
+ * this is off by default, and the pool is only started the first time
+ * such a surface is painted. It is not used for the recordings the
+ * render thread replays, which cairo cannot replay from several
+ * threads at once.
+ */
+#define TILE_MIN_PIXELS (1024 * 1024)
+#define TILE_DEFAULT_MAX_THREADS 8
+
+static struct tile_pool *
+display_get_tile_pool(struct display *display)
+{
+	const char *env;
+	long threads;
+
+	if (display->tile_pool || display->tile_pool_disabled)
+		return display->tile_pool;
+
+	env = getenv("TOYTOOLKIT_TILE_THREADS");
+	threads = env ? strtol(env, NULL, 10) : 1;
+	if (threads == 0) {
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+		if (threads > TILE_DEFAULT_MAX_THREADS)
+			threads = TILE_DEFAULT_MAX_THREADS;
+	}
+
+	if (threads > 1)
+		display->tile_pool = tile_pool_create(threads);
+	if (!display->tile_pool)
+		display->tile_pool_disabled = 1;
+
+	return display->tile_pool;
+}
+
+static void
+surface_paint_tile(const cairo_rectangle_int_t *tile, void *data)
+{
+	struct surface *surface = data;
+	cairo_surface_t *target = surface->cairo_surface;
+	int stride = cairo_image_surface_get_stride(target);
+
+	paint_target = cairo_image_surface_create_for_data(
+		cairo_image_surface_get_data(target) + tile->y * stride,
+		cairo_image_surface_get_format(target),
+		tile->width, tile->height, stride);
+	cairo_surface_set_device_offset(paint_target, 0, -tile->y);
+	paint_target_surface = surface;
+
+	widget_redraw(surface->widget);
+
+	cairo_surface_destroy(paint_target);
+	paint_target = NULL;
+	paint_target_surface = NULL;
+}
+
+static void
+surface_paint(struct surface *surface)
+{
+	struct tile_pool *pool;
+	cairo_surface_t *cairo_surface = NULL;
+	int width, height;
+
+	DBG_OBJ(surface->surface, "-> widget_redraw\n");
+
+	if (surface == surface->window->main_surface &&
+	    surface->buffer_type == WINDOW_BUFFER_TYPE_SHM &&
+	    surface->widget->use_cairo)
+		cairo_surface = widget_get_cairo_surface(surface->widget);
+
+	if (cairo_surface &&
+	    cairo_surface_get_type(cairo_surface) == CAIRO_SURFACE_TYPE_IMAGE) {
+		width = cairo_image_surface_get_width(cairo_surface);
+		height = cairo_image_surface_get_height(cairo_surface);
+
+		if (width * height >= TILE_MIN_PIXELS &&
+		    (pool = display_get_tile_pool(surface->window->display))) {
+			/* The bands write to its memory behind its back */
+			cairo_surface_flush(cairo_surface);
+			tile_pool_run(pool, width, height,
+				      surface_paint_tile, surface);
+			cairo_surface_mark_dirty(cairo_surface);
+			return;
+		}
+	}
+
+	widget_redraw(surface->widget);
+}
+
+/*
+ * Run the redraw handlers of a surface into a recording, which cairo
+ * can replay on another thread: the commands are copied and the source
+ * surfaces snapshotted, so the widgets may change meanwhile.
+ */
+static void
+surface_record(struct surface *surface)
+{
+	surface->recording =
+		cairo_recording_surface_create(CAIRO_CONTENT_COLOR_ALPHA,
+					       NULL);
+	paint_target = surface->recording;
+	paint_target_surface = surface;
+
+	widget_redraw(surface->widget);
+
+	paint_target = NULL;
+	paint_target_surface = NULL;
+}
+
+/* Rasterize the recording into the buffer; runs on the render thread */
+static void
+surface_replay(struct surface *surface)
+{
+	cairo_t *cr;
+
+	/* The handlers paint the whole buffer, the recording replaces it */
+	cr = cairo_create(surface->cairo_surface);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(cr, surface->recording, 0, 0);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+	cairo_surface_flush(surface->cairo_surface);
+}
+
+/* Paint the queued surfaces; may run on the render thread */
+static void
+window_paint(struct window *window)
+{
+	struct surface *surface;
+	int i;
+
+	for (i = 0; i < window->paint_count; i++) {
+		surface = window->paint_surfaces[i];
+		if (surface->recording)
+			surface_replay(surface);
+		else
+			surface_paint(surface);
+	}
+}
+
+/*
+ * On the main thread: destroying a recording detaches its snapshots
+ * from their source surfaces, which the main thread keeps drawing from.
+ */
+static void
+window_release_recordings(struct window *window)
+{
+	struct surface *surface;
+	int i;
+
+	for (i = 0; i < window->paint_count; i++) {
+		surface = window->paint_surfaces[i];
+		if (surface->recording) {
+			cairo_surface_destroy(surface->recording);
+			surface->recording = NULL;
+		}
+	}
+}
+
+static void
+window_redraw_finish(struct window *window, int resized, int failed)
+{
+	struct surface *surface;
+
+	/* Counted once painted, which the render thread does later */
+	window->display->counters.frames_rendered += window->paint_count;
+	window->paint_count = 0;
+	window_flush(window);
+
+	wl_list_for_each(surface, &window->subsurface_list, link)
+		surface_set_synchronized_default(surface);
+
+	if (resized && failed) {
+		/* Restore widget tree to correspond to what is on screen. */
+		undo_resize(window);
+	}
+}
+
+/*
+ * TOYTOOLKIT_RENDER_THREAD=1 moves the painting of shm surfaces to a
+ * render thread. The main thread prepares the buffers and frame
+ * callbacks, runs the redraw handlers into cairo recordings, hands the
+ * window over through a lock-free queue, and attaches and commits once
+ * the window comes back on the other one. The render thread only
+ * rasterizes the recordings into the buffers, so input, timers and
+ * protocol events keep being dispatched meanwhile and may change any
+ * widget state; only that window waits for the paint to redraw again.
+ * TRACE_REDRAW, frames_rendered and the redraw statistics are
+ * accounted once the window comes back.
+ */
+struct render_thread {
+	struct display *display;
+	pthread_t thread;
+	struct spsc_queue jobs;		/* main thread -> render thread */
+	struct spsc_queue done;		/* render thread -> main thread */
+	int job_fd;
+	int done_fd;
+	struct task done_task;
+	int in_flight;
+};
+
+static void *
+render_thread_main(void *data)
+{
+	struct render_thread *rt = data;
+	struct window *window;
+	uint64_t n, allocs;
+
+	for (;;) {
+		if (read(rt->job_fd, &n, sizeof n) != sizeof n)
+			continue;
+
+		while ((window = spsc_queue_pop(&rt->jobs))) {
+			/* The render thread itself is the stop request */
+			if ((void *) window == (void *) rt)
+				return NULL;
+
+			allocs = alloc_count;
+			window_paint(window);
+			window->render_allocs = alloc_count - allocs;
+
+			while (spsc_queue_push(&rt->done, window) < 0)
+				sched_yield();
+			n = 1;
+			if (write(rt->done_fd, &n, sizeof n) != sizeof n)
+				fprintf(stderr, "render thread: %m\n");
+		}
+	}
+}
+
+static void
+render_thread_submit(struct render_thread *rt, void *job)
+{
+	uint64_t n = 1;
+
+	while (spsc_queue_push(&rt->jobs, job) < 0)
+		sched_yield();
+	if (write(rt->job_fd, &n, sizeof n) != sizeof n)
+		fprintf(stderr, "render thread: %m\n");
+}
+
+/* Attach and commit what the render thread has finished */
+static void
+render_thread_collect(struct render_thread *rt)
+{
+	struct window *window;
+	uint64_t n, allocs;
+
+	if (read(rt->done_fd, &n, sizeof n) != sizeof n && errno != EAGAIN)
+		return;
+
+	while ((window = spsc_queue_pop(&rt->done))) {
+		rt->in_flight--;
+		window->render_in_flight = 0;
+		allocs = alloc_count;
+		window_release_recordings(window);
+		window_redraw_finish(window, window->render_resized, 0);
+		window->redraw_allocs += alloc_count - allocs;
+		window_redraw_end_stats(window);
+	}
+}
+
+static void
+handle_render_done(struct task *task, uint32_t events)
+{
+	struct render_thread *rt =
+		container_of(task, struct render_thread, done_task);
+	struct window *window;
+
+	render_thread_collect(rt);
+
+	wl_list_for_each(window, &rt->display->window_list, link) {
+		if (window->redraw_after_render && !window->render_in_flight) {
+			window->redraw_after_render = 0;
+			window_schedule_redraw_task(window);
+		}
+	}
+}
+
+/* Wait for the render thread to hand everything back */
+static void
+display_finish_render(struct display *display)
+{
+	struct render_thread *rt = display->render_thread;
+	struct pollfd pfd;
+
+	if (!rt)
+		return;
+
+	pfd.fd = rt->done_fd;
+	pfd.events = POLLIN;
+	while (rt->in_flight) {
+		poll(&pfd, 1, -1);
+		render_thread_collect(rt);
+	}
+}
+
+static void
+display_create_render_thread(struct display *display)
+{
+	struct render_thread *rt;
+
+	rt = xzalloc(sizeof *rt);
+	rt->display = display;
+	rt->job_fd = eventfd(0, EFD_CLOEXEC);
+	rt->done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (rt->job_fd < 0 || rt->done_fd < 0 ||
+	    spsc_queue_init(&rt->jobs, 4) < 0 ||
+	    spsc_queue_init(&rt->done, 4) < 0)
+		goto err;
+
+	if (pthread_create(&rt->thread, NULL, render_thread_main, rt) != 0)
+		goto err;
+
+	rt->done_task.run = handle_render_done;
+	display_watch_fd(display, rt->done_fd, EPOLLIN, &rt->done_task);
+
+	display->render_thread = rt;
+
+	return;
+
+err:
+	fprintf(stderr, "could not start the render thread: %m\n");
+	if (rt->job_fd >= 0)
+		close(rt->job_fd);
+	if (rt->done_fd >= 0)
+		close(rt->done_fd);
+	spsc_queue_release(&rt->jobs);
+	spsc_queue_release(&rt->done);
+	free(rt);
+}
+
+static void
+display_destroy_render_thread(struct display *display)
+{
+	struct render_thread *rt = display->render_thread;
+
+	display_finish_render(display);
+
+	render_thread_submit(rt, rt);
+	pthread_join(rt->thread, NULL);
+
+	display_unwatch_fd(display, rt->done_fd);
+	close(rt->job_fd);
+	close(rt->done_fd);
+	spsc_queue_release(&rt->jobs);
+	spsc_queue_release(&rt->done);
+	free(rt);
+	display->render_thread = NULL;
+}
+
+static void
+window_latch_paint_state(struct window *window)
+{
+	window->paint_frame_drawn = frame_is_drawn(window);
+
+	if (!window->frame)
+		return;
+
+	if (window->focused)
+		frame_set_flag(window->frame->frame, FRAME_FLAG_ACTIVE);
+	else
+		frame_unset_flag(window->frame->frame, FRAME_FLAG_ACTIVE);
+}
+
+static void
+window_redraw(struct window *window)
+{
+	struct surface *surface;
+	int failed = 0;
+	int resized = 0;
+	uint64_t start;
+	int i, ret;
+
+	DBG(" --------- \n");
 
 	if (window->resize_needed) {
 		/* throttle resizing to the main surface display */
 		if (window->main_surface->frame_cb) {
 			DBG_OBJ(window->main_surface->frame_cb, "pending\n");
+			window->display->counters.frames_throttled++;
 			return;
 		}
 
+		start = trace_now();
 		idle_resize(window);
+		trace_complete(TRACE_RESIZE, start,
+			       window->pending_allocation.width << 16 |
+			       window->pending_allocation.height);
 		resized = 1;
 	}
 
-	if (surface_redraw(window->main_surface) < 0) {
+	window->paint_count = 0;
+	window->paint_inline = 0;
+	window_latch_paint_state(window);
+
+	ret = surface_prepare_redraw(window->main_surface);
+	if (ret < 0) {
 		/*
 		 * Only main_surface failure will cause us to undo the resize.
 		 * If sub-surfaces fail, they will just be broken with old
@@ -4146,24 +5776,101 @@ idle_redraw(struct task *task, uint32_t events)
 		 */
 		failed = 1;
 	} else {
+		if (ret > 0)
+			window_queue_paint(window, window->main_surface);
+
 		wl_list_for_each(surface, &window->subsurface_list, link) {
 			if (surface == window->main_surface)
 				continue;
 
-			surface_redraw(surface);
+			if (surface_prepare_redraw(surface) > 0)
+				window_queue_paint(window, surface);
 		}
 	}
 
 	window->redraw_needed = 0;
-	window_flush(window);
 
-	wl_list_for_each(surface, &window->subsurface_list, link)
-		surface_set_synchronized_default(surface);
+	if (window->display->render_thread && window->paint_count > 0 &&
+	    !window->paint_inline) {
+		for (i = 0; i < window->paint_count; i++)
+			surface_record(window->paint_surfaces[i]);
 
-	if (resized && failed) {
-		/* Restore widget tree to correspond to what is on screen. */
-		undo_resize(window);
+		window->render_resized = resized;
+		window->render_in_flight = 1;
+		window->display->render_thread->in_flight++;
+		render_thread_submit(window->display->render_thread, window);
+		return;
+	}
+
+	window_paint(window);
+	window_redraw_finish(window, resized, failed);
+}
+
+static void
+window_redraw_begin_stats(struct window *window)
+{
+	struct rusage usage;
+
+	window->redraw_start = trace_now();
+	window->redraw_allocs = 0;
+	window->render_allocs = 0;
+
+	if (window->display->stats_enabled) {
+		getrusage(RUSAGE_SELF, &usage);
+		window->redraw_minflt_start = usage.ru_minflt;
+	}
+}
+
+/*
+ * Account for a redraw once its surfaces are committed: right after
+ * window_redraw(), or when the render thread hands the window back.
+ */
+static void
+window_redraw_end_stats(struct window *window)
+{
+	struct display *display = window->display;
+	struct rusage usage;
+
+	trace_complete(TRACE_REDRAW, window->redraw_start, 0);
+	display->counters.redraw_allocs +=
+		window->redraw_allocs + window->render_allocs;
+
+	if (!display->stats_enabled)
+		return;
+
+	getrusage(RUSAGE_SELF, &usage);
+	display->stats_redraws++;
+	display->stats_redraw_minflt +=
+		usage.ru_minflt - window->redraw_minflt_start;
+	display_end_traffic_cycle(display);
+}
+
+static void
+idle_redraw(struct task *task, uint32_t events)
+{
+	struct window *window = container_of(task, struct window, redraw_task);
+	struct display *display = window->display;
+	uint64_t allocs;
+
+	wl_list_init(&window->redraw_task.link);
+	window->redraw_task_scheduled = 0;
+
+	/* Picked up again when the render thread hands it back */
+	if (window->render_in_flight) {
+		window->redraw_after_render = 1;
+		return;
 	}
+
+	/* Replayed events are delivered from the main loop, after this */
+	if (display->input_replay)
+		input_replay_start(display->input_replay, window);
+
+	window_redraw_begin_stats(window);
+	allocs = alloc_count;
+	window_redraw(window);
+	window->redraw_allocs += alloc_count - allocs;
+	if (!window->render_in_flight)
+		window_redraw_end_stats(window);
 }
 
 static void
@@ -4374,6 +6081,8 @@ window_damage(struct window *window, int32_t x, int32_t y,
 	      int32_t width, int32_t height)
 {
 	wl_surface_damage(window->main_surface->surface, x, y, width, height);
+	display_count_request(window->display, &wl_surface_interface,
+			      WL_SURFACE_DAMAGE);
 }
 
 static void
@@ -4385,6 +6094,8 @@ surface_enter(void *data,
 	struct output *output_found = NULL;
 	struct window_output *window_output;
 
+	display_count_event(window->display, &wl_surface_interface);
+
 	wl_list_for_each(output, &window->display->output_list, link) {
 		if (output->output == wl_output) {
 			output_found = output;
@@ -4413,6 +6124,8 @@ surface_leave(void *data,
 	struct window_output *window_output;
 	struct window_output *window_output_found = NULL;
 
+	display_count_event(window->display, &wl_surface_interface);
+
 	wl_list_for_each(window_output, &window->window_output_list, link) {
 		if (window_output->output->output == output) {
 			window_output_found = window_output;
@@ -4790,6 +6503,26 @@ window_set_preferred_format(struct window *window,
 	window->preferred_format = format;
 }
 
+/* Must be called before window_frame_create() */
+void
+window_set_shadow(struct window *window, int shadow)
+{
+	window->no_shadow = !shadow;
+}
+
+/* Must be called before window_frame_create() */
+void
+window_set_compact_frame(struct window *window, int compact)
+{
+	window->compact_frame = compact;
+}
+
+void
+window_set_low_memory(struct window *window, int low_memory)
+{
+	window->low_memory = low_memory;
+}
+
 struct widget *
 window_add_subsurface(struct window *window, void *data,
 		      enum subsurface_mode default_mode)
@@ -5089,11 +6822,7 @@ display_add_input(struct display *d, uint32_t id)
 
 	input->pointer_surface = wl_compositor_create_surface(d->compositor);
 
-	input->repeat_timer_fd = timerfd_create(CLOCK_MONOTONIC,
-						TFD_CLOEXEC | TFD_NONBLOCK);
-	input->repeat_task.run = keyboard_repeat_func;
-	display_watch_fd(d, input->repeat_timer_fd,
-			 EPOLLIN, &input->repeat_task);
+	toytimer_init(&input->repeat_timer, d, keyboard_repeat_func);
 }
 
 static void
@@ -5124,7 +6853,7 @@ input_destroy(struct input *input)
 
 	wl_list_remove(&input->link);
 	wl_seat_destroy(input->seat);
-	close(input->repeat_timer_fd);
+	toytimer_fini(&input->repeat_timer);
 	free(input);
 }
 
@@ -5169,6 +6898,19 @@ static_assert(XDG_VERSION == XDG_SHELL_VERSION_CURRENT,
 	      "Interface version doesn't match implementation version");
 #endif
 
+static void
+presentation_clock_id(void *data, struct wp_presentation *presentation,
+		      uint32_t clk_id)
+{
+	struct display *display = data;
+
+	display->presentation_clock = clk_id;
+}
+
+static const struct wp_presentation_listener presentation_listener = {
+	presentation_clock_id
+};
+
 static void
 registry_handle_global(void *data, struct wl_registry *registry, uint32_t id,
 		       const char *interface, uint32_t version)
@@ -5208,6 +6950,23 @@ registry_handle_global(void *data, struct wl_registry *registry, uint32_t id,
 	} else if (strcmp(interface, "wl_shell") == 0) {
 		d->shell = wl_registry_bind(registry, id,
 					    &wl_shell_interface, 1);
+	} else if (strcmp(interface, "wp_presentation") == 0 &&
+		   d->stats_enabled) {
+		d->presentation =
+			wl_registry_bind(registry, id,
+					 &wp_presentation_interface, 1);
+		wp_presentation_add_listener(d->presentation,
+					     &presentation_listener, d);
+
+		/* Feedback is statistics only, keep it off the input path */
+		d->presentation_queue = wl_display_create_queue(d->display);
+		display_watch_queue(d, d->presentation_queue);
+	} else if (strcmp(interface,
+			  "org_kde_kwin_server_decoration_manager") == 0) {
+		d->server_decoration_manager =
+			wl_registry_bind(registry, id,
+				&org_kde_kwin_server_decoration_manager_interface,
+				1);
 	} else if (strcmp(interface, "text_cursor_position") == 0) {
 		d->text_cursor_position =
 			wl_registry_bind(registry, id,
@@ -5258,6 +7017,24 @@ display_bind(struct display *display, uint32_t name,
 	return wl_registry_bind(display->registry, name, interface, version);
 }
 
+void *
+display_bind_interface(struct display *display,
+		       const struct wl_interface *interface, uint32_t version)
+{
+	struct global *global;
+
+	wl_list_for_each(global, &display->global_list, link) {
+		if (strcmp(global->interface, interface->name) != 0)
+			continue;
+		if (global->version < version)
+			version = global->version;
+		return wl_registry_bind(display->registry, global->name,
+					interface, version);
+	}
+
+	return NULL;
+}
+
 static const struct wl_registry_listener registry_listener = {
 	registry_handle_global,
 	registry_handle_global_remove
@@ -5358,24 +7135,107 @@ init_dummy_surface(struct display *display)
 	display->dummy_surface_data = data;
 }
 
-static void
-handle_display_data(struct task *task, uint32_t events)
+void
+display_watch_queue(struct display *display, struct wl_event_queue *queue)
 {
-	struct display *display =
-		container_of(task, struct display, display_task);
-	struct epoll_event ep;
-	int ret;
+	struct wl_event_queue **p;
 
-	display->display_fd_events = events;
+	p = wl_array_add(&display->queues, sizeof *p);
+	*p = queue;
+}
+
+void
+display_unwatch_queue(struct display *display, struct wl_event_queue *queue)
+{
+	struct wl_event_queue **p, **last;
+
+	last = (struct wl_event_queue **)
+		((char *) display->queues.data + display->queues.size) - 1;
+	wl_array_for_each(p, &display->queues) {
+		if (*p == queue) {
+			*p = *last;
+			display->queues.size -= sizeof *p;
+			return;
+		}
+	}
+}
+
+/*
+ * Seat events are dispatched from a task of their own, so that they
+ * run before the redraws queued at lower priority, even while the
+ * render thread paints.
+ */
+static void
+handle_input(struct task *task, uint32_t events)
+{
+	struct display *display =
+		container_of(task, struct display, input_task);
+
+	display->input_task_scheduled = 0;
+
+	wl_display_dispatch_queue_pending(display->display,
+					  display->input_queue);
+}
+
+static void
+display_schedule_input(struct display *display)
+{
+	if (display->input_task_scheduled)
+		return;
+
+	display_defer_priority(display, &display->input_task,
+			       TASK_PRIORITY_INPUT);
+	display->input_task_scheduled = 1;
+}
+
+/*
+ * Dispatch what has been read for the toolkit and the watched queues;
+ * the input queue is left to the input task.
+ */
+static int
+display_dispatch_pending(struct display *display)
+{
+	struct wl_event_queue **queue;
+	uint64_t start;
+	int ret;
+
+	start = trace_now();
+	ret = wl_display_dispatch_queue_pending(display->display,
+						display->queue);
+	trace_complete(TRACE_DISPATCH, start, ret);
+	if (ret < 0)
+		return ret;
+
+	wl_array_for_each(queue, &display->queues) {
+		ret = wl_display_dispatch_queue_pending(display->display,
+							*queue);
+		if (ret < 0)
+			return ret;
+	}
+
+	display_schedule_input(display);
+
+	return 0;
+}
+
+static void
+handle_display_data(struct task *task, uint32_t events)
+{
+	struct display *display =
+		container_of(task, struct display, display_task);
+	struct epoll_event ep;
+	int ret;
+
+	display->display_fd_events = events;
 
 	if (events & EPOLLERR || events & EPOLLHUP) {
 		display_exit(display);
 		return;
 	}
 
+	/* display_run() has already read the events */
 	if (events & EPOLLIN) {
-		ret = wl_display_dispatch(display->display);
-		if (ret == -1) {
+		if (display_dispatch_pending(display) < 0) {
 			display_exit(display);
 			return;
 		}
@@ -5401,23 +7261,271 @@ log_handler(const char *format, va_list args)
 	vfprintf(stderr, format, args);
 }
 
+static void
+display_print_counters(struct display *display, FILE *fp)
+{
+	struct counters *c = &display->counters;
+
+	fprintf(fp, "toytoolkit counters: pid=%d frames_rendered=%llu "
+		"frames_throttled=%llu bytes_damaged=%llu bytes_attached=%llu "
+		"shm_pools_created=%llu shm_bytes_mapped=%llu "
+		"buffers_held=%llu mallocs_per_frame=%.2f loop_wakeups=%llu\n",
+		getpid(),
+		(unsigned long long) c->frames_rendered,
+		(unsigned long long) c->frames_throttled,
+		(unsigned long long) c->bytes_damaged,
+		(unsigned long long) c->bytes_attached,
+		(unsigned long long) c->shm_pools_created,
+		(unsigned long long) c->shm_bytes_mapped,
+		(unsigned long long) c->buffers_held,
+		c->frames_rendered ?
+		(double) c->redraw_allocs / c->frames_rendered : 0.0,
+		(unsigned long long) c->loop_wakeups);
+}
+
+static void
+display_print_traffic(struct display *display, FILE *fp)
+{
+	struct protocol_traffic *total = &display->traffic_total;
+	double redraws = display->stats_redraws ? display->stats_redraws : 1;
+	int i;
+
+	for (i = 0; i < TRAFFIC_CLASS_COUNT; i++) {
+		if (!total->requests[i] && !total->events[i])
+			continue;
+
+		fprintf(fp, "toytoolkit stats: %-14s %6u requests "
+			"(%.1f/redraw, max %u), %8llu bytes, %6u events\n",
+			traffic_interfaces[i]->name, total->requests[i],
+			total->requests[i] / redraws,
+			display->traffic_max_requests[i],
+			(unsigned long long) total->bytes[i],
+			total->events[i]);
+	}
+}
+
+static void
+display_print_stats(struct display *display, FILE *fp)
+{
+	struct rusage usage;
+
+	getrusage(RUSAGE_SELF, &usage);
+
+	fprintf(fp, "toytoolkit stats: %u redraws, "
+		"%ld minor faults while redrawing (shm prefault %s)\n",
+		display->stats_redraws, display->stats_redraw_minflt,
+		display->shm_prefault ? "on" : "off");
+	fprintf(fp, "toytoolkit stats: shm peak %zu bytes, "
+		"%u extra buffers grown, max rss %ld kB\n",
+		display->stats_shm_peak,
+		display->stats_shm_extra_leaves, usage.ru_maxrss);
+	fprintf(fp, "toytoolkit stats: %llu shm pixels attached\n",
+		(unsigned long long) display->stats_shm_attached_pixels);
+
+	display_print_traffic(display, fp);
+
+	if (!display->presentation)
+		return;
+
+	fprintf(fp, "toytoolkit stats: %u frames discarded\n",
+		display->stats_discarded);
+	latency_histogram_print(&display->commit_latency, "commit", fp);
+	latency_histogram_print(&display->input_latency, "input", fp);
+}
+
+/*
+ * The event trace goes to TOYTOOLKIT_TRACE_FILE if set, and otherwise
+ * to a per-process file in XDG_RUNTIME_DIR.
+ */
+static void
+display_dump_trace(struct display *display)
+{
+	const char *path = getenv("TOYTOOLKIT_TRACE_FILE");
+	const char *dir;
+	char *buf = NULL;
+
+	if (!path) {
+		dir = getenv("XDG_RUNTIME_DIR");
+		if (asprintf(&buf, "%s/toytoolkit-trace-%d.json",
+			     dir ? dir : "/tmp", getpid()) < 0)
+			return;
+		path = buf;
+	}
+
+	if (trace_dump_file(path) < 0)
+		fprintf(stderr, "failed to write trace to %s: %m\n", path);
+	else
+		fprintf(stderr, "toytoolkit: trace written to %s\n", path);
+
+	free(buf);
+}
+
+static void
+trace_dump_func(struct task *task, uint32_t events)
+{
+	struct display *display =
+		container_of(task, struct display, trace_dump_task);
+
+	display->trace_dump_pending = 0;
+	display_dump_trace(display);
+}
+
+static void
+handle_signal(struct task *task, uint32_t events)
+{
+	struct display *display =
+		container_of(task, struct display, signal_task);
+	struct signalfd_siginfo info;
+
+	while (read(display->signal_fd, &info, sizeof info) == sizeof info) {
+		if (info.ssi_signo == SIGUSR1) {
+			display_print_counters(display, stderr);
+			if (display->stats_enabled)
+				display_print_stats(display, stderr);
+		} else if (info.ssi_signo == SIGUSR2 &&
+			   !display->trace_dump_pending) {
+			/* Writing the file can wait for a quiet moment */
+			display->trace_dump_task.run = trace_dump_func;
+			display_defer_priority(display,
+					       &display->trace_dump_task,
+					       TASK_PRIORITY_BACKGROUND);
+			display->trace_dump_pending = 1;
+		}
+	}
+}
+
+void
+display_watch_signals(struct display *display)
+{
+	sigset_t mask;
+
+	if (display->signal_fd >= 0)
+		return;
+
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGUSR1);
+	sigaddset(&mask, SIGUSR2);
+
+	display->signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+	if (display->signal_fd < 0) {
+		fprintf(stderr, "signalfd failed: %m\n");
+		return;
+	}
+
+	pthread_sigmask(SIG_BLOCK, &mask, &display->signal_saved_mask);
+
+	display->signal_task.run = handle_signal;
+	display_watch_fd(display, display->signal_fd, EPOLLIN,
+			 &display->signal_task);
+}
+
+static void
+display_unwatch_signals(struct display *display)
+{
+	struct signalfd_siginfo info;
+	sigset_t mask;
+
+	if (display->signal_fd < 0)
+		return;
+
+	/* Drop what is pending, or unblocking it would kill the process */
+	while (read(display->signal_fd, &info, sizeof info) == sizeof info)
+		;
+
+	display_unwatch_fd(display, display->signal_fd);
+	close(display->signal_fd);
+	display->signal_fd = -1;
+
+	sigemptyset(&mask);
+	if (!sigismember(&display->signal_saved_mask, SIGUSR1))
+		sigaddset(&mask, SIGUSR1);
+	if (!sigismember(&display->signal_saved_mask, SIGUSR2))
+		sigaddset(&mask, SIGUSR2);
+	pthread_sigmask(SIG_UNBLOCK, &mask, NULL);
+}
+
+/* Made by display_preload(), taken by the next display_create() */
+static struct theme *preloaded_theme;
+
+void
+display_preload(void)
+{
+	static const struct {
+		cairo_font_weight_t weight;
+		double size;
+	} fonts[] = {
+		{ CAIRO_FONT_WEIGHT_BOLD, 14 },		/* frame title */
+		{ CAIRO_FONT_WEIGHT_NORMAL, 12 },	/* tooltips */
+		{ CAIRO_FONT_WEIGHT_NORMAL, 14 },
+		{ CAIRO_FONT_WEIGHT_NORMAL, 18 },
+	};
+	char ascii[96];
+	cairo_text_extents_t extents;
+	cairo_surface_t *surface;
+	cairo_t *cr;
+	unsigned int i;
+
+	if (!preloaded_theme)
+		preloaded_theme = theme_create();
+	frame_preload_icons();
+
+	/* Get fontconfig set up and the glyph metrics of the usual faces cached */
+	for (i = 0; i < sizeof ascii - 1; i++)
+		ascii[i] = ' ' + i;
+	ascii[i] = '\0';
+
+	surface = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, 1, 1);
+	cr = cairo_create(surface);
+	for (i = 0; i < ARRAY_LENGTH(fonts); i++) {
+		cairo_select_font_face(cr, "sans", CAIRO_FONT_SLANT_NORMAL,
+				       fonts[i].weight);
+		cairo_set_font_size(cr, fonts[i].size);
+		cairo_text_extents(cr, ascii, &extents);
+	}
+	cairo_destroy(cr);
+	cairo_surface_destroy(surface);
+}
+
 struct display *
 display_create(int *argc, char *argv[])
 {
+	struct wl_display *wl_display;
 	struct display *d;
 
 	wl_log_set_handler_client(log_handler);
 
-	d = zalloc(sizeof *d);
-	if (d == NULL)
-		return NULL;
+	if (getenv("TOYTOOLKIT_TRACE_STARTUP"))
+		startup_trace_enable(strcmp(getenv("TOYTOOLKIT_TRACE_STARTUP"),
+					    "json") == 0);
 
-	d->display = wl_display_connect(NULL);
-	if (d->display == NULL) {
+	wl_display = wl_display_connect(NULL);
+	if (wl_display == NULL) {
 		fprintf(stderr, "failed to connect to Wayland display: %m\n");
-		free(d);
 		return NULL;
 	}
+	startup_trace_phase("wl_display_connect");
+
+	d = display_create_for_wl_display(wl_display);
+	if (d == NULL) {
+		wl_display_disconnect(wl_display);
+		return NULL;
+	}
+	d->own_connection = 1;
+
+	return d;
+}
+
+struct display *
+display_create_for_wl_display(struct wl_display *wl_display)
+{
+	struct display *d;
+	int i;
+
+	d = zalloc(sizeof *d);
+	if (d == NULL)
+		return NULL;
+
+	d->display = wl_display;
 
 	d->xkb_context = xkb_context_new(0);
 	if (d->xkb_context == NULL) {
@@ -5426,41 +7534,90 @@ display_create(int *argc, char *argv[])
 		return NULL;
 	}
 
+	d->queue = wl_display_create_queue(d->display);
+	d->display_wrapper = wl_proxy_create_wrapper(d->display);
+	wl_proxy_set_queue((struct wl_proxy *) d->display_wrapper, d->queue);
+
 	d->epoll_fd = os_epoll_create_cloexec();
 	d->display_fd = wl_display_get_fd(d->display);
 	d->display_task.run = handle_display_data;
 	display_watch_fd(d, d->display_fd, EPOLLIN | EPOLLERR | EPOLLHUP,
 			 &d->display_task);
 
-	wl_list_init(&d->deferred_list);
+	d->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+				     TFD_CLOEXEC | TFD_NONBLOCK);
+	d->timer_task.run = handle_timers;
+	display_watch_fd(d, d->timer_fd, EPOLLIN, &d->timer_task);
+	wl_list_init(&d->expired_timers);
+	toytimer_init(&d->timeout_timer, d, handle_timeout);
+
+	for (i = 0; i < TASK_PRIORITY_COUNT; i++)
+		wl_list_init(&d->deferred_list[i]);
 	wl_list_init(&d->input_list);
 	wl_list_init(&d->output_list);
 	wl_list_init(&d->global_list);
+	wl_list_init(&d->window_list);
+	wl_array_init(&d->queues);
+
+	d->input_queue = wl_display_create_queue(d->display);
+	d->input_task.run = handle_input;
 
 	d->timeout = 0;
 
+	d->shm_prefault = getenv("TOYTOOLKIT_SHM_PREFAULT") != NULL;
+	d->stats_enabled = getenv("TOYTOOLKIT_STATS") != NULL;
+	d->stats_protocol = d->stats_enabled &&
+		strcmp(getenv("TOYTOOLKIT_STATS"), "protocol") == 0;
+
+	d->presentation_clock = CLOCK_MONOTONIC;
+	wl_list_init(&d->presentation_list);
+
+	/* Signal masks are inherited by child processes, see window.h */
+	d->signal_fd = -1;
+	if (getenv("TOYTOOLKIT_SIGNALS") || d->stats_enabled ||
+	    getenv("TOYTOOLKIT_TRACE_FILE"))
+		display_watch_signals(d);
+
+	if (getenv("TOYTOOLKIT_INPUT_RECORD")) {
+		d->input_record = fopen(getenv("TOYTOOLKIT_INPUT_RECORD"), "w");
+		if (!d->input_record)
+			fprintf(stderr, "could not open input recording: %m\n");
+	}
+	d->input_replay = input_replay_create(d);
+
+	if (getenv("TOYTOOLKIT_RENDER_THREAD"))
+		display_create_render_thread(d);
+
 	d->workspace = 0;
 	d->workspace_count = 1;
 
-	d->registry = wl_display_get_registry(d->display);
+	d->registry = wl_display_get_registry(d->display_wrapper);
 	wl_registry_add_listener(d->registry, &registry_listener, d);
 
-	if (wl_display_dispatch(d->display) < 0) {
+	if (wl_display_roundtrip_queue(d->display, d->queue) < 0) {
 		fprintf(stderr, "Failed to process Wayland connection: %m\n");
+		display_destroy(d);
 		return NULL;
 	}
+	startup_trace_phase("registry_dispatch");
 
 #ifdef HAVE_CAIRO_EGL
 	if (init_egl(d) < 0)
 		fprintf(stderr, "EGL does not seem to work, "
 			"falling back to software rendering and wl_shm.\n");
+	startup_trace_phase("init_egl");
 #endif
 
 	create_cursors(d);
+	startup_trace_phase("create_cursors");
 
-	d->theme = theme_create();
-
-	wl_list_init(&d->window_list);
+	if (preloaded_theme) {
+		d->theme = preloaded_theme;
+		preloaded_theme = NULL;
+	} else {
+		d->theme = theme_create();
+	}
+	startup_trace_phase("theme_create");
 
 	init_dummy_surface(d);
 
@@ -5490,23 +7647,66 @@ display_destroy_inputs(struct display *display)
 void
 display_destroy(struct display *display)
 {
+	int i;
+
 	if (!wl_list_empty(&display->window_list))
 		fprintf(stderr, "toytoolkit warning: %d windows exist.\n",
 			wl_list_length(&display->window_list));
 
-	if (!wl_list_empty(&display->deferred_list))
-		fprintf(stderr, "toytoolkit warning: deferred tasks exist.\n");
+	if (display->input_task_scheduled)
+		wl_list_remove(&display->input_task.link);
+
+	for (i = 0; i < TASK_PRIORITY_COUNT; i++)
+		if (!wl_list_empty(&display->deferred_list[i]))
+			fprintf(stderr, "toytoolkit warning: deferred tasks "
+				"exist.\n");
+
+	if (display->stats_enabled)
+		display_print_stats(display, stderr);
+
+	if (getenv("TOYTOOLKIT_TRACE_FILE"))
+		display_dump_trace(display);
+
+	if (display->input_replay)
+		input_replay_destroy(display->input_replay);
+	if (display->input_record)
+		fclose(display->input_record);
+
+	while (!wl_list_empty(&display->presentation_list))
+		presentation_feedback_destroy(
+			container_of(display->presentation_list.next,
+				     struct presentation_feedback, link));
+
+	if (display->presentation_queue) {
+		display_unwatch_queue(display, display->presentation_queue);
+		wl_event_queue_destroy(display->presentation_queue);
+	}
+	wl_array_release(&display->queues);
+
+	display_unwatch_signals(display);
+
+	toytimer_fini(&display->timeout_timer);
 
 	cairo_surface_destroy(display->dummy_surface);
 	free(display->dummy_surface_data);
 
 	display_destroy_outputs(display);
 	display_destroy_inputs(display);
+	wl_event_queue_destroy(display->input_queue);
+
+	if (display->render_thread)
+		display_destroy_render_thread(display);
+
+	if (display->tile_pool)
+		tile_pool_destroy(display->tile_pool);
 
 	xkb_context_unref(display->xkb_context);
 
-	theme_destroy(display->theme);
-	destroy_cursors(display);
+	/* Not there yet when display creation failed */
+	if (display->theme)
+		theme_destroy(display->theme);
+	if (display->cursor_theme)
+		destroy_cursors(display);
 
 #ifdef HAVE_CAIRO_EGL
 	if (display->argb_device)
@@ -5519,6 +7719,13 @@ display_destroy(struct display *display)
 	if (display->xdg_shell)
 		xdg_shell_destroy(display->xdg_shell);
 
+	if (display->server_decoration_manager)
+		org_kde_kwin_server_decoration_manager_destroy(
+			display->server_decoration_manager);
+
+	if (display->presentation)
+		wp_presentation_destroy(display->presentation);
+
 	if (display->shell)
 		wl_shell_destroy(display->shell);
 
@@ -5528,16 +7735,22 @@ display_destroy(struct display *display)
 	if (display->data_device_manager)
 		wl_data_device_manager_destroy(display->data_device_manager);
 
-	wl_compositor_destroy(display->compositor);
+	if (display->compositor)
+		wl_compositor_destroy(display->compositor);
 	wl_registry_destroy(display->registry);
+	wl_proxy_wrapper_destroy(display->display_wrapper);
+	wl_event_queue_destroy(display->queue);
 
+	close(display->timer_fd);
+	free(display->timers);
 	close(display->epoll_fd);
 
 	if (!(display->display_fd_events & EPOLLERR) &&
 	    !(display->display_fd_events & EPOLLHUP))
 		wl_display_flush(display->display);
 
-	wl_display_disconnect(display->display);
+	if (display->own_connection)
+		wl_display_disconnect(display->display);
 	free(display);
 }
 
@@ -5577,7 +7790,9 @@ display_has_subcompositor(struct display *display)
 	if (display->subcompositor)
 		return 1;
 
-	wl_display_roundtrip(display->display);
+	wl_display_roundtrip_queue(display->display, display->queue);
+	/* The roundtrip may have read seat events too */
+	display_schedule_input(display);
 
 	return display->subcompositor != NULL;
 }
@@ -5653,10 +7868,71 @@ display_release_window_surface(struct display *display,
 	surface->toysurface->release(surface->toysurface);
 }
 
+void
+display_defer_priority(struct display *display, struct task *task,
+		       enum task_priority priority)
+{
+	wl_list_insert(&display->deferred_list[priority], &task->link);
+}
+
 void
 display_defer(struct display *display, struct task *task)
 {
-	wl_list_insert(&display->deferred_list, &task->link);
+	display_defer_priority(display, task, TASK_PRIORITY_REDRAW);
+}
+
+/* Time given to background tasks per main loop iteration */
+#define BACKGROUND_BUDGET_NS 2000000
+
+static void
+display_run_task(struct display *display, enum task_priority priority)
+{
+	struct wl_list *list = &display->deferred_list[priority];
+	struct task *task;
+	uint64_t start;
+
+	task = container_of(list->prev, struct task, link);
+	wl_list_remove(&task->link);
+	start = trace_now();
+	task->run(task, 0);
+	trace_complete(TRACE_TASK_DEFERRED, start, priority);
+}
+
+/*
+ * Run the deferred tasks, always picking one from the highest priority
+ * list which has any, since a task may defer another. Background tasks
+ * stop when their budget is spent or something more urgent is queued.
+ * Returns whether background tasks are left over.
+ */
+static int
+display_run_deferred(struct display *display)
+{
+	struct wl_list *background =
+		&display->deferred_list[TASK_PRIORITY_BACKGROUND];
+	uint64_t deadline = 0;
+	int priority;
+
+	for (;;) {
+		for (priority = 0; priority < TASK_PRIORITY_BACKGROUND;
+		     priority++)
+			if (!wl_list_empty(&display->deferred_list[priority]))
+				break;
+
+		if (priority < TASK_PRIORITY_BACKGROUND) {
+			display_run_task(display, priority);
+			continue;
+		}
+
+		if (wl_list_empty(background))
+			return 0;
+
+		if (!deadline)
+			deadline = trace_now() + BACKGROUND_BUDGET_NS;
+		else if (trace_now() >= deadline)
+			return 1;
+
+		display_run_task(display, TASK_PRIORITY_BACKGROUND);
+	}
 }
 
 void
@@ -5676,56 +7952,379 @@ display_unwatch_fd(struct display *display, int fd)
 	epoll_ctl(display->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
 }
 
+/* Timers expiring this close to each other share a wakeup */
+#define TOYTIMER_SLACK_NS 1000000
+
+static void
+timer_heap_swap(struct display *display, int a, int b)
+{
+	struct toytimer *tmp = display->timers[a];
+
+	display->timers[a] = display->timers[b];
+	display->timers[b] = tmp;
+	display->timers[a]->index = a;
+	display->timers[b]->index = b;
+}
+
+static void
+timer_heap_up(struct display *display, int i)
+{
+	while (i > 0 && display->timers[(i - 1) / 2]->expire >
+	       display->timers[i]->expire) {
+		timer_heap_swap(display, i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+}
+
+static void
+timer_heap_down(struct display *display, int i)
+{
+	int child;
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= display->timer_count)
+			break;
+		if (child + 1 < display->timer_count &&
+		    display->timers[child + 1]->expire <
+		    display->timers[child]->expire)
+			child++;
+		if (display->timers[i]->expire <= display->timers[child]->expire)
+			break;
+		timer_heap_swap(display, i, child);
+		i = child;
+	}
+}
+
+static void
+timer_heap_insert(struct display *display, struct toytimer *timer)
+{
+	if (display->timer_count == display->timer_size) {
+		display->timer_size = display->timer_size ?
+			display->timer_size * 2 : 8;
+		display->timers = xrealloc((char *) display->timers,
+					   display->timer_size *
+					   sizeof *display->timers);
+	}
+
+	timer->index = display->timer_count++;
+	display->timers[timer->index] = timer;
+	timer_heap_up(display, timer->index);
+}
+
+static void
+timer_heap_remove(struct display *display, struct toytimer *timer)
+{
+	int i = timer->index;
+
+	timer->index = -1;
+	if (--display->timer_count == i)
+		return;
+
+	display->timers[i] = display->timers[display->timer_count];
+	display->timers[i]->index = i;
+	timer_heap_up(display, i);
+	timer_heap_down(display, display->timers[i]->index);
+}
+
+/* Point the timerfd at the earliest timer, if that changed */
+static void
+display_program_timers(struct display *display)
+{
+	struct itimerspec its;
+	uint64_t next = 0;
+
+	if (display->timers_dispatching)
+		return;
+
+	if (display->timer_count > 0)
+		next = display->timers[0]->expire;
+	if (next == display->timer_programmed)
+		return;
+
+	memset(&its, 0, sizeof its);
+	its.it_value.tv_sec = next / 1000000000;
+	its.it_value.tv_nsec = next % 1000000000;
+	timerfd_settime(display->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+	display->timer_programmed = next;
+}
+
+static void
+handle_timers(struct task *task, uint32_t events)
+{
+	struct display *display =
+		container_of(task, struct display, timer_task);
+	struct toytimer *timer;
+	uint64_t exp, deadline, now;
+
+	if (read(display->timer_fd, &exp, sizeof exp) != sizeof exp)
+		/* Reprogrammed between the wakeup and now */
+		return;
+
+	display->timer_programmed = 0;
+	deadline = trace_now() + TOYTIMER_SLACK_NS;
+
+	/* Timers armed by the callbacks wait for the next wakeup, so
+	 * that the loop gets to run deferred tasks in between */
+	while (display->timer_count > 0 &&
+	       display->timers[0]->expire <= deadline) {
+		timer = display->timers[0];
+		timer_heap_remove(display, timer);
+		wl_list_insert(display->expired_timers.prev, &timer->link);
+		timer->index = -2;
+	}
+
+	display->timers_dispatching = 1;
+	while (!wl_list_empty(&display->expired_timers)) {
+		timer = container_of(display->expired_timers.next,
+				     struct toytimer, link);
+		wl_list_remove(&timer->link);
+		timer->index = -1;
+
+		/* Keep the period, and count the expiries that passed */
+		if (timer->interval) {
+			now = deadline - TOYTIMER_SLACK_NS;
+			timer->overrun = timer->expire < now ?
+				(now - timer->expire) / timer->interval : 0;
+			timer->expire += (timer->overrun + 1) * timer->interval;
+			timer_heap_insert(display, timer);
+		}
+
+		timer->callback(timer);
+	}
+	display->timers_dispatching = 0;
+
+	display_program_timers(display);
+}
+
 void
-display_run(struct display *display)
+toytimer_init(struct toytimer *timer, struct display *display,
+	      toytimer_cb callback)
 {
-	struct task *task;
-	struct epoll_event ep[16];
-	struct timeval current_time;
-	int i, count, ret;
+	memset(timer, 0, sizeof *timer);
+	timer->display = display;
+	timer->callback = callback;
+	timer->index = -1;
+	wl_list_init(&timer->link);
+}
 
-	gettimeofday(&display->time, NULL);
+void
+toytimer_fini(struct toytimer *timer)
+{
+	toytimer_disarm(timer);
+}
+
+void
+toytimer_arm(struct toytimer *timer, uint64_t value, uint64_t interval)
+{
+	struct display *display = timer->display;
+
+	toytimer_disarm(timer);
+
+	timer->expire = trace_now() + value * 1000;
+	timer->interval = interval * 1000;
+	timer->overrun = 0;
+	timer_heap_insert(display, timer);
+	display_program_timers(display);
+}
+
+uint64_t
+toytimer_get_overrun(struct toytimer *timer)
+{
+	return timer->overrun;
+}
+
+void
+toytimer_disarm(struct toytimer *timer)
+{
+	if (timer->index == -2) {
+		wl_list_remove(&timer->link);
+		wl_list_init(&timer->link);
+		timer->index = -1;
+	} else if (timer->index >= 0) {
+		timer_heap_remove(timer->display, timer);
+		display_program_timers(timer->display);
+	}
+}
+
+static void
+handle_timeout(struct toytimer *timer)
+{
+	struct display *display =
+		container_of(timer, struct display, timeout_timer);
+
+	display->running = 0;
+}
+
+/*
+ * Flush the connection before blocking; when the socket is full, the
+ * display fd is also watched for writability until it drains.
+ */
+static int
+display_flush(struct display *display)
+{
+	struct epoll_event ep;
+	int ret;
+
+	ret = wl_display_flush(display->display);
+	if (ret < 0 && errno == EAGAIN) {
+		ep.events = EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP;
+		ep.data.ptr = &display->display_task;
+
+		epoll_ctl(display->epoll_fd, EPOLL_CTL_MOD,
+			  display->display_fd, &ep);
+	} else if (ret < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+static void
+display_start(struct display *display)
+{
+	/* Runs from the main loop, which never wakes up to check it */
+	if (display->timeout > 0)
+		toytimer_arm(&display->timeout_timer,
+			     display->timeout * 1000ULL, 0);
 
 	display->running = 1;
-	while (1) {
-		while (!wl_list_empty(&display->deferred_list)) {
-			task = container_of(display->deferred_list.prev,
-					    struct task, link);
-			wl_list_remove(&task->link);
-			task->run(task, 0);
-		}
 
-		if (display->timeout) {
-			gettimeofday(&current_time, NULL);
+	/* Seat events read by roundtrips before the loop started */
+	display_schedule_input(display);
+}
 
-			if ((current_time.tv_sec - display->time.tv_sec) >= display->timeout)
-				return;
-		}
+/*
+ * Announce the intention to read, so that threads reading their own
+ * queues can do so concurrently. This fails while events, e.g. from a
+ * roundtrip, are already queued on the toolkit, the input or a
+ * watched queue, as blocking would leave them pending: dispatch them
+ * first. Only the toolkit queue's reservation is kept on success.
+ */
+static int
+display_prepare_read(struct display *display)
+{
+	struct wl_event_queue **queue;
 
-		wl_display_dispatch_pending(display->display);
+	if (wl_display_prepare_read_queue(display->display,
+					  display->input_queue) != 0)
+		return -1;
+	wl_display_cancel_read(display->display);
 
-		if (!display->running)
-			break;
+	wl_array_for_each(queue, &display->queues) {
+		if (wl_display_prepare_read_queue(display->display,
+						  *queue) != 0)
+			return -1;
+		wl_display_cancel_read(display->display);
+	}
 
-		ret = wl_display_flush(display->display);
-		if (ret < 0 && errno == EAGAIN) {
-			ep[0].events =
-				EPOLLIN | EPOLLOUT | EPOLLERR | EPOLLHUP;
-			ep[0].data.ptr = &display->display_task;
+	return wl_display_prepare_read_queue(display->display, display->queue);
+}
 
-			epoll_ctl(display->epoll_fd, EPOLL_CTL_MOD,
-				  display->display_fd, &ep[0]);
-		} else if (ret < 0) {
-			break;
-		}
+/*
+ * One main loop iteration: run deferred tasks, then wait for the epoll
+ * fd, blocking only when asked to and no work is left, and run what
+ * became ready. Returns -1 when the loop should stop.
+ */
+static int
+display_iterate(struct display *display, int block)
+{
+	struct task *task;
+	struct epoll_event ep[16];
+	uint64_t start;
+	int i, count, pending, readable;
 
-		count = epoll_wait(display->epoll_fd,
-				   ep, ARRAY_LENGTH(ep), 200);
-		for (i = 0; i < count; i++) {
-			task = ep[i].data.ptr;
-			task->run(task, ep[i].events);
-		}
+	pending = display_run_deferred(display);
+
+	/* Events already queued are dispatched, then what they deferred */
+	if (display_prepare_read(display) != 0) {
+		if (display_dispatch_pending(display) < 0)
+			return -1;
+		return display->running ? 0 : -1;
+	}
+
+	if (!display->running || display_flush(display) < 0) {
+		wl_display_cancel_read(display->display);
+		return -1;
+	}
+
+	/* Only poll while background work is left over */
+	count = epoll_wait(display->epoll_fd, ep, ARRAY_LENGTH(ep),
+			   pending || !block ? 0 : -1);
+	display->counters.loop_wakeups++;
+
+	/* Read or give up the read before running any task */
+	readable = 0;
+	for (i = 0; i < count; i++)
+		if (ep[i].data.ptr == &display->display_task &&
+		    (ep[i].events & EPOLLIN))
+			readable = 1;
+	if (!readable) {
+		wl_display_cancel_read(display->display);
+	} else if (wl_display_read_events(display->display) < 0) {
+		display_exit(display);
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		task = ep[i].data.ptr;
+		start = trace_now();
+		task->run(task, ep[i].events);
+		trace_complete(TRACE_TASK_FD, start, ep[i].events);
 	}
+
+	return 0;
+}
+
+void
+display_run(struct display *display)
+{
+	display_start(display);
+
+	while (display_iterate(display, 1) == 0)
+		;
+}
+
+int
+display_get_epoll_fd(struct display *display)
+{
+	return display->epoll_fd;
+}
+
+int
+display_get_next_timeout(struct display *display)
+{
+	int priority;
+
+	if (display_flush(display) < 0)
+		return 0;
+
+	/* Seat events waiting on the input queue have the input task
+	 * scheduled */
+	for (priority = 0; priority < TASK_PRIORITY_COUNT; priority++)
+		if (!wl_list_empty(&display->deferred_list[priority]))
+			return 0;
+
+	/* Events already queued, e.g. by a roundtrip */
+	if (display_prepare_read(display) != 0)
+		return 0;
+	wl_display_cancel_read(display->display);
+
+	/* Timers are on a timerfd, the epoll fd wakes the host up for them */
+	return -1;
+}
+
+int
+display_dispatch_once(struct display *display)
+{
+	/* Started on the first call, and again after display_exit() */
+	if (!display->running)
+		display_start(display);
+
+	if (display_iterate(display, 0) < 0 || !display->running)
+		return -1;
+
+	return 0;
 }
 
 void
@@ -5787,6 +8386,8 @@ fail_on_null(void *p)
 		exit(EXIT_FAILURE);
 	}
 
+	alloc_count++;
+
 	return p;
 }
 
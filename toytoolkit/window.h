@@ -63,12 +63,38 @@ xstrdup(const char *s);
 void *
 xrealloc(char *p, size_t s);
 
+void
+startup_trace_enable(int json);
+
+void
+startup_trace_phase(const char *name);
+
 struct display *
 display_create(int *argc, char *argv[]);
 
+/*
+ * Use a connection made by the caller, which display_destroy() leaves
+ * open. The toolkit's objects live on an event queue of its own, and
+ * the caller's default queue is never dispatched by the toolkit; as
+ * both read the same socket, the caller has to dispatch its pending
+ * events (wl_display_dispatch_pending()) after display_dispatch_once().
+ */
+struct display *
+display_create_for_wl_display(struct wl_display *wl_display);
+
 void
 display_destroy(struct display *display);
 
+/*
+ * Do the part of display_create() which needs no connection ahead of
+ * time, e.g. in a process which forks one child per dialog: create the
+ * theme, decode the frame icons and load the fonts. The cursor theme
+ * is loaded into wl_shm buffers, so it waits for the connection.
+ */
+void
+display_preload(void);
+
+/* Make display_run() return after timeout milliseconds, 0 for never */
 void
 display_set_timeout(struct display *display, int timeout);
 
@@ -114,6 +140,21 @@ void *
 display_bind(struct display *display, uint32_t name,
 	     const struct wl_interface *interface, uint32_t version);
 
+/*
+ * Bind the first global advertised for interface, at most at version,
+ * without going through the global handler; NULL when there is none.
+ */
+void *
+display_bind_interface(struct display *display,
+		       const struct wl_interface *interface, uint32_t version);
+
+/*
+ * Dispatch the events of proxy, e.g. a text input, with the seat input
+ * rather than the other protocol events, in order with the keyboard.
+ */
+void
+display_set_input_proxy(struct display *display, void *proxy);
+
 typedef void (*display_output_handler_t)(struct output *output, void *data);
 
 /*
@@ -152,6 +193,7 @@ display_release_window_surface(struct display *display,
 #define SURFACE_HINT_RESIZE 0x10
 
 #define SURFACE_HINT_RGB565 0x100
+#define SURFACE_HINT_LOW_MEMORY 0x200
 
 cairo_surface_t *
 display_create_surface(struct display *display,
@@ -166,6 +208,27 @@ display_get_buffer_for_surface(struct display *display,
 struct wl_cursor_image *
 display_get_pointer_image(struct display *display, int pointer);
 
+/*
+ * Deferred tasks run from display_run() before it blocks, higher
+ * priorities first. Seat input is dispatched from an input task, so
+ * it is handled before the redraws already queued; resizes are part
+ * of the window redraw. Background tasks only get a few milliseconds
+ * per main loop iteration, checked between tasks, so each one should
+ * do a bounded chunk of work and defer itself again when there is
+ * more.
+ */
+enum task_priority {
+	TASK_PRIORITY_INPUT,
+	TASK_PRIORITY_REDRAW,
+	TASK_PRIORITY_BACKGROUND,
+	TASK_PRIORITY_COUNT
+};
+
+void
+display_defer_priority(struct display *display, struct task *task,
+		       enum task_priority priority);
+
+/* Defer with TASK_PRIORITY_REDRAW */
 void
 display_defer(struct display *display, struct task *task);
 
@@ -176,12 +239,102 @@ display_watch_fd(struct display *display,
 void
 display_unwatch_fd(struct display *display, int fd);
 
+struct toytimer;
+typedef void (*toytimer_cb)(struct toytimer *timer);
+
+/*
+ * One-shot and periodic timers, all multiplexed on a single timerfd
+ * per display. Embed a toytimer in your own structure and get back to
+ * it with container_of() in the callback. Timers expiring within a
+ * millisecond of each other are run from the same wakeup. The fields
+ * are private.
+ */
+struct toytimer {
+	struct display *display;
+	toytimer_cb callback;
+	uint64_t expire;
+	uint64_t interval;
+	uint64_t overrun;
+	int index;
+	struct wl_list link;
+};
+
+void
+toytimer_init(struct toytimer *timer, struct display *display,
+	      toytimer_cb callback);
+
+/* Disarm the timer; it may be freed afterwards */
+void
+toytimer_fini(struct toytimer *timer);
+
+/*
+ * Expire after value microseconds (0 meaning on the next main loop
+ * iteration), then every interval microseconds unless it is 0.
+ * Rearming an armed timer moves it.
+ */
+void
+toytimer_arm(struct toytimer *timer, uint64_t value, uint64_t interval);
+
+void
+toytimer_disarm(struct toytimer *timer);
+
+/*
+ * From the callback of a periodic timer, the number of expiries which
+ * passed before the main loop got to run it, beyond the current one.
+ */
+uint64_t
+toytimer_get_overrun(struct toytimer *timer);
+
+/*
+ * Event queues which display_run() dispatches on the main thread along
+ * with the default queue. Threads owning a queue of their own must not
+ * register it; they read with wl_display_prepare_read_queue() and
+ * wl_display_read_events() like display_run() does.
+ */
+void
+display_watch_queue(struct display *display, struct wl_event_queue *queue);
+
+void
+display_unwatch_queue(struct display *display, struct wl_event_queue *queue);
+
 void
 display_run(struct display *d);
 
 void
 display_exit(struct display *d);
 
+/*
+ * Integration with a host main loop (GLib, libuv, a private epoll...)
+ * instead of display_run(). Watch the epoll fd for readability, and
+ * before blocking ask for the timeout in milliseconds, -1 meaning none:
+ * it also flushes the requests queued meanwhile. Whenever the fd is
+ * readable or the timeout expires, call display_dispatch_once(), which
+ * never blocks; it returns -1 once display_exit() has been called or
+ * the connection is gone. The next call starts the display again, so
+ * it can be reused after display_exit(). All of it must happen on one
+ * thread.
+ */
+int
+display_get_epoll_fd(struct display *display);
+
+int
+display_get_next_timeout(struct display *display);
+
+int
+display_dispatch_once(struct display *display);
+
+/*
+ * Dump the counters, and the statistics when enabled, on SIGUSR1 and
+ * the event trace on SIGUSR2, from the main loop. This blocks both
+ * signals in the calling thread, and so in the threads it creates
+ * later, until display_destroy(); as that is inherited by child
+ * processes too, display_create() only does it when asked for with
+ * TOYTOOLKIT_SIGNALS=1, TOYTOOLKIT_STATS or TOYTOOLKIT_TRACE_FILE.
+ * Other threads of the host must block them themselves.
+ */
+void
+display_watch_signals(struct display *display);
+
 enum cursor_type {
 	CURSOR_BOTTOM_LEFT,
 	CURSOR_BOTTOM_RIGHT,
@@ -445,6 +598,15 @@ void
 window_set_preferred_format(struct window *window,
 			    enum preferred_format format);
 
+void
+window_set_shadow(struct window *window, int shadow);
+
+void
+window_set_compact_frame(struct window *window, int compact);
+
+void
+window_set_low_memory(struct window *window, int low_memory);
+
 int
 widget_set_tooltip(struct widget *parent, char *entry, float x, float y);
 
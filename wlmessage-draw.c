@@ -0,0 +1,408 @@
+/* Copyright © 2014 Manuel Bachmann */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "shared/cairo-util.h"
+#include "wlmessage-draw.h"
+
+
+int
+get_number_of_lines (char *text)
+{
+	int lines_num = 0;
+
+	gchar **lines = g_strsplit (text, "\n", -1);
+
+	if ( lines ) {
+	  while ((lines[lines_num] != NULL) && (lines_num < MAX_LINES))
+	    lines_num++;
+
+	  g_strfreev (lines);
+	}
+
+	return lines_num;
+}
+
+int
+get_max_length_of_lines (char *text)
+{
+	int lines_num = 0;
+	int length = 0;
+
+	gchar **lines = g_strsplit (text, "\n", -1);
+	
+	if ( lines ) {
+	  while ((lines[lines_num] != NULL) && (lines_num < MAX_LINES)) {
+	    if (strlen (lines[lines_num]) > length)
+	      length = strlen (lines[lines_num]);
+	    lines_num++;
+	  }
+	  g_strfreev (lines);
+	}
+
+	return length;
+}
+
+char **
+get_lines (char *text)
+{
+	gchar **lines = g_strsplit (text, "\n", -1);
+
+	return lines;
+}
+
+
+int
+parse_titlebuttons (char *titlebuttons)
+{
+	int frame_type = FRAME_ALL;
+
+	if (titlebuttons) {
+		frame_type = FRAME_NONE;
+		if (strstr (titlebuttons, "Min"))
+			frame_type = frame_type | FRAME_MINIMIZE;
+		if (strstr (titlebuttons, "Max"))
+			frame_type = frame_type | FRAME_MAXIMIZE;
+		if (strstr (titlebuttons, "Close"))
+			frame_type = frame_type | FRAME_CLOSE;
+	}
+
+	return frame_type;
+}
+
+cairo_surface_t *
+load_icon (char *filename)
+{
+	cairo_surface_t *icon = NULL;
+
+	cairo_surface_t *icon_temp = cairo_image_surface_create_from_png (filename);
+	cairo_status_t status = cairo_surface_status (icon_temp);
+	if (status == CAIRO_STATUS_SUCCESS) {
+		icon = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 64, 64);
+		cairo_t *icon_cr = cairo_create (icon);
+		 /* rescale to 64x64 */
+		int width = cairo_image_surface_get_width (icon_temp);
+		int height = cairo_image_surface_get_height (icon_temp);
+		if (width != height != 64) {
+			double ratio = ((64.0/width) < (64.0/height) ? (64.0/width) : (64.0/height));
+			cairo_scale (icon_cr, ratio, ratio);
+		}
+		cairo_set_source_surface (icon_cr, icon_temp, 0.0, 0.0);
+		cairo_paint (icon_cr);
+		cairo_destroy (icon_cr);
+	}
+	cairo_surface_destroy (icon_temp);
+
+	return icon;
+}
+
+void
+layout_entry (struct rectangle *allocation, struct rectangle *entry)
+{
+	entry->x = allocation->x + (allocation->width - 240)/2;
+	entry->y = allocation->y + allocation->height - 16*2 - 32*2;
+	entry->width = 240;
+	entry->height = 32;
+}
+
+static int
+button_width (char *caption)
+{
+	int extended_width = strlen(caption) - 5;
+	if (extended_width < 0) extended_width = 0;
+
+	return 60 + extended_width*10;
+}
+
+void
+layout_buttons (struct rectangle *allocation, char **captions,
+                int buttons_nb, struct rectangle *buttons)
+{
+	int buttons_width;
+	int i, x;
+
+	buttons_width = 0;
+	for (i = 0; i < buttons_nb; i++)
+		buttons_width += button_width (captions[i]);
+
+	x = allocation->x + (allocation->width - buttons_width)/2
+	                  - (buttons_nb-1)*10;
+
+	for (i = 0; i < buttons_nb; i++) {
+		buttons[i].x = x;
+		buttons[i].y = allocation->y + allocation->height - 16 - 32;
+		buttons[i].width = button_width (captions[i]);
+		buttons[i].height = 32;
+		x += buttons[i].width + 10;
+	}
+}
+
+void
+draw_message (cairo_t *cr, struct rectangle *allocation, char *message,
+              cairo_surface_t *icon, int has_entry, int buttons_nb)
+{
+	cairo_text_extents_t extents;
+	int lines_nb;
+	char **lines;
+
+	cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+	cairo_rectangle (cr,
+			allocation->x,
+			allocation->y,
+			allocation->width,
+			allocation->height);
+	cairo_set_source_rgba (cr, 0.5, 0.5, 0.5, 1.0);
+	cairo_fill (cr);
+
+	if (icon) {
+			cairo_set_source_surface (cr, icon,
+			                              allocation->x + (allocation->width - 64.0)/2,
+			                              allocation->y + 10);
+			cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
+			cairo_paint (cr);
+	}
+
+	cairo_set_source_rgba (cr, 0.0, 0.0, 0.0, 1.0);
+	cairo_select_font_face (cr, "sans",
+	                        CAIRO_FONT_SLANT_NORMAL,
+	                        CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size (cr, 18);
+
+	lines_nb = get_number_of_lines (message);
+	lines = get_lines (message);
+
+	int i;
+	for (i = 0; i < lines_nb; i++) {
+		cairo_text_extents (cr, lines[i], &extents);
+		cairo_move_to (cr, allocation->x + (allocation->width - extents.width)/2,
+	        	           allocation->y + (allocation->height - lines_nb * extents.height)/2
+		                                + i*(extents.height+10)
+		                                + (!icon ? 0 : 32)
+                                                - (!has_entry ? 0 : 32)
+                                                - (!buttons_nb ? 0 : 32));
+		cairo_show_text (cr, lines[i]);
+	}
+
+	g_strfreev (lines);
+}
+
+void
+draw_button (cairo_t *cr, struct rectangle *allocation, const char *caption,
+             int focused)
+{
+	cairo_text_extents_t extents;
+
+	cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+	cairo_rectangle (cr,
+			allocation->x,
+			allocation->y,
+			allocation->width,
+			allocation->height);
+	if (focused)
+		cairo_set_source_rgb (cr, 1.0, 1.0, 1.0);
+	else
+		cairo_set_source_rgb (cr, 0.9, 0.9, 0.9);
+	cairo_fill (cr);
+	cairo_set_line_width (cr, 1);
+	cairo_rectangle (cr,
+			allocation->x,
+			allocation->y,
+			allocation->width,
+			allocation->height);
+	cairo_set_source_rgb (cr, 0.0, 0.0, 0.0);
+	cairo_stroke_preserve(cr);
+	cairo_select_font_face (cr, "sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size (cr, 14);
+	cairo_text_extents (cr, caption, &extents);
+	cairo_move_to (cr, allocation->x + (allocation->width - extents.width)/2,
+                           allocation->y + (allocation->height - extents.height)/2 + 10);
+	cairo_show_text (cr, caption);
+}
+
+void
+draw_entry (cairo_t *cr, struct rectangle *allocation, const char *text,
+            int cursor_pos, int active)
+{
+	cairo_text_extents_t extents;
+	cairo_text_extents_t leftp_extents;
+	char *leftp_text;
+	int char_pos;
+
+	cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
+	cairo_rectangle (cr,
+	                allocation->x,
+	                allocation->y,
+	                allocation->width,
+	                allocation->height);
+	cairo_set_source_rgb (cr, 1.0, 1.0, 1.0);
+	cairo_fill (cr);
+	cairo_set_line_width (cr, 1);
+	cairo_rectangle (cr,
+			allocation->x,
+			allocation->y,
+			allocation->width,
+			allocation->height);
+	if (active)
+		cairo_set_source_rgb (cr, 0.0, 0.0, 1.0);
+	else
+		cairo_set_source_rgb (cr, 0.0, 0.0, 0.0);
+	cairo_stroke_preserve(cr);
+
+	cairo_set_source_rgba (cr, 0.0, 0.0, 0.0, 1.0);
+	cairo_select_font_face (cr, "sans",
+	                        CAIRO_FONT_SLANT_NORMAL,
+	                        CAIRO_FONT_WEIGHT_NORMAL);
+	cairo_set_font_size (cr, 14);
+	cairo_text_extents (cr, text, &extents);
+			char_pos = strlen(text) -1;						/* for spaces at the end */
+			while (char_pos >= 0 && text[char_pos] == ' ') {
+				extents.width += 5.0;
+				char_pos--;
+			}
+	cairo_move_to (cr, allocation->x + (allocation->width - extents.width)/2,
+	        	   allocation->y + (allocation->height - extents.height)/2 + 10);
+	cairo_show_text (cr, text);
+
+	if (active) {
+		leftp_text = malloc (cursor_pos + 1);
+		strncpy (leftp_text, text, cursor_pos);
+		leftp_text[cursor_pos] = '\0';
+		cairo_text_extents (cr, leftp_text, &leftp_extents);
+			char_pos = strlen(leftp_text) -1;
+			while (char_pos >= 0 && leftp_text[char_pos] == ' ') {
+				leftp_extents.width += 5.0;
+				char_pos--;
+			}
+		free (leftp_text);
+
+		cairo_move_to (cr, allocation->x + (allocation->width - extents.width)/2 + leftp_extents.width,
+		        	   allocation->y + (allocation->height - extents.height)/2 + 15);
+		cairo_line_to(cr, allocation->x + (allocation->width - extents.width)/2 + leftp_extents.width,
+		        	   allocation->y + (allocation->height - extents.height)/2 - 5);
+		cairo_stroke(cr);
+	}
+}
+
+void
+layout_dialog (struct rectangle *allocation, struct dialog_content *content,
+               struct dialog_layout *layout)
+{
+	if (content->entry_text)
+		layout_entry (allocation, &layout->entry);
+
+	layout_buttons (allocation, content->captions, content->buttons_nb,
+	                layout->buttons);
+}
+
+void
+draw_dialog (cairo_t *cr, struct rectangle *allocation,
+             struct dialog_content *content)
+{
+	struct dialog_layout layout;
+	struct rectangle rect;
+	int i;
+
+	layout_dialog (allocation, content, &layout);
+
+	draw_message (cr, allocation, content->message, content->icon,
+	              content->entry_text != NULL, content->buttons_nb);
+
+	for (i = 0; i < content->buttons_nb; i++) {
+		rect = layout.buttons[i];
+		if (content->pressed[i]) {
+			rect.x++;
+			rect.y++;
+		}
+		draw_button (cr, &rect, content->captions[i], content->focused[i]);
+	}
+
+	if (content->entry_text)
+		draw_entry (cr, &layout.entry, content->entry_text,
+		            content->entry_cursor, content->entry_active);
+}
+
+/*
+ * Paint the dialog the way the window would show it when focused, into
+ * a WIDTHxHEIGHT image that includes the frame and its shadow.
+ */
+int
+render_to_png (const char *filename, int width, int height,
+               char *message, char *title, char *titlebuttons, int noresize,
+               int compact, char *buttons, char *icon, char *textfield)
+{
+	struct theme *theme;
+	struct frame *frame;
+	struct rectangle allocation;
+	struct dialog_content content;
+	char **button_list = NULL;
+	cairo_surface_t *surface;
+	cairo_status_t status;
+	cairo_t *cr;
+
+	theme = theme_create ();
+	if (!theme)
+		return -1;
+
+	/* Same arguments as window_frame_create() */
+	frame = frame_create (theme, 0, 0, !noresize,
+	                      parse_titlebuttons (titlebuttons),
+	                      title ? title : "wlmessage");
+	if (!frame) {
+		theme_destroy (theme);
+		return -1;
+	}
+	if (compact)
+		frame_set_flag (frame, FRAME_FLAG_COMPACT);
+	frame_set_flag (frame, FRAME_FLAG_ACTIVE);
+	frame_resize (frame, width, height);
+	frame_interior (frame, &allocation.x, &allocation.y,
+	                &allocation.width, &allocation.height);
+
+	memset (&content, 0, sizeof content);
+	content.message = message ? message : "";
+
+	if (buttons) {
+		button_list = g_strsplit (buttons, ",", MAX_BUTTONS);
+		while (button_list[content.buttons_nb] != NULL) {
+			int i = content.buttons_nb++;
+
+			content.captions[i] = strtok (button_list[i], ":");
+			if (!content.captions[i])
+				content.captions[i] = button_list[i];
+		}
+	}
+
+	if (textfield) {
+		content.entry_text = textfield;
+		content.entry_cursor = strlen (textfield);
+	}
+
+	if (icon)
+		content.icon = load_icon (icon);
+
+	surface = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, width, height);
+	cr = cairo_create (surface);
+
+	/* The frame, then what the message widget paints inside it */
+	frame_repaint (frame, cr);
+	draw_dialog (cr, &allocation, &content);
+
+	cairo_destroy (cr);
+
+	status = cairo_surface_write_to_png (surface, filename);
+	if (status != CAIRO_STATUS_SUCCESS)
+		fprintf (stderr, "failed to write %s: %s\n",
+		         filename, cairo_status_to_string (status));
+
+	cairo_surface_destroy (surface);
+	if (content.icon)
+		cairo_surface_destroy (content.icon);
+	g_strfreev (button_list);
+	frame_destroy (frame);
+	theme_destroy (theme);
+
+	return status == CAIRO_STATUS_SUCCESS ? 0 : -1;
+}
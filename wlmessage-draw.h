@@ -0,0 +1,85 @@
+/* Copyright © 2014 Manuel Bachmann */
+
+#ifndef WLMESSAGE_DRAW_H
+#define WLMESSAGE_DRAW_H
+
+#include <cairo.h>
+
+#include "window.h"
+
+#define MAX_LINES 6
+#define MAX_BUTTONS 3
+
+int
+get_number_of_lines (char *text);
+
+int
+get_max_length_of_lines (char *text);
+
+char **
+get_lines (char *text);
+
+int
+parse_titlebuttons (char *titlebuttons);
+
+cairo_surface_t *
+load_icon (char *filename);
+
+void
+layout_entry (struct rectangle *allocation, struct rectangle *entry);
+
+void
+layout_buttons (struct rectangle *allocation, char **captions,
+                int buttons_nb, struct rectangle *buttons);
+
+/*
+ * Everything the dialog shows inside its frame, as the window has it
+ * or as render_to_png() makes it up, so that both paint the same way.
+ */
+struct dialog_content {
+	char *message;
+	cairo_surface_t *icon;
+
+	int buttons_nb;
+	char *captions[MAX_BUTTONS];
+	int focused[MAX_BUTTONS];
+	int pressed[MAX_BUTTONS];
+
+	const char *entry_text;		/* NULL without a text field */
+	int entry_cursor;
+	int entry_active;
+};
+
+struct dialog_layout {
+	struct rectangle entry;
+	struct rectangle buttons[MAX_BUTTONS];
+};
+
+void
+layout_dialog (struct rectangle *allocation, struct dialog_content *content,
+               struct dialog_layout *layout);
+
+/* The message, then the buttons, then the text field */
+void
+draw_dialog (cairo_t *cr, struct rectangle *allocation,
+             struct dialog_content *content);
+
+/* These only draw into cr and need no display connection */
+void
+draw_message (cairo_t *cr, struct rectangle *allocation, char *message,
+              cairo_surface_t *icon, int has_entry, int buttons_nb);
+
+void
+draw_button (cairo_t *cr, struct rectangle *allocation, const char *caption,
+             int focused);
+
+void
+draw_entry (cairo_t *cr, struct rectangle *allocation, const char *text,
+            int cursor_pos, int active);
+
+int
+render_to_png (const char *filename, int width, int height,
+               char *message, char *title, char *titlebuttons, int noresize,
+               int compact, char *buttons, char *icon, char *textfield);
+
+#endif
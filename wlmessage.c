@@ -1,891 +1,869 @@
 /* Copyright © 2014 Manuel Bachmann */
 
-#include <linux/input.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 #include <glib.h>
-#include <wayland-client.h>
 
 #include "window.h"
-#include "text-client-protocol.h"
-#define MAX_LINES 6
+#include "wlmessage-draw.h"
+#include "libwlmessage.h"
 
 
-struct message_window {
-	struct window *window;
-	struct widget *widget;
-	cairo_surface_t *surface;
-
+struct options {
 	char *message;
+	char *buttons;
+	char *deflt;
+	char *textfield;
 	char *title;
-	cairo_surface_t *icon;
-	struct entry *entry;
-	int buttons_nb;
-	struct wl_list button_list;
+	char *titlebuttons;
+	char *icon;
+	int timeout;
+	int noresize;
+	int compact;
+	int low_memory;
+	int trace_startup;
+	char *render_to;
+	int render_width, render_height;
+	int daemon, client, zygote;
+	int batch, parallel;
 };
 
-struct button {
-	struct widget *widget;
-	int focused, pressed;
-	struct wl_list link;
-
-	char *caption;
+struct result {
+	struct display *display;
 	int value;
 };
 
-struct entry {
-	struct widget *widget;
-	int active;
-
-	struct wl_text_input *text_input;
-	char *text;
-	int cursor_pos;
-	int cursor_anchor;
-	int last_vkb_len;
-};
-
-void message_window_destroy ();
-
-struct message_window *message_window;
-struct wl_text_input_manager *text_input_manager;
-int default_value;
-
-
-int
-get_number_of_lines (char *text)
+static void
+done_handler (struct wlmessage *wlmessage, int value, const char *text,
+              void *data)
 {
-	int lines_num = 0;
+	struct result *result = data;
 
-	gchar **lines = g_strsplit (text, "\n", -1);
+	if (text)
+		fputs (text, stdout);
+	result->value = value;
+	display_exit (result->display);
+}
 
-	if ( lines ) {
-	  while ((lines[lines_num] != NULL) && (lines_num < MAX_LINES))
-	    lines_num++;
+static struct wlmessage *
+dialog_create (struct display *display, struct options *options)
+{
+	struct wlmessage *wlmessage;
+	int i;
 
-	  g_strfreev (lines);
+	wlmessage = wlmessage_create (display);
+	wlmessage_set_message (wlmessage, options->message);
+	wlmessage_set_title (wlmessage, options->title);
+	wlmessage_set_titlebuttons (wlmessage, options->titlebuttons);
+	wlmessage_set_noresize (wlmessage, options->noresize);
+	wlmessage_set_compact (wlmessage, options->compact);
+	wlmessage_set_low_memory (wlmessage, options->low_memory);
+	wlmessage_set_icon (wlmessage, options->icon);
+	wlmessage_set_textfield (wlmessage, options->textfield);
+	wlmessage_set_timeout (wlmessage, options->timeout);
+
+	if (options->buttons) {
+		gchar **button_list = g_strsplit (options->buttons, ",", MAX_BUTTONS);
+		for (i = 0; button_list[i] != NULL; i++) {
+			gchar **desc = g_strsplit (button_list[i], ":", 2);
+			wlmessage_add_button (wlmessage, desc[0],
+			                      desc[1] ? atoi (desc[1]) : 0);
+			g_strfreev (desc);
+		}
+		g_strfreev (button_list);
+		wlmessage_set_default_button (wlmessage, options->deflt);
 	}
 
-	return lines_num;
+	return wlmessage;
 }
 
-int
-get_max_length_of_lines (char *text)
+/* Unlike the library, the program dumps its counters on SIGUSR1 */
+static struct display *
+open_display (void)
 {
-	int lines_num = 0;
-	int length = 0;
-
-	gchar **lines = g_strsplit (text, "\n", -1);
-	
-	if ( lines ) {
-	  while ((lines[lines_num] != NULL) && (lines_num < MAX_LINES)) {
-	    if (strlen (lines[lines_num]) > length)
-	      length = strlen (lines[lines_num]);
-	    lines_num++;
-	  }
-	  g_strfreev (lines);
+	struct display *display;
+
+	display = display_create (NULL, NULL);
+	if (!display) {
+		fprintf (stderr, "Failed to connect to a Wayland compositor !\n");
+		return NULL;
 	}
 
-	return length;
+	display_watch_signals (display);
+
+	return display;
 }
 
-char **
-get_lines (char *text)
+static int
+wlmessage_run (struct options *options)
 {
-	gchar **lines = g_strsplit (text, "\n", -1);
+	struct display *display = NULL;
+	struct wlmessage *wlmessage;
+	struct result result;
 
-	return lines;
-}
+	display = open_display ();
+	if (!display)
+		return 0;
 
+	wlmessage = dialog_create (display, options);
 
-static void
-text_input_enter(void *data,
-                 struct wl_text_input *text_input,
-                 struct wl_surface *surface)
-{
-}
+	result.display = display;
+	result.value = 0;
+	wlmessage_show (wlmessage, done_handler, &result);
+	display_run (display);
 
-static void
-text_input_leave(void *data,
-                 struct wl_text_input *text_input)
-{
-}
+	wlmessage_destroy (wlmessage);
+	display_destroy (display);
 
-static void
-text_input_modifiers_map(void *data,
-                         struct wl_text_input *text_input,
-                         struct wl_array *map)
-{
+	return result.value;
 }
 
-static void
-text_input_input_panel_state(void *data,
-                             struct wl_text_input *text_input,
-                             uint32_t state)
-{
-}
 
-static void
-text_input_preedit_string(void *data,
-                          struct wl_text_input *text_input,
-                          uint32_t serial,
-                          const char *text,
-                          const char *commit)
-{
-	struct entry *entry = data;
-	char *new_text;
-
-	if (strlen(entry->text) >= 18)
-		return;
+/*
+ * -daemon keeps a display, and with it the theme, cursors and font
+ * caches, for the dialogs -client asks for over a Unix socket in
+ * $XDG_RUNTIME_DIR. A request is a 32-bit length followed by the
+ * client working directory and its arguments, each NUL-terminated;
+ * the reply is a struct daemon_reply, then the text if any. A request
+ * the daemon cannot show is answered with DAEMON_REPLY_ERROR.
+ */
+#define DAEMON_MAX_REQUEST 65536
+#define DAEMON_REPLY_ERROR -2
+
+struct daemon_reply {
+	int32_t value;
+	int32_t text_length;	/* -1 for no text, or DAEMON_REPLY_ERROR */
+};
 
-	 /* workaround to prevent using Backspace for now */
-	if (strlen(text) < entry->last_vkb_len) {
-		entry->last_vkb_len = strlen(text);
-		return;
-	} else {
-		entry->last_vkb_len = strlen(text);
-	}
+struct daemon {
+	struct display *display;
+	int fd;
+	struct task task;
+	struct wl_list client_list;
+	int single;	/* a zygote child, done after one dialog */
+};
 
-	new_text = malloc (strlen(entry->text) + 1 + 1);
-	strncpy (new_text, entry->text, entry->cursor_pos);
-	strcpy (new_text+entry->cursor_pos, text+(strlen(text)-1));
-	strcpy (new_text+entry->cursor_pos+1, entry->text+entry->cursor_pos);
-	free (entry->text);
-	entry->text = new_text;
-	entry->cursor_pos++;
+struct daemon_client {
+	struct daemon *daemon;
+	int fd;
+	struct task task;
+	struct wl_list link;
 
-	widget_schedule_redraw (entry->widget);
-}
+	uint32_t length;
+	uint32_t received;
+	char *request;
 
-static void
-text_input_preedit_styling(void *data,
-                           struct wl_text_input *text_input,
-                           uint32_t index,
-                           uint32_t length,
-                           uint32_t style)
-{
-}
+	struct wlmessage *wlmessage;
+};
 
-static void
-text_input_preedit_cursor(void *data,
-                          struct wl_text_input *text_input,
-                          int32_t index)
+static int
+daemon_socket_path (struct sockaddr_un *addr)
 {
-}
+	const char *runtime_dir = getenv ("XDG_RUNTIME_DIR");
+	const char *display = getenv ("WAYLAND_DISPLAY");
+	int len;
 
-static void
-text_input_commit_string(void *data,
-                         struct wl_text_input *text_input,
-                         uint32_t serial,
-                         const char *text)
-{
-}
+	if (!runtime_dir) {
+		fprintf (stderr, "XDG_RUNTIME_DIR is not set\n");
+		return -1;
+	}
+	if (!display)
+		display = "wayland-0";
+
+	memset (addr, 0, sizeof *addr);
+	addr->sun_family = AF_LOCAL;
+	len = snprintf (addr->sun_path, sizeof addr->sun_path,
+	                "%s/wlmessage-%s", runtime_dir, display);
+	if (len < 0 || len >= (int) sizeof addr->sun_path) {
+		fprintf (stderr, "socket path too long\n");
+		return -1;
+	}
 
-static void
-text_input_cursor_position(void *data,
-                           struct wl_text_input *text_input,
-                           int32_t index,
-                           int32_t anchor)
-{
+	return 0;
 }
 
-static void
-text_input_keysym(void *data,
-                  struct wl_text_input *text_input,
-                  uint32_t serial,
-                  uint32_t time,
-                  uint32_t sym,
-                  uint32_t state,
-                  uint32_t modifiers)
+static int
+write_all (int fd, const void *data, size_t size)
 {
-	struct entry *entry = data;
-	char *new_text;
-
-	if (state == WL_KEYBOARD_KEY_STATE_PRESSED)
-		return;
-
-	 /* use Tab as Backspace until I figure this out */
-	if (sym == XKB_KEY_Tab) {
-		if (entry->cursor_pos != 0) {
-			new_text = malloc (strlen(entry->text));
-			strncpy (new_text, entry->text, entry->cursor_pos - 1);
-			strcpy (new_text+entry->cursor_pos-1, entry->text+entry->cursor_pos);
-			free (entry->text);
-			entry->text = new_text;
-			entry->cursor_pos--;
-		}
-	}	
+	const char *p = data;
+	ssize_t len;
 
-	if (sym == XKB_KEY_Left) {
-		if (entry->cursor_pos != 0)
-			entry->cursor_pos--;
+	while (size > 0) {
+		len = send (fd, p, size, MSG_NOSIGNAL);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return -1;
+		p += len;
+		size -= len;
 	}
 
-	if (sym == XKB_KEY_Right) {
-		if (entry->cursor_pos != strlen (entry->text))
-			entry->cursor_pos++;
-	}
+	return 0;
+}
 
-	if (sym == XKB_KEY_Return) {
-		fprintf (stdout, entry->text);
-		message_window_destroy ();
-		exit (default_value);
+static int
+read_all (int fd, void *data, size_t size)
+{
+	char *p = data;
+	ssize_t len;
+
+	while (size > 0) {
+		len = read (fd, p, size);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0)
+			return -1;
+		p += len;
+		size -= len;
 	}
 
-	widget_schedule_redraw (entry->widget);
+	return 0;
 }
 
-static void
-text_input_language(void *data,
-                    struct wl_text_input *text_input,
-                    uint32_t serial,
-                    const char *language)
-{
-}
+static int parse_options (int argc, char *argv[], const char *cwd,
+                          struct options *options);
+static void options_release (struct options *options);
 
 static void
-text_input_text_direction(void *data,
-                          struct wl_text_input *text_input,
-                          uint32_t serial,
-                          uint32_t direction)
+daemon_client_destroy (struct daemon_client *client)
 {
-}
+	struct daemon *daemon = client->daemon;
 
-static const struct wl_text_input_listener text_input_listener = {
-	text_input_enter,
-	text_input_leave,
-	text_input_modifiers_map,
-	text_input_input_panel_state,
-	text_input_preedit_string,
-	text_input_preedit_styling,
-	text_input_preedit_cursor,
-	text_input_commit_string,
-	text_input_cursor_position,
-	NULL,
-	text_input_keysym,
-	text_input_language,
-	text_input_text_direction
-};
+	if (client->wlmessage)
+		wlmessage_destroy (client->wlmessage);
 
+	display_unwatch_fd (daemon->display, client->fd);
+	close (client->fd);
+	wl_list_remove (&client->link);
+	free (client->request);
+	free (client);
 
-void
-button_send_activate (int value)
-{
-	if (message_window->entry)
-		fprintf (stdout, message_window->entry->text);
-	message_window_destroy ();
-	exit (value);
+	if (daemon->single)
+		display_exit (daemon->display);
 }
 
 static void
-button_click_handler(struct widget *widget,
-		struct input *input, uint32_t time,
-		uint32_t butt,
-		enum wl_pointer_button_state state, void *data)
+daemon_client_done (struct wlmessage *wlmessage, int value, const char *text,
+                    void *data)
 {
-	struct button *button = data;
+	struct daemon_client *client = data;
+	struct daemon_reply reply;
 
-	widget_schedule_redraw (widget);
+	reply.value = value;
+	reply.text_length = text ? (int32_t) strlen (text) : -1;
 
-	if (state == WL_POINTER_BUTTON_STATE_PRESSED) {
-		button->pressed = 1;
-	} else {
-		button->pressed = 0;
-		button_send_activate (button->value);
-	}
-}
+	/* The reply is small, the socket buffer takes it whole */
+	if (write_all (client->fd, &reply, sizeof reply) == 0 && text)
+		write_all (client->fd, text, reply.text_length);
 
-static void
-button_touch_down_handler(struct widget *widget, struct input *input,
-		 uint32_t serial, uint32_t time, int32_t id,
-		 float tx, float ty, void *data)
-{
-	struct button *button = data;
-
-	button->focused = 1;
-	widget_schedule_redraw (widget);
+	daemon_client_destroy (client);
 }
 
 static void
-button_touch_up_handler(struct widget *widget, struct input *input,
-		 uint32_t serial, uint32_t time, int32_t id,
-		 void *data)
+daemon_client_reject (struct daemon_client *client)
 {
-	struct button *button = data;
+	struct daemon_reply reply;
 
-	button->focused = 0;
-	widget_schedule_redraw (widget);
+	reply.value = 0;
+	reply.text_length = DAEMON_REPLY_ERROR;
+	write_all (client->fd, &reply, sizeof reply);
 
-	button_send_activate (button->value);
+	daemon_client_destroy (client);
 }
 
 static int
-button_enter_handler(struct widget *widget, struct input *input,
-			     float x, float y, void *data)
+daemon_client_show (struct daemon_client *client)
 {
-	struct button *button = data;
+	struct options options;
+	char **argv;
+	char *p, *end;
+	int argc = 0;
+
+	/* NUL-terminated strings: the working directory, then the arguments */
+	end = client->request + client->length;
+	if (end[-1] != '\0')
+		return -1;
+
+	argv = xzalloc ((client->length + 1) * sizeof *argv);
+	argv[argc++] = "wlmessage";
+	for (p = client->request + strlen (client->request) + 1; p < end;
+	     p += strlen (p) + 1)
+		argv[argc++] = p;
+
+	if (parse_options (argc, argv, client->request, &options) < 0 ||
+	    options.render_to || options.daemon || options.client ||
+	    options.zygote || options.batch) {
+		options_release (&options);
+		free (argv);
+		return -1;
+	}
+
+	client->wlmessage = dialog_create (client->daemon->display, &options);
+	wlmessage_show (client->wlmessage, daemon_client_done, client);
 
-	button->focused = 1;
-	widget_schedule_redraw (widget);
+	options_release (&options);
+	free (argv);
 
-	return CURSOR_LEFT_PTR;
+	return 0;
 }
 
 static void
-button_leave_handler(struct widget *widget,
-			     struct input *input, void *data)
+daemon_client_data (struct task *task, uint32_t events)
 {
-	struct button *button = data;
+	struct daemon_client *client =
+		container_of (task, struct daemon_client, task);
+	ssize_t len;
 
-	button->focused = 0;
-	widget_schedule_redraw (widget);
-}
+	/* Anything once the dialog is up means the client has gone */
+	if (client->wlmessage || (events & (EPOLLERR | EPOLLHUP))) {
+		daemon_client_destroy (client);
+		return;
+	}
 
-static void
-button_redraw_handler (struct widget *widget, void *data)
-{
-	struct button *button = data;
-	struct rectangle allocation;
-	cairo_t *cr;
-	cairo_text_extents_t extents;
-
-	widget_get_allocation (widget, &allocation);
-	if (button->pressed) {
-		allocation.x++;
-		allocation.y++;
+	if (!client->request) {
+		len = read (client->fd, (char *) &client->length + client->received,
+		            sizeof client->length - client->received);
+		if (len < 0 && errno == EAGAIN)
+			return;
+		if (len <= 0) {
+			daemon_client_destroy (client);
+			return;
+		}
+		client->received += len;
+		if (client->received < sizeof client->length)
+			return;
+
+		if (client->length == 0 || client->length > DAEMON_MAX_REQUEST) {
+			daemon_client_reject (client);
+			return;
+		}
+		client->request = xmalloc (client->length);
+		client->received = 0;
 	}
 
-	cr = widget_cairo_create (message_window->widget);
-	cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
-	cairo_rectangle (cr,
-			allocation.x,
-			allocation.y,
-			allocation.width,
-			allocation.height);
-	if (button->focused)
-		cairo_set_source_rgb (cr, 1.0, 1.0, 1.0);
-	else
-		cairo_set_source_rgb (cr, 0.9, 0.9, 0.9);
-	cairo_fill (cr);
-	cairo_set_line_width (cr, 1);
-	cairo_rectangle (cr,
-			allocation.x,
-			allocation.y,
-			allocation.width,
-			allocation.height);
-	cairo_set_source_rgb (cr, 0.0, 0.0, 0.0);
-	cairo_stroke_preserve(cr);
-	cairo_select_font_face (cr, "sans", CAIRO_FONT_SLANT_NORMAL, CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size (cr, 14);
-	cairo_text_extents (cr, button->caption, &extents);
-	cairo_move_to (cr, allocation.x + (allocation.width - extents.width)/2,
-                           allocation.y + (allocation.height - extents.height)/2 + 10);
-	cairo_show_text (cr, button->caption);
-	cairo_destroy (cr);
+	len = read (client->fd, client->request + client->received,
+	            client->length - client->received);
+	if (len < 0 && errno == EAGAIN)
+		return;
+	if (len <= 0) {
+		daemon_client_destroy (client);
+		return;
+	}
+	client->received += len;
+	if (client->received < client->length)
+		return;
+
+	if (daemon_client_show (client) < 0)
+		daemon_client_reject (client);
 }
 
 static void
-entry_click_handler(struct widget *widget,
-		struct input *input, uint32_t time,
-		uint32_t button,
-		enum wl_pointer_button_state state, void *data)
+daemon_client_create (struct daemon *daemon, int fd)
 {
-	struct entry *entry = data;
-
-	widget_schedule_redraw (widget);
-
-	if (state == WL_POINTER_BUTTON_STATE_PRESSED && button == BTN_LEFT) {
-		if (!entry->text_input) {
-			entry->text_input = wl_text_input_manager_create_text_input (text_input_manager);
-			wl_text_input_add_listener (entry->text_input, &text_input_listener, entry);
-		}
+	struct daemon_client *client;
 
-		struct wl_seat *seat = input_get_seat (input);
-		struct wl_surface *surface = window_get_wl_surface (message_window->window);
-		wl_text_input_show_input_panel (entry->text_input);
-		wl_text_input_activate (entry->text_input, seat, surface);
+	client = xzalloc (sizeof *client);
+	client->daemon = daemon;
+	client->fd = fd;
+	client->task.run = daemon_client_data;
+	wl_list_insert (&daemon->client_list, &client->link);
 
-		entry->active = 1;
-	}
+	display_watch_fd (daemon->display, fd, EPOLLIN | EPOLLRDHUP, &client->task);
 }
 
 static void
-entry_touch_handler(struct widget *widget, struct input *input,
-		 uint32_t serial, uint32_t time, int32_t id,
-		 float tx, float ty, void *data)
+daemon_accept (struct task *task, uint32_t events)
 {
-	struct entry *entry = data;
-
-	widget_schedule_redraw (widget);
+	struct daemon *daemon = container_of (task, struct daemon, task);
+	int fd;
 
-	if (!entry->text_input) {
-		entry->text_input = wl_text_input_manager_create_text_input (text_input_manager);
-		wl_text_input_add_listener (entry->text_input, &text_input_listener, entry);
-	}
-
-	struct wl_seat *seat = input_get_seat (input);
-	struct wl_surface *surface = window_get_wl_surface (message_window->window);
-	wl_text_input_show_input_panel (entry->text_input);
-	wl_text_input_activate (entry->text_input, seat, surface);
+	fd = accept4 (daemon->fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	if (fd < 0)
+		return;
 
-	entry->active = 1;
+	daemon_client_create (daemon, fd);
 }
 
+/* Only a socket nobody answers on is stale and can be replaced */
 static int
-entry_motion_handler(struct widget *widget,
-		struct input *input, uint32_t time,
-		float x, float y, void *data)
+daemon_listen (struct sockaddr_un *addr)
 {
-	return CURSOR_IBEAM;
-}
-
-static void
-entry_redraw_handler (struct widget *widget, void *data)
-{
-	struct entry *entry = data;
-	struct rectangle allocation;
-	cairo_t *cr;
-	cairo_text_extents_t extents;
-	cairo_text_extents_t leftp_extents;
-	char *leftp_text;
-	int char_pos;
-
-	widget_get_allocation (widget, &allocation);
-
-	cr = widget_cairo_create (message_window->widget);
-	cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
-	cairo_rectangle (cr,
-	                allocation.x,
-	                allocation.y,
-	                allocation.width,
-	                allocation.height);
-	cairo_set_source_rgb (cr, 1.0, 1.0, 1.0);
-	cairo_fill (cr);
-	cairo_set_line_width (cr, 1);
-	cairo_rectangle (cr,
-			allocation.x,
-			allocation.y,
-			allocation.width,
-			allocation.height);
-	if (entry->active)
-		cairo_set_source_rgb (cr, 0.0, 0.0, 1.0);
-	else
-		cairo_set_source_rgb (cr, 0.0, 0.0, 0.0);
-	cairo_stroke_preserve(cr);
-
-	cairo_set_source_rgba (cr, 0.0, 0.0, 0.0, 1.0);
-	cairo_select_font_face (cr, "sans",
-	                        CAIRO_FONT_SLANT_NORMAL,
-	                        CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size (cr, 14);
-	cairo_text_extents (cr, entry->text, &extents);
-			char_pos = strlen(entry->text) -1;						/* for spaces at the end */
-			while (char_pos >= 0 && entry->text[char_pos] == ' ') {
-				extents.width += 5.0;
-				char_pos--;
-			}
-	cairo_move_to (cr, allocation.x + (allocation.width - extents.width)/2,
-	        	   allocation.y + (allocation.height - extents.height)/2 + 10);
-	cairo_show_text (cr, entry->text);
-
-	if (entry->active) {
-		leftp_text = malloc (entry->cursor_pos + 1);
-		strncpy (leftp_text, entry->text, entry->cursor_pos);
-		leftp_text[entry->cursor_pos] = '\0';
-		cairo_text_extents (cr, leftp_text, &leftp_extents);
-			char_pos = strlen(leftp_text) -1;
-			while (char_pos >= 0 && leftp_text[char_pos] == ' ') {
-				leftp_extents.width += 5.0;
-				char_pos--;
-			}
-		free (leftp_text);
+	int fd;
+
+	fd = socket (AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd >= 0 &&
+	    connect (fd, (struct sockaddr *) addr, sizeof *addr) == 0) {
+		fprintf (stderr, "a daemon is already listening on %s\n",
+		         addr->sun_path);
+		close (fd);
+		return -1;
+	}
+	if (fd >= 0) {
+		close (fd);
+		fd = socket (AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	}
 
-		cairo_move_to (cr, allocation.x + (allocation.width - extents.width)/2 + leftp_extents.width,
-		        	   allocation.y + (allocation.height - extents.height)/2 + 15);
-		cairo_line_to(cr, allocation.x + (allocation.width - extents.width)/2 + leftp_extents.width,
-		        	   allocation.y + (allocation.height - extents.height)/2 - 5);
-		cairo_stroke(cr);
+	unlink (addr->sun_path);
+	if (fd < 0 ||
+	    bind (fd, (struct sockaddr *) addr, sizeof *addr) < 0 ||
+	    listen (fd, 16) < 0) {
+		fprintf (stderr, "cannot listen on %s: %m\n", addr->sun_path);
+		if (fd >= 0)
+			close (fd);
+		return -1;
 	}
 
-	cairo_destroy (cr);
+	return fd;
 }
 
-static void
-resize_handler (struct widget *widget, int32_t width, int32_t height, void *data)
+static int
+daemon_run (void)
 {
-	struct message_window *message_window = data;
-	struct entry *entry;
-	struct button *button;
-	struct rectangle allocation;
-	int buttons_width, extended_width;
-	int x;
+	struct daemon daemon;
+	struct daemon_client *client, *tmp;
+	struct sockaddr_un addr;
 
-	widget_get_allocation (widget, &allocation);
+	if (daemon_socket_path (&addr) < 0)
+		return 1;
 
-	x = allocation.x + (width - 240)/2;
+	daemon.display = open_display ();
+	if (!daemon.display)
+		return 1;
 
-	if (message_window->entry) {
-		entry = message_window->entry;
-		widget_set_allocation (entry->widget, x, allocation.y + height - 16*2 - 32*2,
-		                                      240, 32);
+	daemon.fd = daemon_listen (&addr);
+	if (daemon.fd < 0) {
+		display_destroy (daemon.display);
+		return 1;
 	}
 
-	buttons_width = 0;
-	wl_list_for_each (button, &message_window->button_list, link) {
-		extended_width = strlen(button->caption) - 5;
-		if (extended_width < 0) extended_width = 0;
-		buttons_width += 60 + extended_width*10;
-	}
+	daemon.single = 0;
+	wl_list_init (&daemon.client_list);
+	daemon.task.run = daemon_accept;
+	display_watch_fd (daemon.display, daemon.fd, EPOLLIN, &daemon.task);
 
-	x = allocation.x + (width - buttons_width)/2
-	                 - (message_window->buttons_nb-1)*10;
+	display_run (daemon.display);
 
-	wl_list_for_each (button, &message_window->button_list, link) {
-		extended_width = strlen(button->caption) - 5;
-		if (extended_width < 0) extended_width = 0;
-		widget_set_allocation (button->widget, x, allocation.y + height - 16 - 32,
-		                                       60 + extended_width*10, 32); 
-		x += 60 + extended_width*10 + 10;
-	}
+	wl_list_for_each_safe (client, tmp, &daemon.client_list, link)
+		daemon_client_destroy (client);
+	display_unwatch_fd (daemon.display, daemon.fd);
+	close (daemon.fd);
+	unlink (addr.sun_path);
+	display_destroy (daemon.display);
+
+	return 0;
 }
 
-static void
-redraw_handler (struct widget *widget, void *data)
+/*
+ * -zygote serves the requests of -client like -daemon does, but shows
+ * each dialog in a process of its own. The parent never connects: it
+ * only preloads the theme, frame icons and fonts, and keeps a child
+ * forked ahead, waiting on the socket. The child taking a request
+ * tells the parent to fork the next one, then connects and shows the
+ * dialog.
+ */
+static int
+zygote_child (int listen_fd, int ready_fd)
 {
-	struct message_window *message_window = data;
-	struct rectangle allocation;
-	cairo_surface_t *surface;
-	cairo_t *cr;
-	cairo_text_extents_t extents;
-	int lines_nb;
-	char **lines;
-
-	widget_get_allocation (message_window->widget, &allocation);
-
-	surface = window_get_surface (message_window->window);
-	cr = cairo_create (surface);
-	cairo_set_operator (cr, CAIRO_OPERATOR_SOURCE);
-	cairo_rectangle (cr,
-			allocation.x,
-			allocation.y,
-			allocation.width,
-			allocation.height);
-	cairo_set_source_rgba (cr, 0.5, 0.5, 0.5, 1.0);
-	cairo_fill (cr);
-
-	if (message_window->icon) {
-			cairo_set_source_surface (cr, message_window->icon,
-			                              allocation.x + (allocation.width - 64.0)/2,
-			                              allocation.y + 10);
-			cairo_set_operator (cr, CAIRO_OPERATOR_OVER);
-			cairo_paint (cr);
-			cairo_set_source_surface (cr, surface, 0.0, 0.0);
+	struct daemon daemon;
+	struct daemon_client *client, *tmp;
+	int fd;
+
+	do {
+		fd = accept4 (listen_fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+	} while (fd < 0 && errno == EINTR);
+	close (listen_fd);
+	if (fd < 0)
+		return 1;
+
+	if (write (ready_fd, "", 1) != 1)
+		fprintf (stderr, "zygote: %m\n");
+	close (ready_fd);
+
+	daemon.display = open_display ();
+	if (!daemon.display) {
+		close (fd);
+		return 1;
 	}
 
-	cairo_set_source_rgba (cr, 0.0, 0.0, 0.0, 1.0);
-	cairo_select_font_face (cr, "sans",
-	                        CAIRO_FONT_SLANT_NORMAL,
-	                        CAIRO_FONT_WEIGHT_NORMAL);
-	cairo_set_font_size (cr, 18);
+	daemon.fd = -1;
+	daemon.single = 1;
+	wl_list_init (&daemon.client_list);
+	daemon_client_create (&daemon, fd);
 
-	lines_nb = get_number_of_lines (message_window->message);
-	lines = get_lines (message_window->message);
+	display_run (daemon.display);
 
-	int i;
-	for (i = 0; i < lines_nb; i++) {
-		cairo_text_extents (cr, lines[i], &extents);
-		cairo_move_to (cr, allocation.x + (allocation.width - extents.width)/2,
-	        	           allocation.y + (allocation.height - lines_nb * extents.height)/2
-		                                + i*(extents.height+10)
-		                                + (!message_window->icon ? 0 : 32)
-                                                - (!message_window->entry ? 0 : 32)
-                                                - (!message_window->buttons_nb ? 0 : 32));
-		cairo_show_text (cr, lines[i]);
-	}
+	wl_list_for_each_safe (client, tmp, &daemon.client_list, link)
+		daemon_client_destroy (client);
+	display_destroy (daemon.display);
 
-	g_strfreev (lines);
-
-	cairo_destroy (cr);
+	return 0;
 }
 
-static void
-keyboard_focus_handler (struct window *window, struct input *input, void *data)
+static int
+zygote_run (void)
 {
-	struct message_window *message_window = data;
+	struct sockaddr_un addr;
+	int fd, ready[2];
+	ssize_t len;
+	pid_t pid;
+	char c;
 
-	window_schedule_redraw (message_window->window);
-}
+	if (daemon_socket_path (&addr) < 0)
+		return 1;
 
-static void
-key_handler (struct window *window, struct input *input, uint32_t time,
-		 uint32_t key, uint32_t sym, enum wl_keyboard_key_state state,
-		 void *data)
-{
-	struct message_window *message_window = data;
-	struct entry *entry = message_window->entry;
-	char *new_text;
-	char text[16];
+	fd = daemon_listen (&addr);
+	if (fd < 0)
+		return 1;
 
-	if (state == WL_KEYBOARD_KEY_STATE_RELEASED)
-		return;
+	display_preload ();
 
-	if (sym == XKB_KEY_Return || sym == XKB_KEY_KP_Enter) {
-		if (entry)
-			fprintf (stdout, entry->text);
-		message_window_destroy ();
-		exit (default_value);
-	}
+	/* Children are never waited for */
+	signal (SIGCHLD, SIG_IGN);
+
+	for (;;) {
+		if (pipe2 (ready, O_CLOEXEC) < 0) {
+			fprintf (stderr, "zygote: %m\n");
+			break;
+		}
+
+		pid = fork ();
+		if (pid < 0) {
+			fprintf (stderr, "zygote: %m\n");
+			close (ready[0]);
+			close (ready[1]);
+			break;
+		}
 
-	if (entry && entry->active) {
-		switch (sym) {
-			case XKB_KEY_BackSpace:
-				if (entry->cursor_pos == 0)
-					break;
-				new_text = malloc (strlen(entry->text));
-				strncpy (new_text, entry->text, entry->cursor_pos - 1);
-				strcpy (new_text+entry->cursor_pos-1, entry->text+entry->cursor_pos);
-				free (entry->text);
-				entry->text = new_text;
-				entry->cursor_pos--;
-				break;
-			case XKB_KEY_Delete:
-				if (entry->cursor_pos == strlen (entry->text))
-					break;
-				new_text = malloc (strlen(entry->text));
-				strncpy (new_text, entry->text, entry->cursor_pos);
-				strcpy (new_text+entry->cursor_pos, entry->text+entry->cursor_pos+1);
-				free (entry->text);
-				entry->text = new_text;
-				break;
-			case XKB_KEY_Left:
-				if (entry->cursor_pos != 0)
-					entry->cursor_pos--;
-				break;
-			case XKB_KEY_Right:
-				if (entry->cursor_pos != strlen (entry->text))
-					entry->cursor_pos++;
-				break;
-			case XKB_KEY_Tab:
-				break;
-			default:
-				if (strlen(entry->text) >= 18)
-					break;
-				if (xkb_keysym_to_utf8 (sym, text, sizeof(text)) <= 0)
-					break;
-				if (strlen(text) > 1)	/* dismiss non-ASCII characters for now */
-					break;
-				new_text = malloc (strlen(entry->text) + strlen(text) + 1);
-				strncpy (new_text, entry->text, entry->cursor_pos);
-				strcpy (new_text+entry->cursor_pos, text);
-				strcpy (new_text+entry->cursor_pos+strlen(text), entry->text+entry->cursor_pos);
-				free (entry->text);
-				entry->text = new_text;
-				entry->cursor_pos++;
+		if (pid == 0) {
+			close (ready[0]);
+			signal (SIGCHLD, SIG_DFL);
+			exit (zygote_child (fd, ready[1]));
 		}
-		widget_schedule_redraw(entry->widget);
+
+		/* Wait for the child to take a request before forking again */
+		close (ready[1]);
+		do {
+			len = read (ready[0], &c, 1);
+		} while (len < 0 && errno == EINTR);
+		close (ready[0]);
+
+		/* The child died without a request, don't spin on it */
+		if (len != 1)
+			sleep (1);
 	}
-}
 
-void
-message_window_add_entry (char *textfield)
-{
-	struct entry *entry;
-
-	entry = xzalloc (sizeof *entry);
-	entry->widget = widget_add_widget (message_window->widget, entry);
-	entry->text = strdup (textfield);
-	entry->cursor_pos = strlen (entry->text);
-	entry->cursor_anchor = entry->cursor_pos;
-	entry->last_vkb_len = 0;
-	entry->active = 0;
-
-	message_window->entry = entry;
-
-	widget_set_redraw_handler (entry->widget, entry_redraw_handler);
-	widget_set_motion_handler (entry->widget, entry_motion_handler);
-	widget_set_button_handler (entry->widget, entry_click_handler);
-	widget_set_touch_down_handler (entry->widget, entry_touch_handler);
+	close (fd);
+	unlink (addr.sun_path);
+
+	return 1;
 }
 
-void
-message_window_add_button (char *button_desc)
+/*
+ * Returns -1 when no daemon answers, so that the dialog can be shown
+ * by this process instead. A request the daemon rejects is reported on
+ * stderr and exits with status 1, as a local option error would.
+ */
+static int
+client_run (int argc, char *argv[], int *value)
 {
-	struct button *button;
+	struct sockaddr_un addr;
+	struct daemon_reply reply;
+	GString *request;
+	uint32_t length;
+	char *cwd, *text;
+	int fd, i;
+
+	if (daemon_socket_path (&addr) < 0)
+		return -1;
+
+	fd = socket (AF_LOCAL, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+	if (connect (fd, (struct sockaddr *) &addr, sizeof addr) < 0) {
+		close (fd);
+		return -1;
+	}
 
-	gchar **desc = g_strsplit (button_desc, ":", 2);
+	request = g_string_new (NULL);
+	cwd = getcwd (NULL, 0);
+	g_string_append_len (request, cwd ? cwd : "/", strlen (cwd ? cwd : "/") + 1);
+	free (cwd);
+	for (i = 1; i < argc; i++)
+		if (strcmp (argv[i], "-client") != 0)
+			g_string_append_len (request, argv[i], strlen (argv[i]) + 1);
+
+	length = request->len;
+	if (write_all (fd, &length, sizeof length) < 0 ||
+	    write_all (fd, request->str, request->len) < 0 ||
+	    read_all (fd, &reply, sizeof reply) < 0) {
+		g_string_free (request, TRUE);
+		close (fd);
+		return -1;
+	}
+	g_string_free (request, TRUE);
 
-	button = xzalloc (sizeof *button);
-	button->widget = widget_add_widget (message_window->widget, button);
-	button->caption = strdup (desc[0]);
-	button->value = atoi (desc[1]);
+	if (reply.text_length == DAEMON_REPLY_ERROR) {
+		fprintf (stderr, "the daemon rejected the request\n");
+		close (fd);
+		*value = 1;
+		return 0;
+	}
 
-	g_strfreev (desc);
+	if (reply.text_length > 0 && reply.text_length <= DAEMON_MAX_REQUEST) {
+		text = xmalloc (reply.text_length);
+		if (read_all (fd, text, reply.text_length) == 0)
+			fwrite (text, 1, reply.text_length, stdout);
+		free (text);
+	}
+	close (fd);
 
-	widget_set_redraw_handler (button->widget, button_redraw_handler);
-	widget_set_enter_handler (button->widget, button_enter_handler);
-	widget_set_leave_handler (button->widget, button_leave_handler);
-	widget_set_button_handler (button->widget, button_click_handler);
-	widget_set_touch_down_handler (button->widget, button_touch_down_handler);
-	widget_set_touch_up_handler (button->widget, button_touch_up_handler);
+	*value = reply.value;
 
-	wl_list_insert (message_window->button_list.prev, &button->link);
+	return 0;
 }
 
-void
-message_window_create (struct display *display, char *message, char *title, char *titlebuttons, int noresize, char *buttons, char *icon, char *deflt, char *textfield)
+
+/*
+ * -batch reads one dialog per line on stdin, written with the command
+ * line options and shell quoting, e.g.
+ *
+ *	-buttons Yes:1,No:0 -default Yes "Deploy to production ?"
+ *
+ * Empty lines and lines starting with '#' are skipped. The dialogs are
+ * shown on one display, up to -parallel at once, and for each of them
+ * a line "<record> <value>[ <text>]" is written to stdout as it is
+ * answered, records being numbered from 1; "<record> error" when the
+ * line cannot be parsed.
+ */
+struct batch {
+	struct display *display;
+	struct task stdin_task;
+	int eof;
+	GString *input;
+
+	struct wl_list record_list;	/* not shown yet */
+	struct wl_list dialog_list;	/* shown */
+	int shown, parallel;
+	unsigned int records;
+};
+
+struct batch_record {
+	struct batch *batch;
+	unsigned int number;
+	char *line;
+	struct wlmessage *wlmessage;
+	struct wl_list link;
+};
+
+static void
+batch_record_destroy (struct batch_record *record)
 {
-	int frame_type = FRAME_ALL;
-	int extended_width = 0;
-	int lines_nb = 0;
-
-	if (titlebuttons) {
-		frame_type = FRAME_NONE;
-		if (strstr (titlebuttons, "Min"))
-			frame_type = frame_type | FRAME_MINIMIZE;
-		if (strstr (titlebuttons, "Max"))
-			frame_type = frame_type | FRAME_MAXIMIZE;
-		if (strstr (titlebuttons, "Close"))
-			frame_type = frame_type | FRAME_CLOSE;
-	}
+	if (record->wlmessage)
+		wlmessage_destroy (record->wlmessage);
+	wl_list_remove (&record->link);
+	free (record->line);
+	free (record);
+}
 
-	message_window = xzalloc (sizeof *message_window);
-	message_window->window = window_create (display);
-	message_window->widget = window_frame_create (message_window->window, frame_type, !noresize,  message_window);
+static void batch_fill (struct batch *batch);
 
-	message_window->message = message;
+static void
+batch_record_done (struct wlmessage *wlmessage, int value, const char *text,
+                   void *data)
+{
+	struct batch_record *record = data;
+	struct batch *batch = record->batch;
 
-	if (title)
-		message_window->title = strdup (title);
+	if (text)
+		printf ("%u %d %s\n", record->number, value, text);
 	else
-		message_window->title = strdup ("wlmessage");
-	window_set_title (message_window->window, message_window->title);
-
-	message_window->buttons_nb = 0;
-	wl_list_init (&message_window->button_list);
-	if (buttons) {
-		gchar **button_list = g_strsplit (buttons, ",", 3);
-		while (button_list[message_window->buttons_nb] != NULL) {
-			message_window_add_button (button_list[message_window->buttons_nb]);
-			message_window->buttons_nb++;
-		}
-		g_strfreev (button_list);
-	}
-
-	default_value = 0;
-	if (buttons && deflt) {
-		struct button *button;
-		wl_list_for_each (button, &message_window->button_list, link) {
-			if (!strcmp(button->caption, deflt))
-				default_value = button->value;
-		}
-	}
+		printf ("%u %d\n", record->number, value);
+	fflush (stdout);
 
-	if (textfield) {
-		message_window_add_entry (textfield);
-	} else {
-		message_window->entry = NULL;
-	}
+	batch_record_destroy (record);
+	batch->shown--;
+	batch_fill (batch);
+}
 
-	if (icon) {
-		cairo_surface_t *icon_temp = cairo_image_surface_create_from_png (icon);
-		cairo_status_t status = cairo_surface_status (icon_temp);
-		if (status == CAIRO_STATUS_SUCCESS) {
-			message_window->icon = cairo_image_surface_create (CAIRO_FORMAT_ARGB32, 64, 64);
-			cairo_t *icon_cr = cairo_create (message_window->icon);
-			 /* rescale to 64x64 */
-			int width = cairo_image_surface_get_width (icon_temp);
-			int height = cairo_image_surface_get_height (icon_temp);
-			if (width != height != 64) {
-				double ratio = ((64.0/width) < (64.0/height) ? (64.0/width) : (64.0/height));
-				cairo_scale (icon_cr, ratio, ratio);
-			}
-			cairo_set_source_surface (icon_cr, icon_temp, 0.0, 0.0);
-			cairo_paint (icon_cr);
-			cairo_destroy (icon_cr);
-			cairo_surface_destroy (icon_temp);
-		}
-	}
-	else {
-		message_window->icon = NULL;
+static int
+batch_record_show (struct batch_record *record)
+{
+	struct batch *batch = record->batch;
+	struct options options;
+	char **args, **argv;
+	int argc, i;
+
+	if (!g_shell_parse_argv (record->line, &argc, &args, NULL))
+		return -1;
+
+	argv = xzalloc ((argc + 2) * sizeof *argv);
+	argv[0] = "wlmessage";
+	for (i = 0; i < argc; i++)
+		argv[i + 1] = args[i];
+
+	if (parse_options (argc + 1, argv, NULL, &options) < 0 ||
+	    options.render_to || options.daemon || options.client ||
+	    options.zygote || options.batch) {
+		options_release (&options);
+		free (argv);
+		g_strfreev (args);
+		return -1;
 	}
 
-	extended_width = (get_max_length_of_lines (message)) - 35;
-	 if (extended_width < 0) extended_width = 0;
-	lines_nb = get_number_of_lines (message);
+	record->wlmessage = dialog_create (batch->display, &options);
+	wlmessage_show (record->wlmessage, batch_record_done, record);
 
-	window_set_user_data (message_window->window, message_window);
-	window_set_keyboard_focus_handler (message_window->window, keyboard_focus_handler);
-	window_set_key_handler (message_window->window, key_handler);
-	widget_set_redraw_handler (message_window->widget, redraw_handler);
-	widget_set_resize_handler (message_window->widget, resize_handler);
+	options_release (&options);
+	free (argv);
+	g_strfreev (args);
 
-	window_schedule_resize (message_window->window,
-	                        480 + extended_width*10,
-	                        280 + lines_nb*16 + (!message_window->entry ? 0 : 1)*32
-	                                          + (!message_window->buttons_nb ? 0 : 1)*32);
+	return 0;
 }
 
-void
-message_window_destroy ()
+/* Show queued records while there is room, and stop once all are done */
+static void
+batch_fill (struct batch *batch)
 {
-	if (message_window->surface)
-		cairo_surface_destroy (message_window->surface);
-
-	if (message_window->icon)
-		cairo_surface_destroy (message_window->icon);
-
-	struct entry *entry;
-	if (message_window->entry) {
-		entry = message_window->entry;
-		if (entry->text_input)
-			wl_text_input_destroy (entry->text_input);
-		widget_destroy(entry->widget);
-		free (entry->text);
-		free (entry);
+	struct batch_record *record;
+
+	while (batch->shown < batch->parallel &&
+	       !wl_list_empty (&batch->record_list)) {
+		record = container_of (batch->record_list.next,
+		                       struct batch_record, link);
+		wl_list_remove (&record->link);
+		wl_list_insert (batch->dialog_list.prev, &record->link);
+
+		if (batch_record_show (record) < 0) {
+			printf ("%u error\n", record->number);
+			fflush (stdout);
+			batch_record_destroy (record);
+			continue;
+		}
+		batch->shown++;
 	}
 
-	struct button *button, *tmp;
-	wl_list_for_each_safe (button, tmp, &message_window->button_list, link) {
-		wl_list_remove (&button->link);
-		widget_destroy (button->widget);
-		free (button->caption);
-		free (button);
+	if (batch->eof && batch->shown == 0)
+		display_exit (batch->display);
+}
+
+static void
+batch_queue_lines (struct batch *batch)
+{
+	struct batch_record *record;
+	char *start, *end, *line;
+	gsize consumed = 0;
+
+	start = batch->input->str;
+	while ((end = memchr (start, '\n', batch->input->len - consumed)) ||
+	       (batch->eof && consumed < batch->input->len)) {
+		if (!end)
+			end = batch->input->str + batch->input->len;
+
+		line = g_strstrip (g_strndup (start, end - start));
+		consumed += end - start + (end < batch->input->str + batch->input->len);
+		start = batch->input->str + consumed;
+
+		if (line[0] == '\0' || line[0] == '#') {
+			g_free (line);
+			continue;
+		}
+
+		record = xzalloc (sizeof *record);
+		record->batch = batch;
+		record->number = ++batch->records;
+		record->line = strdup (line);
+		g_free (line);
+		wl_list_insert (batch->record_list.prev, &record->link);
 	}
 
-	widget_destroy (message_window->widget);
-	window_destroy (message_window->window);
-	free (message_window->title);
-	free (message_window->message);
-	free (message_window);
+	g_string_erase (batch->input, 0, consumed);
 }
 
 static void
-global_handler(struct display *display, uint32_t name,
-	       const char *interface, uint32_t version, void *data)
+batch_stdin_data (struct task *task, uint32_t events)
 {
-	if (!strcmp(interface, "wl_text_input_manager")) {
-		text_input_manager = display_bind (display, name, &wl_text_input_manager_interface, 1);
+	struct batch *batch = container_of (task, struct batch, stdin_task);
+	char buffer[4096];
+	ssize_t len;
+
+	for (;;) {
+		len = read (STDIN_FILENO, buffer, sizeof buffer);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0 && errno == EAGAIN)
+			break;
+		if (len <= 0) {
+			batch->eof = 1;
+			display_unwatch_fd (batch->display, STDIN_FILENO);
+			break;
+		}
+		g_string_append_len (batch->input, buffer, len);
 	}
+
+	batch_queue_lines (batch);
+	batch_fill (batch);
 }
 
-void
-wlmessage_run (char *message, char *title, char *titlebuttons, int noresize, char *buttons, char *icon, int timeout, char *deflt, char *textfield)
+static int
+batch_run (int parallel)
 {
-	struct display *display = NULL;
+	struct batch batch;
+	struct batch_record *record, *tmp;
+	struct stat st;
+	int stdin_flags = -1;
+
+	memset (&batch, 0, sizeof batch);
+	batch.parallel = parallel > 0 ? parallel : 1;
+	batch.input = g_string_new (NULL);
+	wl_list_init (&batch.record_list);
+	wl_list_init (&batch.dialog_list);
+
+	batch.display = open_display ();
+	if (!batch.display) {
+		g_string_free (batch.input, TRUE);
+		return 1;
+	}
 
-	display = display_create (NULL, NULL);
-	if (!display) {
-		fprintf (stderr, "Failed to connect to a Wayland compositor !\n");
-		return;
+	/* Files and /dev/null cannot be polled, but never block either */
+	batch.stdin_task.run = batch_stdin_data;
+	if (fstat (STDIN_FILENO, &st) == 0 && !S_ISFIFO (st.st_mode) &&
+	    !S_ISSOCK (st.st_mode) && !isatty (STDIN_FILENO)) {
+		batch_stdin_data (&batch.stdin_task, 0);
+	} else {
+		/* stdin may be shared with the parent, restored below */
+		stdin_flags = fcntl (STDIN_FILENO, F_GETFL);
+		if (stdin_flags >= 0)
+			fcntl (STDIN_FILENO, F_SETFL, stdin_flags | O_NONBLOCK);
+		display_watch_fd (batch.display, STDIN_FILENO, EPOLLIN,
+		                  &batch.stdin_task);
 	}
 
-	if (timeout)
-		display_set_timeout (display, timeout);
+	if (!batch.eof || batch.shown > 0)
+		display_run (batch.display);
 
-	message_window_create (display, message, title, titlebuttons, noresize, buttons, icon, deflt, textfield);
-	display_set_global_handler (display, global_handler);
-	display_run (display);
+	wl_list_for_each_safe (record, tmp, &batch.dialog_list, link)
+		batch_record_destroy (record);
+	wl_list_for_each_safe (record, tmp, &batch.record_list, link)
+		batch_record_destroy (record);
+	if (!batch.eof)
+		display_unwatch_fd (batch.display, STDIN_FILENO);
+	if (stdin_flags >= 0)
+		fcntl (STDIN_FILENO, F_SETFL, stdin_flags);
+	display_destroy (batch.display);
+	g_string_free (batch.input, TRUE);
 
-	message_window_destroy ();
-	display_destroy (display);
+	return 0;
 }
 
 
@@ -916,100 +894,225 @@ read_from_file (char *filename)
 	return text;
 }
 
-int
-main (int argc, char *argv[])
+static char *
+resolve_path (const char *cwd, const char *path)
 {
-	if (argc < 2) {
-		printf ("usage: wlmessage [-options] [message ...]\n"
-                        "\n"
-                        "where options include:\n"
-                        "    -file filename              file to read message from\n"
-                        "    -buttons string             comma-separated list of label:exitcode\n"
-                        "    -default button             button to activate if Return is pressed\n"
-                        "    -textfield text             text field with default text\n"
-                        "    -timeout secs               exit with status 0 after \"secs\" seconds\n"
-                        "    -title title                window has this title\n"
-                        "    -titlebuttons string        comma-separated list of \"Min, Max, Close, None\"\n"
-                        "    -no-resize                  window is not resizable\n"
-                        "    -icon filename              window shows this PNG icon\n"
-                        "\n");
-		return 0;
-	}
+	if (!cwd || path[0] == '/')
+		return strdup (path);
 
+	return g_strdup_printf ("%s/%s", cwd, path);
+}
 
+/*
+ * Relative paths are taken from cwd when it is set, that of a client
+ * of the daemon. Strings stay owned by argv, except for message and
+ * icon which options_release() frees.
+ */
+static int
+parse_options (int argc, char *argv[], const char *cwd, struct options *options)
+{
+	char *path;
 	int i;
-	char *message = NULL;
-	char *buttons = NULL;
-	char *deflt = NULL;
-	char *textfield = NULL;
-	char *title = NULL;
-	char *titlebuttons = NULL;
-	char *icon = NULL;
-	int timeout = 0;
-	int noresize = 0;
+
+	memset (options, 0, sizeof *options);
 
 	for (i = 1; i < argc ; i++) {
 
 		if (!strcmp (argv[i], "-file")) {
-			if (argc >= i+2)
-				message = read_from_file (argv[i+1]);
+			if (argc >= i+2 && !options->message) {
+				path = resolve_path (cwd, argv[i+1]);
+				options->message = read_from_file (path);
+				free (path);
+			}
 			i++; continue;
 		}
 
 		if (!strcmp (argv[i], "-buttons")) {
 			if (argc >= i+2)
-				buttons = argv[i+1];
+				options->buttons = argv[i+1];
 			i++; continue;
 		}
 
 		if (!strcmp (argv[i], "-default")) {
 			if (argc >= i+2)
-				deflt = argv[i+1];
+				options->deflt = argv[i+1];
 			i++; continue;
 		}
 
 		if (!strcmp (argv[i], "-textfield")) {
 			if (argc >= i+2)
-				textfield = argv[i+1];
+				options->textfield = argv[i+1];
 			i++; continue;
 		}
 
 		if (!strcmp (argv[i], "-title")) {
 			if (argc >= i+2)
-				title = argv[i+1];
+				options->title = argv[i+1];
 			i++; continue;
 		}
 
 		if (!strcmp (argv[i], "-titlebuttons")) {
 			if (argc >= i+2)
-				titlebuttons = argv[i+1];
+				options->titlebuttons = argv[i+1];
 			i++; continue;
 		}
 
 		if (!strcmp (argv[i], "-no-resize")) {
-			noresize = 1;
+			options->noresize = 1;
+			continue;
+		}
+
+		if (!strcmp (argv[i], "-trace-startup")) {
+			options->trace_startup = 1;
+			continue;
+		}
+
+		if (!strcmp (argv[i], "-compact")) {
+			options->compact = 1;
+			continue;
+		}
+
+		if (!strcmp (argv[i], "-low-memory")) {
+			options->low_memory = 1;
 			continue;
 		}
 
 		if (!strcmp (argv[i], "-icon")) {
-			if (argc >= i+2)
-				icon = argv[i+1];
+			if (argc >= i+2) {
+				free (options->icon);
+				options->icon = resolve_path (cwd, argv[i+1]);
+			}
 			i++; continue;
 		}
 
+		if (!strcmp (argv[i], "-render-to")) {
+			if (argc < i+3) {
+				fprintf (stderr, "usage: -render-to file.png WIDTHxHEIGHT\n");
+				return -1;
+			}
+			options->render_to = argv[i+1];
+			if (sscanf (argv[i+2], "%dx%d", &options->render_width, &options->render_height) != 2 ||
+			    options->render_width <= 0 || options->render_height <= 0) {
+				fprintf (stderr, "invalid size \"%s\", expected WIDTHxHEIGHT\n", argv[i+2]);
+				return -1;
+			}
+			i += 2; continue;
+		}
+
 		if (!strcmp (argv[i], "-timeout")) {
-			if (argc >= i+2)
-				timeout = atoi (argv[i+1]);
+			if (argc >= i+2) {
+				char *end;
+				double secs = strtod (argv[i+1], &end);
+
+				if (end == argv[i+1] || *end != '\0' || !(secs >= 0) || secs > INT_MAX / 1000) {
+					fprintf (stderr, "invalid timeout \"%s\", expected seconds\n", argv[i+1]);
+					return -1;
+				}
+				options->timeout = secs * 1000;
+				 /* 0 means no timeout, so never round a short one down to it */
+				if (options->timeout == 0 && secs > 0)
+					options->timeout = 1;
+			}
 			i++; continue;
 		}
 
-		if (!message)
-			message = strdup (argv[i]);
-	}
+		if (!strcmp (argv[i], "-daemon")) {
+			options->daemon = 1;
+			continue;
+		}
+
+		if (!strcmp (argv[i], "-client")) {
+			options->client = 1;
+			continue;
+		}
+
+		if (!strcmp (argv[i], "-zygote")) {
+			options->zygote = 1;
+			continue;
+		}
 
-	wlmessage_run (message, title, titlebuttons, noresize, buttons, icon, timeout, deflt, textfield);
+		if (!strcmp (argv[i], "-batch")) {
+			options->batch = 1;
+			continue;
+		}
+
+		if (!strcmp (argv[i], "-parallel")) {
+			if (argc >= i+2)
+				options->parallel = atoi (argv[i+1]);
+			i++; continue;
+		}
 
+		if (!options->message)
+			options->message = strdup (argv[i]);
+	}
 
 	return 0;
 }
 
+static void
+options_release (struct options *options)
+{
+	free (options->message);
+	free (options->icon);
+}
+
+int
+main (int argc, char *argv[])
+{
+	struct options options;
+	int ret = 0;
+
+	if (argc < 2) {
+		printf ("usage: wlmessage [-options] [message ...]\n"
+                        "\n"
+                        "where options include:\n"
+                        "    -file filename              file to read message from\n"
+                        "    -buttons string             comma-separated list of label:exitcode\n"
+                        "    -default button             button to activate if Return is pressed\n"
+                        "    -textfield text             text field with default text\n"
+                        "    -timeout secs               exit with status 0 after \"secs\" seconds (e.g. 2.5)\n"
+                        "    -title title                window has this title\n"
+                        "    -titlebuttons string        comma-separated list of \"Min, Max, Close, None\"\n"
+                        "    -no-resize                  window is not resizable\n"
+                        "    -icon filename              window shows this PNG icon\n"
+                        "    -compact                    opaque frame without shadow\n"
+                        "    -low-memory                 16-bit single-buffered rendering, implies -compact\n"
+                        "    -trace-startup              print the startup timeline on stderr\n"
+                        "    -render-to file.png WxH     paint the dialog into a PNG, no compositor needed\n"
+                        "    -daemon                     serve the dialogs of -client over a socket\n"
+                        "    -client                     have the running -daemon or -zygote show the dialog\n"
+                        "    -zygote                     like -daemon, with one process forked per dialog\n"
+                        "    -batch                      show the dialogs read from stdin, one per line\n"
+                        "    -parallel n                 with -batch, show up to n dialogs at once\n"
+                        "\n");
+		return 0;
+	}
+
+	if (parse_options (argc, argv, NULL, &options) < 0) {
+		options_release (&options);
+		return 1;
+	}
+
+	if (options.trace_startup)
+		startup_trace_enable (0);
+
+	if (options.daemon) {
+		ret = daemon_run ();
+	} else if (options.zygote) {
+		ret = zygote_run ();
+	} else if (options.batch) {
+		ret = batch_run (options.parallel);
+	} else if (options.render_to) {
+		if (render_to_png (options.render_to, options.render_width, options.render_height,
+		                   options.message, options.title, options.titlebuttons,
+		                   options.noresize, options.compact || options.low_memory,
+		                   options.buttons, options.icon, options.textfield) < 0)
+			ret = 1;
+	} else if (!options.client || client_run (argc, argv, &ret) < 0) {
+		ret = wlmessage_run (&options);
+	}
+
+	options_release (&options);
+
+	return ret;
+}